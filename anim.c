@@ -0,0 +1,513 @@
+//
+// Frames of an animation, see anim.h
+// The GIF decoder is built in (no extra library needed), APNG frames are decoded with libpng by feeding every frame
+// as a separate PNG stream (IHDR of the frame + the shared chunks + its image data).
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "anim.h"
+
+#ifdef USE_PNG
+#include <png.h>
+#endif
+
+#define PIXEL(r, g, b, a) (((uint32_t) (a) << 24) | ((uint32_t) (b) << 16) | ((uint32_t) (g) << 8) | (uint32_t) (r))
+
+void anim_init(anim_t * anim, int width, int height){
+    memset(anim, 0, sizeof(anim_t));
+    anim->width = width;
+    anim->height = height;
+}
+
+void anim_free(anim_t * anim){
+    free(anim->pixels);
+    free(anim->delays);
+    anim->pixels = NULL;
+    anim->delays = NULL;
+    anim->frame_count = 0;
+    anim->capacity = 0;
+}
+
+int anim_add_frame(anim_t * anim, const uint32_t * image, int image_width, int image_height, unsigned int delay){
+    int x, y;
+
+    if (anim->frame_count == anim->capacity){
+        int capacity = anim->capacity ? anim->capacity * 2 : 8;
+        uint32_t * pixels = (uint32_t *) realloc(anim->pixels, sizeof(uint32_t) * capacity * anim->width * anim->height);
+        if (pixels == NULL) return -2;
+        anim->pixels = pixels;
+        unsigned int * delays = (unsigned int *) realloc(anim->delays, sizeof(unsigned int) * capacity);
+        if (delays == NULL) return -2;
+        anim->delays = delays;
+        anim->capacity = capacity;
+    }
+
+    //nearest neighbour scaling, the columns of the source are computed once per frame in 16.16 fixed point
+    uint32_t * dst = anim_frame(anim, anim->frame_count);
+    uint32_t step_x = ((uint32_t) image_width << 16) / anim->width;
+    uint32_t step_y = ((uint32_t) image_height << 16) / anim->height;
+    for (y = 0; y < anim->height; y++){
+        const uint32_t * src = &image[(size_t) ((y * step_y) >> 16) * image_width];
+        uint32_t sx = 0;
+        for (x = 0; x < anim->width; x++, sx += step_x){
+            uint32_t pixel = src[sx >> 16];
+            uint32_t a = pixel >> 24;
+            if (a == 255){
+                *dst++ = pixel & 0xFFFFFF;
+            }else{ //blend with black
+                *dst++ = ((((pixel & 0xFF) * a) / 255)) | ((((pixel >> 8) & 0xFF) * a / 255) << 8) | ((((pixel >> 16) & 0xFF) * a / 255) << 16);
+            }
+        }
+    }
+    anim->delays[anim->frame_count++] = delay;
+    return 0;
+}
+
+static unsigned char * read_file(const char * filename, size_t * size){
+    FILE * file = fopen(filename, "rb");
+    unsigned char * data = NULL;
+    long len;
+
+    if (file == NULL) return NULL;
+    if (fseek(file, 0, SEEK_END) == 0 && (len = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0){
+        data = (unsigned char *) malloc(len);
+        if (data != NULL && fread(data, 1, len, file) != (size_t) len){
+            free(data);
+            data = NULL;
+        }
+        *size = len;
+    }
+    fclose(file);
+    return data;
+}
+
+//
+// GIF
+//
+
+#define GIF_MAX_CODES 4096
+
+//decodes the LZW data of one GIF image to width*height color indices
+static int gif_lzw_decode(const unsigned char * data, size_t size, int min_code_size, unsigned char * out, size_t out_len){
+    unsigned short prefix[GIF_MAX_CODES];
+    unsigned char suffix[GIF_MAX_CODES];
+    unsigned char stack[GIF_MAX_CODES + 1];
+    int clear = 1 << min_code_size, eoi = clear + 1;
+    int next = clear + 2, code_size = min_code_size + 1, old = -1, first = 0;
+    size_t bit = 0, pos = 0;
+    int code, i;
+
+    if (min_code_size < 2 || min_code_size > 8) return -1;
+    for (i = 0; i < clear; i++){
+        prefix[i] = 0;
+        suffix[i] = i;
+    }
+
+    while (pos < out_len && bit + code_size <= size * 8){
+        code = 0;
+        for (i = 0; i < code_size; i++, bit++){
+            code |= ((data[bit >> 3] >> (bit & 7)) & 1) << i;
+        }
+
+        if (code == clear){
+            next = clear + 2;
+            code_size = min_code_size + 1;
+            old = -1;
+            continue;
+        }
+        if (code == eoi) break;
+        if (old == -1){
+            if (code >= clear) return -1;
+            out[pos++] = first = code;
+            old = code;
+            continue;
+        }
+        if (code > next) return -1;
+
+        int in = code, sp = 0;
+        if (code == next){ //code that is defined by this step (KwKwK)
+            stack[sp++] = first;
+            code = old;
+        }
+        while (code >= clear){
+            stack[sp++] = suffix[code];
+            code = prefix[code];
+        }
+        first = code;
+        stack[sp++] = first;
+        while (sp > 0 && pos < out_len) out[pos++] = stack[--sp];
+
+        if (next < GIF_MAX_CODES){
+            prefix[next] = old;
+            suffix[next] = first;
+            next++;
+            if (next == (1 << code_size) && code_size < 12) code_size++;
+        }
+        old = in;
+    }
+    //missing pixels of a truncated image stay at the first color
+    if (pos < out_len) memset(out + pos, 0, out_len - pos);
+    return 0;
+}
+
+int anim_load_gif(anim_t * anim, const char * filename){
+    size_t size = 0, pos;
+    unsigned char * gif = read_file(filename, &size);
+    unsigned char * indices = NULL, * lzw = NULL;
+    uint32_t * screen = NULL, * previous = NULL;
+    uint32_t global_palette[256], local_palette[256];
+    int width, height, result = -1;
+    int transparent = -1, disposal = 0;
+    unsigned int delay = 0;
+
+    if (gif == NULL) return -1;
+    if (size < 13 || (memcmp(gif, "GIF87a", 6) != 0 && memcmp(gif, "GIF89a", 6) != 0)) goto done;
+
+    width = gif[6] | (gif[7] << 8);
+    height = gif[8] | (gif[9] << 8);
+    if (width == 0 || height == 0) goto done;
+    pos = 13;
+
+    #define READ_PALETTE(palette, flags) { \
+        int i, n = 2 << ((flags) & 7); \
+        if (pos + n * 3 > size) goto done; \
+        for (i = 0; i < n; i++, pos += 3) palette[i] = PIXEL(gif[pos], gif[pos + 1], gif[pos + 2], 255); \
+        for (; i < 256; i++) palette[i] = PIXEL(0, 0, 0, 255); \
+    }
+
+    memset(global_palette, 0, sizeof(global_palette));
+    if (gif[10] & 0x80) READ_PALETTE(global_palette, gif[10]);
+
+    screen = (uint32_t *) calloc((size_t) width * height, sizeof(uint32_t));
+    previous = (uint32_t *) malloc(sizeof(uint32_t) * width * height);
+    lzw = (unsigned char *) malloc(size);
+    if (screen == NULL || previous == NULL || lzw == NULL){
+        result = -2;
+        goto done;
+    }
+
+    while (pos < size){
+        unsigned char block = gif[pos++];
+
+        if (block == 0x3B) break; //trailer
+
+        if (block == 0x21){ //extension
+            if (pos >= size) goto done;
+            unsigned char label = gif[pos++];
+            if (label == 0xF9 && pos + 5 < size && gif[pos] == 4){ //graphic control extension
+                disposal = (gif[pos + 1] >> 2) & 7;
+                delay = (gif[pos + 2] | (gif[pos + 3] << 8)) * 10;
+                transparent = (gif[pos + 1] & 1) ? gif[pos + 4] : -1;
+            }
+            while (pos < size && gif[pos] != 0) pos += gif[pos] + 1; //skip the sub blocks
+            pos++;
+            continue;
+        }
+
+        if (block != 0x2C || pos + 9 > size) goto done; //image descriptor
+
+        int left = gif[pos] | (gif[pos + 1] << 8);
+        int top = gif[pos + 2] | (gif[pos + 3] << 8);
+        int frame_width = gif[pos + 4] | (gif[pos + 5] << 8);
+        int frame_height = gif[pos + 6] | (gif[pos + 7] << 8);
+        unsigned char flags = gif[pos + 8];
+        uint32_t * palette = global_palette;
+        size_t lzw_size = 0;
+        int x, y, row;
+
+        pos += 9;
+        if (flags & 0x80){
+            READ_PALETTE(local_palette, flags);
+            palette = local_palette;
+        }
+        if (pos >= size) goto done;
+        int min_code_size = gif[pos++];
+        while (pos < size && gif[pos] != 0){ //collect the sub blocks of the image data
+            size_t len = gif[pos];
+            if (pos + 1 + len > size) goto done;
+            memcpy(lzw + lzw_size, gif + pos + 1, len);
+            lzw_size += len;
+            pos += len + 1;
+        }
+        pos++;
+
+        free(indices);
+        indices = (unsigned char *) malloc((size_t) frame_width * frame_height + 1);
+        if (indices == NULL){
+            result = -2;
+            goto done;
+        }
+        if (gif_lzw_decode(lzw, lzw_size, min_code_size, indices, (size_t) frame_width * frame_height) != 0) goto done;
+
+        if (disposal == 3) memcpy(previous, screen, sizeof(uint32_t) * width * height);
+
+        //draw the frame on the screen, interlaced images store the rows in 4 passes
+        for (row = 0; row < frame_height; row++){
+            y = row;
+            if (flags & 0x40){
+                int pass1 = (frame_height + 7) / 8, pass2 = (frame_height + 3) / 8, pass3 = (frame_height + 1) / 4;
+                if (row < pass1) y = row * 8;
+                else if (row < pass1 + pass2) y = (row - pass1) * 8 + 4;
+                else if (row < pass1 + pass2 + pass3) y = (row - pass1 - pass2) * 4 + 2;
+                else y = (row - pass1 - pass2 - pass3) * 2 + 1;
+            }
+            if (top + y >= height) continue;
+            const unsigned char * src = &indices[row * frame_width];
+            for (x = 0; x < frame_width && left + x < width; x++){
+                if (src[x] != transparent) screen[(top + y) * width + left + x] = palette[src[x]];
+            }
+        }
+
+        result = anim_add_frame(anim, screen, width, height, delay);
+        if (result != 0) goto done;
+
+        //dispose the frame before the next one is drawn
+        if (disposal == 2){
+            for (y = top; y < top + frame_height && y < height; y++){
+                for (x = left; x < left + frame_width && x < width; x++) screen[y * width + x] = 0;
+            }
+        }else if (disposal == 3){
+            memcpy(screen, previous, sizeof(uint32_t) * width * height);
+        }
+        transparent = -1;
+        disposal = 0;
+        delay = 0;
+    }
+    #undef READ_PALETTE
+    result = anim->frame_count > 0 ? 0 : -1;
+
+done:
+    if (result == -1 && anim->frame_count > 0) result = 0; //show the frames before a damaged block
+    free(gif);
+    free(lzw);
+    free(indices);
+    free(screen);
+    free(previous);
+    return result;
+}
+
+//
+// APNG
+//
+
+#ifdef USE_PNG
+
+typedef struct {
+    const unsigned char * data;
+    size_t size;
+    size_t pos;
+} png_memory_t;
+
+static void png_read_memory(png_structp png, png_bytep out, png_size_t len){
+    png_memory_t * memory = (png_memory_t *) png_get_io_ptr(png);
+    if (memory->pos + len > memory->size) png_error(png, "read past end of frame");
+    memcpy(out, memory->data + memory->pos, len);
+    memory->pos += len;
+}
+
+static uint32_t read_uint32(const unsigned char * p){
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static void write_uint32(unsigned char * p, uint32_t value){
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+//appends a chunk to buffer, the CRC is not computed (CRC checks are disabled while decoding the frame)
+static unsigned char * append_chunk(unsigned char * buffer, const char * type, const unsigned char * data, uint32_t len){
+    write_uint32(buffer, len);
+    memcpy(buffer + 4, type, 4);
+    if (len > 0) memcpy(buffer + 8, data, len);
+    memset(buffer + 8 + len, 0, 4);
+    return buffer + 12 + len;
+}
+
+//decodes a PNG stream to width*height 0xAABBGGRR pixels
+static int decode_png_stream(const unsigned char * data, size_t size, uint32_t * pixels, uint32_t width, uint32_t height){
+    png_memory_t memory = {data, size, 0};
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = NULL;
+    png_bytep * volatile rows = NULL;
+    uint32_t y;
+
+    if (png == NULL) return -2;
+    info = png_create_info_struct(png);
+    if (info == NULL){
+        png_destroy_read_struct(&png, NULL, NULL);
+        return -2;
+    }
+    if (setjmp(png_jmpbuf(png))){
+        png_destroy_read_struct(&png, &info, NULL);
+        free(rows);
+        return -1;
+    }
+
+    png_set_read_fn(png, &memory, png_read_memory);
+    png_set_crc_action(png, PNG_CRC_QUIET_USE, PNG_CRC_QUIET_USE);
+    png_read_info(png, info);
+    if (png_get_image_width(png, info) != width || png_get_image_height(png, info) != height) png_error(png, "unexpected size");
+
+    //convert everything to 8 bit RGBA, the bytes of a pixel are then 0xAABBGGRR on little endian
+    png_set_expand(png);
+    png_set_strip_16(png);
+    png_set_gray_to_rgb(png);
+    png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
+    png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+
+    rows = (png_bytep *) malloc(sizeof(png_bytep) * height);
+    if (rows == NULL) png_error(png, "out of memory");
+    for (y = 0; y < height; y++) rows[y] = (png_bytep) &pixels[(size_t) y * width];
+    png_read_image(png, rows);
+
+    //the bytes are R,G,B,A in memory, make sure the pixels have the same layout on every platform
+    for (y = 0; y < width * height; y++){
+        unsigned char * p = (unsigned char *) &pixels[y];
+        pixels[y] = PIXEL(p[0], p[1], p[2], p[3]);
+    }
+
+    png_destroy_read_struct(&png, &info, NULL);
+    free(rows);
+    return 0;
+}
+
+int anim_load_png(anim_t * anim, const char * filename){
+    static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    size_t size = 0, pos, shared_size = 0;
+    unsigned char * file = read_file(filename, &size);
+    unsigned char * frame = NULL, * shared = NULL, * end = NULL;
+    uint32_t * screen = NULL, * image = NULL, * previous = NULL;
+    const unsigned char * ihdr = NULL, * fctl = NULL;
+    uint32_t width = 0, height = 0;
+    int animated = 0, result = -1;
+
+    if (file == NULL) return -1;
+    if (size < 8 + 25 || memcmp(file, signature, 8) != 0) goto done;
+
+    //first pass: find the header, the chunks all frames share and whether the file is animated
+    shared = (unsigned char *) malloc(size);
+    frame = (unsigned char *) malloc(size + 64);
+    if (shared == NULL || frame == NULL){
+        result = -2;
+        goto done;
+    }
+    for (pos = 8; pos + 12 <= size; ){
+        uint32_t len = read_uint32(file + pos);
+        const unsigned char * type = file + pos + 4;
+        if (pos + 12 + len > size) goto done;
+        if (memcmp(type, "IHDR", 4) == 0 && len == 13){
+            ihdr = type + 4;
+        }else if (memcmp(type, "acTL", 4) == 0){
+            animated = 1;
+        }else if (memcmp(type, "IDAT", 4) == 0 || memcmp(type, "IEND", 4) == 0){
+            break;
+        }else if (memcmp(type, "fcTL", 4) != 0){ //PLTE, tRNS, gAMA,... are needed for every frame
+            memcpy(shared + shared_size, file + pos, len + 12);
+            shared_size += len + 12;
+        }
+        pos += len + 12;
+    }
+    if (ihdr == NULL) goto done;
+    width = read_uint32(ihdr);
+    height = read_uint32(ihdr + 4);
+    if (width == 0 || height == 0 || width > 0x4000 || height > 0x4000) goto done;
+
+    screen = (uint32_t *) calloc((size_t) width * height, sizeof(uint32_t));
+    image = (uint32_t *) malloc(sizeof(uint32_t) * width * height);
+    previous = (uint32_t *) malloc(sizeof(uint32_t) * width * height);
+    if (screen == NULL || image == NULL || previous == NULL){
+        result = -2;
+        goto done;
+    }
+
+    if (!animated){
+        result = decode_png_stream(file, size, screen, width, height);
+        if (result == 0) result = anim_add_frame(anim, screen, width, height, 0);
+        goto done;
+    }
+
+    //second pass: every fcTL starts a frame, its image data is in the following IDAT or fdAT chunks
+    for (pos = 8; pos + 12 <= size; ){
+        uint32_t len = read_uint32(file + pos);
+        const unsigned char * type = file + pos + 4;
+        int last = memcmp(type, "IEND", 4) == 0;
+
+        if (fctl != NULL && (last || memcmp(type, "fcTL", 4) == 0) && end != NULL){ //previous frame is complete
+            uint32_t frame_width = read_uint32(fctl + 4), frame_height = read_uint32(fctl + 8);
+            uint32_t left = read_uint32(fctl + 12), top = read_uint32(fctl + 16);
+            unsigned int delay_num = (fctl[20] << 8) | fctl[21], delay_den = (fctl[22] << 8) | fctl[23];
+            unsigned char dispose = fctl[24], blend = fctl[25];
+            uint32_t x, y;
+
+            if (frame_width == 0 || frame_height == 0 || left + frame_width > width || top + frame_height > height) goto done;
+            end = append_chunk(end, "IEND", NULL, 0);
+            result = decode_png_stream(frame, end - frame, image, frame_width, frame_height);
+            if (result != 0) goto done;
+
+            if (dispose == 2) memcpy(previous, screen, sizeof(uint32_t) * width * height);
+            for (y = 0; y < frame_height; y++){
+                uint32_t * dst = &screen[(size_t) (top + y) * width + left];
+                const uint32_t * src = &image[(size_t) y * frame_width];
+                for (x = 0; x < frame_width; x++){
+                    uint32_t a = src[x] >> 24;
+                    if (blend == 0 || a == 255){ //APNG_BLEND_OP_SOURCE or opaque
+                        dst[x] = src[x];
+                    }else if (a > 0){ //APNG_BLEND_OP_OVER, alpha is kept scaled by 255 to avoid rounding overflows
+                        uint32_t da = dst[x] >> 24, out_a = a * 255 + da * (255 - a), c, pixel = 0;
+                        for (c = 0; c < 24; c += 8){
+                            uint32_t sc = (src[x] >> c) & 0xFF, dc = (dst[x] >> c) & 0xFF;
+                            pixel |= ((sc * a * 255 + dc * da * (255 - a)) / out_a) << c;
+                        }
+                        dst[x] = pixel | ((out_a / 255) << 24);
+                    }
+                }
+            }
+
+            if (delay_den == 0) delay_den = 100;
+            result = anim_add_frame(anim, screen, width, height, delay_num * 1000 / delay_den);
+            if (result != 0) goto done;
+
+            if (dispose == 1){ //APNG_DISPOSE_OP_BACKGROUND
+                for (y = top; y < top + frame_height; y++) memset(&screen[(size_t) y * width + left], 0, sizeof(uint32_t) * frame_width);
+            }else if (dispose == 2){ //APNG_DISPOSE_OP_PREVIOUS
+                memcpy(screen, previous, sizeof(uint32_t) * width * height);
+            }
+            fctl = NULL;
+        }
+        if (last || pos + 12 + len > size) break;
+
+        if (memcmp(type, "fcTL", 4) == 0 && len >= 26){
+            //start a new PNG stream: signature, IHDR with the size of the frame, the shared chunks
+            unsigned char header[13];
+            memcpy(header, ihdr, 13);
+            memcpy(header, type + 8, 8); //width and height of the frame
+            fctl = type + 4;
+            memcpy(frame, signature, 8);
+            end = append_chunk(frame + 8, "IHDR", header, 13);
+            memcpy(end, shared, shared_size);
+            end += shared_size;
+        }else if (fctl != NULL && memcmp(type, "IDAT", 4) == 0){
+            end = append_chunk(end, "IDAT", type + 4, len);
+        }else if (fctl != NULL && memcmp(type, "fdAT", 4) == 0 && len >= 4){
+            end = append_chunk(end, "IDAT", type + 8, len - 4); //without the sequence number
+        }
+        pos += len + 12;
+    }
+    result = anim->frame_count > 0 ? 0 : -1;
+
+done:
+    free(file);
+    free(frame);
+    free(shared);
+    free(screen);
+    free(image);
+    free(previous);
+    return result;
+}
+
+#endif
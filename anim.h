@@ -0,0 +1,39 @@
+//
+// Frames of an animation (animated GIF, (A)PNG or a numbered PNG sequence), decoded once and scaled to the matrix,
+// so playing an animation only copies the frames to the leds.
+//
+
+#ifndef RPI_LEDMATRIX_SERVER_ANIM_H
+#define RPI_LEDMATRIX_SERVER_ANIM_H
+
+#include <stdint.h>
+
+typedef struct {
+    int width;                  //size of every frame (size of the matrix)
+    int height;
+    int frame_count;
+    int capacity;               //number of frames that fit in pixels/delays
+    uint32_t * pixels;          //frame_count*width*height led colors, frame by frame, row by row
+    unsigned int * delays;      //delay of every frame in ms, 0 = use the default delay
+} anim_t;
+
+//returns the pixels of frame i
+#define anim_frame(anim, i) (&(anim)->pixels[(size_t) (i) * (anim)->width * (anim)->height])
+
+void anim_init(anim_t * anim, int width, int height);
+
+void anim_free(anim_t * anim);
+
+//scales an image (0xAABBGGRR pixels, transparent pixels are black) to the size of the animation and adds it as frame
+//returns 0 on success, -2 out of memory
+int anim_add_frame(anim_t * anim, const uint32_t * image, int image_width, int image_height, unsigned int delay);
+
+//decodes all frames of a GIF file, returns 0 on success, -1 if the file can't be read or is not a valid GIF, -2 out of memory
+int anim_load_gif(anim_t * anim, const char * filename);
+
+#ifdef USE_PNG
+//decodes all frames of an APNG file or the image of a normal PNG file, returns like anim_load_gif
+int anim_load_png(anim_t * anim, const char * filename);
+#endif
+
+#endif //RPI_LEDMATRIX_SERVER_ANIM_H
@@ -0,0 +1,98 @@
+//
+// Baked frame files, see bakedframes.h
+//
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bakedframes.h"
+
+uint32_t baked_frame_delay(const baked_frames_t * baked, unsigned int i){
+    uint32_t delay;
+    memcpy(&delay, baked_frame(baked, i) - 4, sizeof(delay));
+    return delay;
+}
+
+int baked_create(baked_writer_t * writer, const char * filename, const ws2811_raw_config_t * config){
+    memset(writer, 0, sizeof(baked_writer_t));
+    memcpy(writer->header.magic, BAKED_FRAMES_MAGIC, 4);
+    writer->header.version = BAKED_FRAMES_VERSION;
+    writer->header.frame_size = config->raw_size;
+    writer->header.config = *config;
+
+    writer->file = fopen(filename, "wb");
+    if (writer->file == NULL) return -1;
+    //the frame count is written again by baked_finish, until then the file is not valid
+    if (fwrite(&writer->header, sizeof(baked_header_t), 1, writer->file) != 1){
+        fclose(writer->file);
+        writer->file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int baked_write_frame(baked_writer_t * writer, const uint8_t * raw, uint32_t delay){
+    if (fwrite(&delay, sizeof(delay), 1, writer->file) != 1 ||
+        fwrite(raw, writer->header.frame_size, 1, writer->file) != 1) return -1;
+    writer->header.frame_count++;
+    return 0;
+}
+
+int baked_finish(baked_writer_t * writer){
+    int result = 0;
+
+    if (writer->file == NULL) return -1;
+    if (fseek(writer->file, 0, SEEK_SET) != 0 ||
+        fwrite(&writer->header, sizeof(baked_header_t), 1, writer->file) != 1) result = -1;
+    if (fclose(writer->file) != 0) result = -1;
+    writer->file = NULL;
+    return result;
+}
+
+int baked_open(baked_frames_t * baked, const char * filename, const ws2811_raw_config_t * config){
+    struct stat st;
+    int fd;
+
+    memset(baked, 0, sizeof(baked_frames_t));
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0){
+        close(fd);
+        return -1;
+    }
+    if (st.st_size < (off_t) sizeof(baked_header_t)){
+        close(fd);
+        return -3;
+    }
+    baked->map_size = st.st_size;
+    baked->map = mmap(NULL, baked->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (baked->map == MAP_FAILED){
+        baked->map = NULL;
+        return -1;
+    }
+    madvise(baked->map, baked->map_size, MADV_SEQUENTIAL);
+    memcpy(&baked->header, baked->map, sizeof(baked_header_t));
+    baked->frames = (const uint8_t *) baked->map + sizeof(baked_header_t);
+
+    if (memcmp(baked->header.magic, BAKED_FRAMES_MAGIC, 4) != 0 || baked->header.version != BAKED_FRAMES_VERSION ||
+        baked->header.frame_size == 0 ||
+        (baked->map_size - sizeof(baked_header_t)) / (baked->header.frame_size + 4) < baked->header.frame_count){
+        baked_close(baked);
+        return -3;
+    }
+    if (memcmp(&baked->header.config, config, sizeof(ws2811_raw_config_t)) != 0){
+        baked_close(baked);
+        return -4;
+    }
+    return 0;
+}
+
+void baked_close(baked_frames_t * baked){
+    if (baked->map != NULL) munmap(baked->map, baked->map_size);
+    baked->map = NULL;
+    baked->frames = NULL;
+    baked->header.frame_count = 0;
+}
@@ -0,0 +1,62 @@
+//
+// Baked frames: frames stored already encoded to the PWM/PCM/SPI symbols of the DMA buffer, so playing them
+// only copies every frame to the DMA buffer (no color, brightness or gamma conversion and no bit expansion).
+// The encoded data depends on the strip type, brightness, gamma, invert and driver of the channels, the file
+// records this configuration and can only be played with the same configuration.
+//
+// file: baked_header_t, then frame_count records of a uint32_t delay (µs) followed by frame_size bytes
+// The file is written in the byte order of the machine, it is meant to be played where it was baked.
+//
+
+#ifndef RPI_LEDMATRIX_SERVER_BAKEDFRAMES_H
+#define RPI_LEDMATRIX_SERVER_BAKEDFRAMES_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "ws2811.h"
+
+#define BAKED_FRAMES_MAGIC "LEDB"
+#define BAKED_FRAMES_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t frame_count;
+    uint32_t frame_size;            //bytes of an encoded frame (ws2811_raw_size)
+    ws2811_raw_config_t config;     //configuration the frames were encoded with
+} baked_header_t;
+
+typedef struct {
+    FILE * file;
+    baked_header_t header;
+} baked_writer_t;
+
+typedef struct {
+    baked_header_t header;
+    const uint8_t * frames;         //first record
+    void * map;
+    size_t map_size;
+} baked_frames_t;
+
+//returns the encoded data of frame i
+#define baked_frame(baked, i) ((baked)->frames + (size_t) (i) * ((baked)->header.frame_size + 4) + 4)
+
+//returns the delay in µs after frame i
+uint32_t baked_frame_delay(const baked_frames_t * baked, unsigned int i);
+
+//creates a baked frame file for frames encoded with config, returns 0 on success, -1 if the file can't be written
+int baked_create(baked_writer_t * writer, const char * filename, const ws2811_raw_config_t * config);
+
+//appends an encoded frame, returns 0 on success, -1 on a write error
+int baked_write_frame(baked_writer_t * writer, const uint8_t * raw, uint32_t delay);
+
+//writes the frame count and closes the file, returns 0 on success, -1 on a write error
+int baked_finish(baked_writer_t * writer);
+
+//maps a baked frame file, returns 0 on success, -1 if the file can't be read, -3 if it is not a baked frame file,
+//-4 if the frames were encoded with another configuration than config
+int baked_open(baked_frames_t * baked, const char * filename, const ws2811_raw_config_t * config);
+
+void baked_close(baked_frames_t * baked);
+
+#endif //RPI_LEDMATRIX_SERVER_BAKEDFRAMES_H
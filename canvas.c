@@ -0,0 +1,243 @@
+//
+// 2D drawing on the logical canvas of a led matrix, see canvas.h
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "canvas.h"
+#include "span.h"
+
+//part of a canvas row that is consecutive in the index table of the layout
+typedef struct {
+    const int * index; //led index of every pixel of the span
+    int len;
+    int step;          //1 or -1 if the leds of the span are consecutive in the led buffer, 0 otherwise
+} canvas_span_t;
+
+//splits x..x+len of row y (inside the canvas) in the parts that are consecutive in the index table
+//the viewport offset can wrap a row around, so there are at most 2 parts
+static int row_spans(const canvas_t * canvas, int x, int y, int len, canvas_span_t * spans){
+    const led_layout_t * layout = canvas->layout;
+    int row = y + layout->viewport.offset_y;
+    int column = x + layout->viewport.offset_x;
+    int first;
+
+    if (row >= canvas->height) row -= canvas->height;
+    if (column >= canvas->width) column -= canvas->width;
+
+    const int * index = &layout->index[row * canvas->width];
+    first = canvas->width - column;
+    if (first > len) first = len;
+
+    spans[0].index = &index[column];
+    spans[0].len = first;
+    spans[0].step = layout->row_step[row];
+    if (len == first) return 1;
+
+    spans[1].index = index;
+    spans[1].len = len - first;
+    spans[1].step = layout->row_step[row];
+    return 2;
+}
+
+void canvas_init(canvas_t * canvas, led_layout_t * layout, ws2811_led_t * leds){
+    canvas->layout = layout;
+    canvas->leds = leds;
+    canvas->width = layout->width;
+    canvas->height = layout->height;
+}
+
+int canvas_clip(const canvas_t * canvas, int * x, int * y, int * width, int * height){
+    if (*x < 0){
+        *width += *x;
+        *x = 0;
+    }
+    if (*y < 0){
+        *height += *y;
+        *y = 0;
+    }
+    if (*x + *width > canvas->width) *width = canvas->width - *x;
+    if (*y + *height > canvas->height) *height = canvas->height - *y;
+    return *width > 0 && *height > 0;
+}
+
+ws2811_led_t * canvas_pixel(const canvas_t * canvas, int x, int y){
+    canvas_span_t span;
+    if (x < 0 || y < 0 || x >= canvas->width || y >= canvas->height) return NULL;
+    row_spans(canvas, x, y, 1, &span);
+    return &canvas->leds[span.index[0]];
+}
+
+void canvas_fill_rect(canvas_t * canvas, int x, int y, int width, int height, uint32_t color){
+    canvas_span_t spans[2];
+    int row, s, i, n;
+
+    if (!canvas_clip(canvas, &x, &y, &width, &height)) return;
+    for (row = y; row < y + height; row++){
+        n = row_spans(canvas, x, row, width, spans);
+        for (s = 0; s < n; s++){
+            if (spans[s].step == 1){
+                span_fill(&canvas->leds[spans[s].index[0]], spans[s].len, SPAN_OP_SET, color);
+            }else if (spans[s].step == -1){
+                span_fill(&canvas->leds[spans[s].index[0] - spans[s].len + 1], spans[s].len, SPAN_OP_SET, color);
+            }else{
+                for (i = 0; i < spans[s].len; i++) canvas->leds[spans[s].index[i]].color = color;
+            }
+        }
+    }
+}
+
+void canvas_brightness_rect(canvas_t * canvas, int x, int y, int width, int height, uint32_t brightness){
+    canvas_span_t spans[2];
+    int row, s, i, n;
+
+    if (!canvas_clip(canvas, &x, &y, &width, &height)) return;
+    for (row = y; row < y + height; row++){
+        n = row_spans(canvas, x, row, width, spans);
+        for (s = 0; s < n; s++){
+            if (spans[s].step == 1){
+                span_set_component(&canvas->leds[spans[s].index[0]], spans[s].len, SPAN_BRIGHTNESS, brightness);
+            }else if (spans[s].step == -1){
+                span_set_component(&canvas->leds[spans[s].index[0] - spans[s].len + 1], spans[s].len, SPAN_BRIGHTNESS, brightness);
+            }else{
+                for (i = 0; i < spans[s].len; i++) canvas->leds[spans[s].index[i]].brightness = brightness;
+            }
+        }
+    }
+}
+
+//clips the rectangle at x,y and moves the source pointer offset (in pixels) along, returns 0 if nothing is left
+static int clip_source(const canvas_t * canvas, int * x, int * y, int * width, int * height, int stride, int * offset){
+    *offset = 0;
+    if (*x < 0) *offset -= *x;
+    if (*y < 0) *offset -= *y * stride;
+    return canvas_clip(canvas, x, y, width, height);
+}
+
+void canvas_blit_colors(canvas_t * canvas, int x, int y, const uint32_t * colors, int width, int height, int stride){
+    canvas_span_t spans[2];
+    int row, s, i, n, offset;
+
+    if (!clip_source(canvas, &x, &y, &width, &height, stride, &offset)) return;
+    colors += offset;
+    for (row = y; row < y + height; row++, colors += stride){
+        const uint32_t * src = colors;
+        n = row_spans(canvas, x, row, width, spans);
+        for (s = 0; s < n; s++){
+            ws2811_led_t * leds = &canvas->leds[spans[s].index[0]];
+            if (spans[s].step == 1){
+                for (i = 0; i < spans[s].len; i++) leds[i].color = src[i];
+            }else if (spans[s].step == -1){
+                for (i = 0; i < spans[s].len; i++) leds[-i].color = src[i];
+            }else{
+                for (i = 0; i < spans[s].len; i++) canvas->leds[spans[s].index[i]].color = src[i];
+            }
+            src += spans[s].len;
+        }
+    }
+}
+
+void canvas_blit(canvas_t * canvas, int x, int y, const ws2811_led_t * src, int width, int height, int stride){
+    canvas_span_t spans[2];
+    int row, s, i, n, offset;
+
+    if (!clip_source(canvas, &x, &y, &width, &height, stride, &offset)) return;
+    src += offset;
+    for (row = y; row < y + height; row++, src += stride){
+        const ws2811_led_t * line = src;
+        n = row_spans(canvas, x, row, width, spans);
+        for (s = 0; s < n; s++){
+            if (spans[s].step == 1){
+                memcpy(&canvas->leds[spans[s].index[0]], line, sizeof(ws2811_led_t) * spans[s].len);
+            }else{
+                for (i = 0; i < spans[s].len; i++) canvas->leds[spans[s].index[i]] = line[i];
+            }
+            line += spans[s].len;
+        }
+    }
+}
+
+void canvas_read(const canvas_t * canvas, int x, int y, int width, int height, ws2811_led_t * dst, int stride){
+    canvas_span_t spans[2];
+    int row, s, i, n;
+
+    for (row = y; row < y + height; row++, dst += stride){
+        ws2811_led_t * line = dst;
+        n = row_spans(canvas, x, row, width, spans);
+        for (s = 0; s < n; s++){
+            if (spans[s].step == 1){
+                memcpy(line, &canvas->leds[spans[s].index[0]], sizeof(ws2811_led_t) * spans[s].len);
+            }else{
+                for (i = 0; i < spans[s].len; i++) line[i] = canvas->leds[spans[s].index[i]];
+            }
+            line += spans[s].len;
+        }
+    }
+}
+
+void canvas_scroll(canvas_t * canvas, int dx, int dy){
+    led_layout_scroll(canvas->layout, dx, dy);
+}
+
+int canvas_mirror(canvas_t * canvas, int x, int y, int width, int height, int vertical){
+    ws2811_led_t * rows, tmp;
+    int top, bottom, i;
+
+    if (!canvas_clip(canvas, &x, &y, &width, &height)) return 0;
+    rows = (ws2811_led_t *) malloc(sizeof(ws2811_led_t) * width * 2);
+    if (rows == NULL) return -2;
+
+    if (vertical){ //swap the rows from the outside in
+        for (top = y, bottom = y + height - 1; top < bottom; top++, bottom--){
+            canvas_read(canvas, x, top, width, 1, rows, width);
+            canvas_read(canvas, x, bottom, width, 1, rows + width, width);
+            canvas_blit(canvas, x, top, rows + width, width, 1, width);
+            canvas_blit(canvas, x, bottom, rows, width, 1, width);
+        }
+    }else{ //reverse every row
+        for (top = y; top < y + height; top++){
+            canvas_read(canvas, x, top, width, 1, rows, width);
+            for (i = 0; i < width / 2; i++){
+                tmp = rows[i];
+                rows[i] = rows[width - i - 1];
+                rows[width - i - 1] = tmp;
+            }
+            canvas_blit(canvas, x, top, rows, width, 1, width);
+        }
+    }
+    free(rows);
+    return 0;
+}
+
+int canvas_rotate90(canvas_t * canvas, int x, int y, int size, int turns){
+    ws2811_led_t * src, * dst;
+    int row, column;
+
+    if (x < 0 || y < 0 || size <= 0 || x + size > canvas->width || y + size > canvas->height) return -1;
+    turns = ((turns % 4) + 4) % 4;
+    if (turns == 0) return 0;
+
+    src = (ws2811_led_t *) malloc(sizeof(ws2811_led_t) * size * size * 2);
+    if (src == NULL) return -2;
+    dst = src + size * size;
+
+    canvas_read(canvas, x, y, size, size, src, size);
+    for (row = 0; row < size; row++){
+        for (column = 0; column < size; column++){
+            switch (turns){
+                case 1:
+                    dst[row * size + column] = src[(size - column - 1) * size + row];
+                    break;
+                case 2:
+                    dst[row * size + column] = src[(size - row - 1) * size + size - column - 1];
+                    break;
+                case 3:
+                    dst[row * size + column] = src[column * size + size - row - 1];
+                    break;
+            }
+        }
+    }
+    canvas_blit(canvas, x, y, dst, size, size, size);
+    free(src);
+    return 0;
+}
@@ -0,0 +1,59 @@
+//
+// 2D drawing on the logical canvas of a led matrix.
+// All coordinates are logical (x,y) of the led layout, the viewport offset of a scrolled matrix is taken into account,
+// so drawing doesn't have to move the pixels back to their absolute position first.
+// The operations work row by row through the index table of the layout, rows that are wired consecutively are copied at once.
+//
+
+#ifndef RPI_LEDMATRIX_SERVER_CANVAS_H
+#define RPI_LEDMATRIX_SERVER_CANVAS_H
+
+#include <stdint.h>
+#include "ws2811.h"
+#include "layout.h"
+
+typedef struct {
+    led_layout_t * layout;
+    ws2811_led_t * leds;
+    int width;
+    int height;
+} canvas_t;
+
+void canvas_init(canvas_t * canvas, led_layout_t * layout, ws2811_led_t * leds);
+
+//clips the rectangle to the canvas, returns 0 if nothing of it is inside the canvas
+int canvas_clip(const canvas_t * canvas, int * x, int * y, int * width, int * height);
+
+//returns the led shown at x,y or NULL if x,y is outside the canvas
+ws2811_led_t * canvas_pixel(const canvas_t * canvas, int x, int y);
+
+//sets the color of all leds in the rectangle
+void canvas_fill_rect(canvas_t * canvas, int x, int y, int width, int height, uint32_t color);
+
+//sets the brightness of all leds in the rectangle
+void canvas_brightness_rect(canvas_t * canvas, int x, int y, int width, int height, uint32_t brightness);
+
+//copies width*height colors to the rectangle at x,y, the brightness of the leds is not changed
+//stride is the number of colors between 2 rows in colors, 0 draws the same row on every line
+//parts outside the canvas are clipped
+void canvas_blit_colors(canvas_t * canvas, int x, int y, const uint32_t * colors, int width, int height, int stride);
+
+//copies width*height leds (color and brightness) to the rectangle at x,y, clipped like canvas_blit_colors
+void canvas_blit(canvas_t * canvas, int x, int y, const ws2811_led_t * src, int width, int height, int stride);
+
+//copies the leds of the rectangle to dst (stride leds per row), the rectangle must be inside the canvas
+void canvas_read(const canvas_t * canvas, int x, int y, int width, int height, ws2811_led_t * dst, int stride);
+
+//scrolls the whole canvas by dx columns and dy rows (left / up for positive values), the content wraps around
+//this only moves the viewport, no pixel is copied
+void canvas_scroll(canvas_t * canvas, int dx, int dy);
+
+//mirrors the rectangle, horizontal (vertical=0) swaps left and right, vertical swaps top and bottom
+//returns -2 if out of memory
+int canvas_mirror(canvas_t * canvas, int x, int y, int width, int height, int vertical);
+
+//rotates the square at x,y by 90 degrees clockwise (turns times, negative = counter clockwise)
+//returns -1 if the square is not inside the canvas, -2 if out of memory
+int canvas_rotate90(canvas_t * canvas, int x, int y, int size, int turns);
+
+#endif //RPI_LEDMATRIX_SERVER_CANVAS_H
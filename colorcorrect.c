@@ -0,0 +1,85 @@
+//
+// Gamma and color correction tables, see colorcorrect.h
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "colorcorrect.h"
+
+void color_correction_default(color_correction_t * correction){
+    correction->gamma = 1.0;
+    memset(correction->scale, 255, sizeof(correction->scale));
+    correction->temperature = 0;
+}
+
+static double clamp255(double value){
+    if (value < 0) return 0;
+    if (value > 255) return 255;
+    return value;
+}
+
+//red, green and blue of a black body at kelvin (approximation by Tanner Helland), 6600K is white
+static void temperature_to_rgb(int kelvin, double rgb[3]){
+    double t = kelvin / 100.0;
+
+    if (t < 10) t = 10;
+    if (t > 400) t = 400;
+    if (t <= 66){
+        rgb[0] = 255;
+        rgb[1] = clamp255(99.4708025861 * log(t) - 161.1195681661);
+        rgb[2] = t <= 19 ? 0 : clamp255(138.5177312231 * log(t - 10) - 305.0447927307);
+    }else{
+        rgb[0] = clamp255(329.698727446 * pow(t - 60, -0.1332047592));
+        rgb[1] = clamp255(288.1221695283 * pow(t - 60, -0.0755148492));
+        rgb[2] = 255;
+    }
+}
+
+void color_correction_build(const color_correction_t * correction, uint8_t * table){
+    static const int offsets[4] = {WS2811_GAMMA_RED, WS2811_GAMMA_GREEN, WS2811_GAMMA_BLUE, WS2811_GAMMA_WHITE};
+    double white[4] = {255, 255, 255, 255};
+    double gamma = correction->gamma > 0 ? correction->gamma : 1.0;
+    int c, x;
+
+    if (correction->temperature > 0) temperature_to_rgb(correction->temperature, white);
+
+    for (c = 0; c < 4; c++){
+        double factor = correction->scale[c] / 255.0 * white[c] / 255.0;
+        for (x = 0; x < 256; x++){
+            table[offsets[c] + x] = (uint8_t) (pow(x / 255.0, gamma) * factor * 255.0 + 0.5);
+        }
+    }
+}
+
+int color_table_save(const char * filename, const uint8_t * table){
+    FILE * file;
+    int x;
+
+    if ((file = fopen(filename, "w")) == NULL) return -1;
+    for (x = 0; x < 256; x++){
+        fprintf(file, "%02X,%02X,%02X,%02X\n", table[WS2811_GAMMA_RED + x], table[WS2811_GAMMA_GREEN + x],
+                table[WS2811_GAMMA_BLUE + x], table[WS2811_GAMMA_WHITE + x]);
+    }
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+int color_table_load(const char * filename, uint8_t * table){
+    uint8_t loaded[WS2811_GAMMA_TABLE_SIZE];
+    unsigned int r, g, b, w;
+    FILE * file;
+    int x;
+
+    if ((file = fopen(filename, "r")) == NULL) return -1;
+    for (x = 0; x < 256; x++){
+        if (fscanf(file, "%x,%x,%x,%x", &r, &g, &b, &w) != 4 || r > 255 || g > 255 || b > 255 || w > 255) break;
+        loaded[WS2811_GAMMA_RED + x] = r;
+        loaded[WS2811_GAMMA_GREEN + x] = g;
+        loaded[WS2811_GAMMA_BLUE + x] = b;
+        loaded[WS2811_GAMMA_WHITE + x] = w;
+    }
+    fclose(file);
+    if (x < 256) return -2;
+    memcpy(table, loaded, sizeof(loaded));
+    return 0;
+}
@@ -0,0 +1,32 @@
+//
+// Gamma and color correction tables for the encoder.
+// Gamma, white balance and color temperature are folded into one 256 entry table per color once,
+// the encoder already looks every component up in ws2811_channel_t.gamma so the correction costs nothing per pixel.
+//
+
+#ifndef RPI_LEDMATRIX_SERVER_COLORCORRECT_H
+#define RPI_LEDMATRIX_SERVER_COLORCORRECT_H
+
+#include <stdint.h>
+#include "ws2811.h"
+
+typedef struct {
+    double gamma;                   //exponent, 1 = linear
+    uint8_t scale[4];               //white balance of red, green, blue and white, 255 = full
+    int temperature;                //color temperature of the white point in Kelvin, 0 = no correction
+} color_correction_t;
+
+//no correction: gamma 1, full scale, no temperature
+void color_correction_default(color_correction_t * correction);
+
+//builds the red, green, blue and white tables (WS2811_GAMMA_TABLE_SIZE bytes, see WS2811_GAMMA_*)
+void color_correction_build(const color_correction_t * correction, uint8_t * table);
+
+//saves a table as text, one line per input level: RR,GG,BB,WW (hex), returns 0 on success
+int color_table_save(const char * filename, const uint8_t * table);
+
+//loads a table saved by color_table_save (or measured for a panel), returns 0 on success
+//on an error the table is not changed
+int color_table_load(const char * filename, uint8_t * table);
+
+#endif //RPI_LEDMATRIX_SERVER_COLORCORRECT_H
@@ -0,0 +1,191 @@
+//
+// HSV and HSL colors in fixed point, see colorspace.h
+//
+
+#include "colorspace.h"
+
+#define RGB(r, g, b) (((uint32_t) (b) << 16) | ((uint32_t) (g) << 8) | (uint32_t) (r))
+
+uint32_t color_wheel[256];
+
+//fully saturated colors of the hue circle: 6 sectors of 256 steps, in every sector one component changes
+static uint32_t hue_table[HUE_STEPS];
+
+//x / 255 rounded, for x = 0..65535
+static inline uint32_t div255(uint32_t x){
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+void colorspace_init(void){
+    int i, f;
+
+    for (i = 0; i < HUE_STEPS; i++){
+        f = i & 0xFF;
+        switch (i >> 8){
+            case 0: hue_table[i] = RGB(255, f, 0); break;
+            case 1: hue_table[i] = RGB(255 - f, 255, 0); break;
+            case 2: hue_table[i] = RGB(0, 255, f); break;
+            case 3: hue_table[i] = RGB(0, 255 - f, 255); break;
+            case 4: hue_table[i] = RGB(f, 0, 255); break;
+            default: hue_table[i] = RGB(255, 0, 255 - f); break;
+        }
+    }
+    for (i = 0; i < 256; i++){
+        if (i < 85){
+            color_wheel[i] = RGB(255 - i * 3, i * 3, 0);
+        }else if (i < 170){
+            color_wheel[i] = RGB(0, 255 - (i - 85) * 3, (i - 85) * 3);
+        }else{
+            color_wheel[i] = RGB((i - 170) * 3, 0, 255 - (i - 170) * 3);
+        }
+    }
+}
+
+//splits a color in its largest and smallest component and the position on the hue circle (0..HUE_STEPS-1)
+static inline int color_to_step(uint32_t color, int * max, int * min){
+    int r = color & 0xFF, g = (color >> 8) & 0xFF, b = (color >> 16) & 0xFF;
+    int delta;
+
+    //sector of the hue circle from the order of the components
+    if (r >= g && g >= b){
+        *max = r; *min = b;
+        if ((delta = r - b) == 0) return 0;
+        return ((g - b) * 255 + delta / 2) / delta;
+    }else if (g > r && r >= b){
+        *max = g; *min = b; delta = g - b;
+        return 511 - ((r - b) * 255 + delta / 2) / delta;
+    }else if (g >= b && b > r){
+        *max = g; *min = r; delta = g - r;
+        return 512 + ((b - r) * 255 + delta / 2) / delta;
+    }else if (b > g && g > r){
+        *max = b; *min = r; delta = b - r;
+        return 1023 - ((g - r) * 255 + delta / 2) / delta;
+    }else if (b > r && r >= g){
+        *max = b; *min = g; delta = b - g;
+        return 1024 + ((r - g) * 255 + delta / 2) / delta;
+    }
+    *max = r; *min = g; delta = r - g;
+    return 1535 - ((b - g) * 255 + delta / 2) / delta;
+}
+
+//builds a color with the hue of a step, min as smallest and min+delta as largest component
+static inline uint32_t step_to_color(int step, int min, int delta){
+    uint32_t c = hue_table[step];
+    return RGB(min + div255((c & 0xFF) * delta), min + div255(((c >> 8) & 0xFF) * delta), min + div255(((c >> 16) & 0xFF) * delta));
+}
+
+static inline int hue_to_step(uint16_t hue){
+    return (((uint32_t) hue * HUE_STEPS + 32768) >> 16) % HUE_STEPS;
+}
+
+static inline uint16_t step_to_hue(int step){
+    return (uint16_t) (((uint32_t) step * 65536 + HUE_STEPS / 2) / HUE_STEPS);
+}
+
+uint32_t hsv_to_color(uint16_t hue, uint8_t saturation, uint8_t value){
+    int delta = div255(value * saturation);
+    return step_to_color(hue_to_step(hue), value - delta, delta);
+}
+
+void color_to_hsv(uint32_t color, uint16_t * hue, uint8_t * saturation, uint8_t * value){
+    int max, min;
+    int step = color_to_step(color, &max, &min);
+
+    *hue = step_to_hue(step);
+    *value = max;
+    *saturation = max == 0 ? 0 : ((max - min) * 255 + max / 2) / max;
+}
+
+uint32_t hsl_to_color(uint16_t hue, uint8_t saturation, uint8_t lightness){
+    int l2 = 2 * lightness - 255;
+    int chroma = div255((255 - (l2 < 0 ? -l2 : l2)) * saturation);
+    int min = lightness - (chroma + 1) / 2;
+
+    if (min < 0) min = 0;
+    if (min + chroma > 255) chroma = 255 - min;
+    return step_to_color(hue_to_step(hue), min, chroma);
+}
+
+void color_to_hsl(uint32_t color, uint16_t * hue, uint8_t * saturation, uint8_t * lightness){
+    int max, min, range;
+    int step = color_to_step(color, &max, &min);
+
+    *hue = step_to_hue(step);
+    *lightness = (max + min + 1) / 2;
+    range = 255 - (max + min > 255 ? max + min - 255 : 255 - max - min); //largest possible chroma at this lightness
+    *saturation = range == 0 ? 0 : ((max - min) * 255 + range / 2) / range;
+}
+
+//the smallest and largest component stay the same, only the position on the hue circle moves,
+//so a shift of 0 returns the same color
+void span_hue_shift(ws2811_led_t * leds, int count, int shift){
+    int steps = ((shift % 65536 + 65536) % 65536 * HUE_STEPS + 32768) >> 16;
+    int i, max, min, step;
+
+    for (i = 0; i < count; i++){
+        uint32_t color = leds[i].color;
+        step = color_to_step(color, &max, &min) + steps;
+        if (step >= HUE_STEPS) step -= HUE_STEPS;
+        leds[i].color = (color & 0xFF000000) | step_to_color(step, min, max - min);
+    }
+}
+
+void span_saturate(ws2811_led_t * leds, int count, unsigned int scale){
+    int i, c, max, v;
+
+    for (i = 0; i < count; i++){
+        uint32_t color = leds[i].color;
+        uint32_t result = color & 0xFF000000;
+        max = color & 0xFF;
+        if (((color >> 8) & 0xFF) > (uint32_t) max) max = (color >> 8) & 0xFF;
+        if (((color >> 16) & 0xFF) > (uint32_t) max) max = (color >> 16) & 0xFF;
+        for (c = 0; c < 24; c += 8){
+            v = max - (int) (((max - (int) ((color >> c) & 0xFF)) * scale + 128) >> 8);
+            if (v < 0) v = 0;
+            result |= (uint32_t) v << c;
+        }
+        leds[i].color = result;
+    }
+}
+
+//when all components are given every led gets the same color and the conversion is done once
+void span_set_hsv(ws2811_led_t * leds, int count, int hue, int saturation, int value){
+    int i;
+    uint16_t h;
+    uint8_t s, v;
+
+    if (hue >= 0 && saturation >= 0 && value >= 0){
+        uint32_t color = hsv_to_color(hue, saturation, value);
+        for (i = 0; i < count; i++) leds[i].color = (leds[i].color & 0xFF000000) | color;
+        return;
+    }
+    for (i = 0; i < count; i++){
+        uint32_t color = leds[i].color;
+        color_to_hsv(color, &h, &s, &v);
+        if (hue >= 0) h = hue;
+        if (saturation >= 0) s = saturation;
+        if (value >= 0) v = value;
+        leds[i].color = (color & 0xFF000000) | hsv_to_color(h, s, v);
+    }
+}
+
+void span_set_hsl(ws2811_led_t * leds, int count, int hue, int saturation, int lightness){
+    int i;
+    uint16_t h;
+    uint8_t s, l;
+
+    if (hue >= 0 && saturation >= 0 && lightness >= 0){
+        uint32_t color = hsl_to_color(hue, saturation, lightness);
+        for (i = 0; i < count; i++) leds[i].color = (leds[i].color & 0xFF000000) | color;
+        return;
+    }
+    for (i = 0; i < count; i++){
+        uint32_t color = leds[i].color;
+        color_to_hsl(color, &h, &s, &l);
+        if (hue >= 0) h = hue;
+        if (saturation >= 0) s = saturation;
+        if (lightness >= 0) l = lightness;
+        leds[i].color = (color & 0xFF000000) | hsl_to_color(h, s, l);
+    }
+}
@@ -0,0 +1,45 @@
+//
+// HSV and HSL colors in fixed point.
+// Hue is 16 bit (0-65535 is 0-360 degrees), saturation, value and lightness are 0-255.
+// Fully saturated hues come from a table: at 8 bit per component the hue circle has 6*256 different colors,
+// so a 16 bit hue is converted with a lookup and an integer scaling instead of float math.
+// Colors are led colors (0xWWBBGGRR), the white component is kept by the conversions.
+//
+
+#ifndef RPI_LEDMATRIX_SERVER_COLORSPACE_H
+#define RPI_LEDMATRIX_SERVER_COLORSPACE_H
+
+#include <stdint.h>
+#include "ws2811.h"
+
+#define HUE_STEPS 1536              //different fully saturated colors
+#define HUE_DEGREES(degrees) ((uint16_t) ((long) (degrees) * 65536 / 360))
+
+//colors of the 256 step color wheel of rainbow and color_change (red - green - blue - red)
+extern uint32_t color_wheel[256];
+
+//fills the tables, must be called once before the other functions are used
+void colorspace_init(void);
+
+uint32_t hsv_to_color(uint16_t hue, uint8_t saturation, uint8_t value);
+
+void color_to_hsv(uint32_t color, uint16_t * hue, uint8_t * saturation, uint8_t * value);
+
+uint32_t hsl_to_color(uint16_t hue, uint8_t saturation, uint8_t lightness);
+
+void color_to_hsl(uint32_t color, uint16_t * hue, uint8_t * saturation, uint8_t * lightness);
+
+//rotates the hue of count leds by shift (65536 = 360 degrees), saturation and value are kept
+void span_hue_shift(ws2811_led_t * leds, int count, int shift);
+
+//scales the saturation of count leds by scale/256: 0 = gray, 256 = unchanged, > 256 = more saturated
+//the value (largest component) is kept
+void span_saturate(ws2811_led_t * leds, int count, unsigned int scale);
+
+//sets hue, saturation and value of count leds, a negative argument keeps the led's own component
+void span_set_hsv(ws2811_led_t * leds, int count, int hue, int saturation, int value);
+
+//sets hue, saturation and lightness of count leds, a negative argument keeps the led's own component
+void span_set_hsl(ws2811_led_t * leds, int count, int hue, int saturation, int lightness);
+
+#endif //RPI_LEDMATRIX_SERVER_COLORSPACE_H
@@ -0,0 +1,94 @@
+//
+// inotify watch of the configuration file and the script directory, see confwatch.h
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include "confwatch.h"
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+
+int config_watch_init(config_watch_t * watch){
+    memset(watch, 0, sizeof(*watch));
+    watch->config_wd = -1;
+    watch->scripts_wd = -1;
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    return watch->fd < 0 ? -1 : 0;
+}
+
+void config_watch_free(config_watch_t * watch){
+    if (watch->fd >= 0) close(watch->fd); //removes all watches
+    free(watch->config_name);
+    watch->fd = -1;
+    watch->config_wd = -1;
+    watch->scripts_wd = -1;
+    watch->config_name = NULL;
+}
+
+int config_watch_file(config_watch_t * watch, const char * filename){
+    const char * slash = strrchr(filename, '/');
+    char * directory;
+    int wd;
+
+    if (watch->fd < 0) return -1;
+    if (slash == NULL) directory = strdup(".");
+    else if (slash == filename) directory = strdup("/");
+    else directory = strndup(filename, slash - filename);
+    free(watch->config_name);
+    watch->config_name = strdup(slash == NULL ? filename : slash + 1);
+    if (directory == NULL || watch->config_name == NULL){
+        free(directory);
+        return -2;
+    }
+
+    wd = inotify_add_watch(watch->fd, directory, WATCH_EVENTS);
+    free(directory);
+    if (wd < 0) return -1;
+    watch->config_wd = wd;
+    return 0;
+}
+
+int config_watch_scripts(config_watch_t * watch, const char * directory){
+    int wd = -1;
+
+    if (watch->fd < 0) return -1;
+    if (directory != NULL && (wd = inotify_add_watch(watch->fd, directory, WATCH_EVENTS)) < 0) return -1;
+    //the same directory gives the same watch, keep the one of the configuration file
+    if (watch->scripts_wd >= 0 && watch->scripts_wd != wd && watch->scripts_wd != watch->config_wd){
+        inotify_rm_watch(watch->fd, watch->scripts_wd);
+    }
+    watch->scripts_wd = wd;
+    return 0;
+}
+
+static int has_extension(const char * name, const char * extension){
+    size_t len = strlen(name), ext = strlen(extension);
+    return len > ext && strcmp(&name[len - ext], extension) == 0;
+}
+
+int config_watch_read(config_watch_t * watch){
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    int changes = 0;
+    ssize_t len;
+
+    if (watch->fd < 0) return 0;
+    while ((len = read(watch->fd, buffer, sizeof(buffer))) > 0){
+        ssize_t pos = 0;
+        while (pos < len){
+            const struct inotify_event * event = (const struct inotify_event *) &buffer[pos];
+            if (event->len > 0){
+                if (event->wd == watch->config_wd && watch->config_name != NULL && strcmp(event->name, watch->config_name) == 0){
+                    changes |= CONFIG_WATCH_CONFIG;
+                }
+                if (event->wd == watch->scripts_wd && has_extension(event->name, ".txt")){
+                    changes |= CONFIG_WATCH_SCRIPTS;
+                }
+            }
+            pos += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changes;
+}
@@ -0,0 +1,33 @@
+//
+// Watches the configuration file and the script directory with inotify, changes are read without blocking.
+// The directory of the configuration file is watched because editors often replace the file instead of writing it.
+//
+
+#ifndef RPI_LEDMATRIX_SERVER_CONFWATCH_H
+#define RPI_LEDMATRIX_SERVER_CONFWATCH_H
+
+#define CONFIG_WATCH_CONFIG 1   //the configuration file was written or replaced
+#define CONFIG_WATCH_SCRIPTS 2  //a file in the script directory was written, added or removed
+
+typedef struct {
+    int fd;                     //inotify descriptor, -1 = not watching
+    int config_wd;              //watch of the directory of the configuration file
+    int scripts_wd;             //watch of the script directory
+    char * config_name;         //file name of the configuration file (without directory)
+} config_watch_t;
+
+//returns 0 on success, -1 if inotify is not available
+int config_watch_init(config_watch_t * watch);
+
+void config_watch_free(config_watch_t * watch);
+
+//returns 0 on success, -1 if the file can't be watched, -2 out of memory
+int config_watch_file(config_watch_t * watch, const char * filename);
+
+//watches another script directory (NULL = none), returns 0 on success, -1 if the directory can't be watched
+int config_watch_scripts(config_watch_t * watch, const char * directory);
+
+//reads the pending changes without blocking, returns the CONFIG_WATCH_* flags of what changed (0 = nothing)
+int config_watch_read(config_watch_t * watch);
+
+#endif //RPI_LEDMATRIX_SERVER_CONFWATCH_H
@@ -0,0 +1,140 @@
+//
+// Cache of decoded images, see imagecache.h
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "imagecache.h"
+
+void image_cache_init(image_cache_t * cache, size_t budget){
+    memset(cache, 0, sizeof(image_cache_t));
+    cache->budget = budget;
+    pthread_mutex_init(&cache->mutex, NULL);
+}
+
+static void unlink_entry(image_cache_t * cache, image_cache_entry_t * entry){
+    if (entry->prev!=NULL) entry->prev->next = entry->next;
+    else cache->first = entry->next;
+    if (entry->next!=NULL) entry->next->prev = entry->prev;
+    else cache->last = entry->prev;
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void push_front(image_cache_t * cache, image_cache_entry_t * entry){
+    entry->prev = NULL;
+    entry->next = cache->first;
+    if (cache->first!=NULL) cache->first->prev = entry;
+    cache->first = entry;
+    if (cache->last==NULL) cache->last = entry;
+}
+
+static void free_entry(image_cache_t * cache, image_cache_entry_t * entry){
+    unlink_entry(cache, entry);
+    cache->used -= entry->bytes;
+    free(entry->path);
+    free(entry->pixels);
+    free(entry);
+}
+
+//drops the least recently used images that are not in use until there is room for bytes more
+static void make_room(image_cache_t * cache, size_t bytes){
+    image_cache_entry_t * entry = cache->last;
+    while (entry!=NULL && cache->used + bytes > cache->budget){
+        image_cache_entry_t * prev = entry->prev;
+        if (entry->users==0) free_entry(cache, entry);
+        entry = prev;
+    }
+}
+
+static int same_options(const image_cache_options_t * a, const image_cache_options_t * b){
+    return a->back_color==b->back_color && a->back_color_type==b->back_color_type && a->color_size==b->color_size &&
+           a->min_width==b->min_width && a->min_height==b->min_height;
+}
+
+image_cache_entry_t * image_cache_get(image_cache_t * cache, const char * path, const image_cache_options_t * options){
+    struct stat st;
+    image_cache_entry_t * entry, * found = NULL;
+
+    if (stat(path, &st)!=0) return NULL;
+
+    pthread_mutex_lock(&cache->mutex);
+    for (entry = cache->first; entry!=NULL; entry = entry->next){
+        if (strcmp(entry->path, path)==0 && same_options(&entry->options, options)){
+            if (entry->mtime.tv_sec==st.st_mtim.tv_sec && entry->mtime.tv_nsec==st.st_mtim.tv_nsec && entry->file_size==st.st_size){
+                found = entry;
+            }else if (entry->users==0){ //file was modified
+                free_entry(cache, entry);
+            }
+            break;
+        }
+    }
+    if (found!=NULL){
+        unlink_entry(cache, found);
+        push_front(cache, found);
+        found->users++;
+        cache->hits++;
+    }else{
+        cache->misses++;
+    }
+    pthread_mutex_unlock(&cache->mutex);
+    return found;
+}
+
+image_cache_entry_t * image_cache_put(image_cache_t * cache, const char * path, const image_cache_options_t * options,
+                                      uint32_t * pixels, int width, int height){
+    struct stat st;
+    image_cache_entry_t * entry;
+    size_t bytes = sizeof(uint32_t) * width * height;
+
+    if (cache->budget==0 || bytes > cache->budget || stat(path, &st)!=0) return NULL;
+
+    entry = (image_cache_entry_t *) calloc(1, sizeof(image_cache_entry_t));
+    if (entry==NULL) return NULL;
+    entry->path = strdup(path);
+    if (entry->path==NULL){
+        free(entry);
+        return NULL;
+    }
+    entry->mtime = st.st_mtim;
+    entry->file_size = st.st_size;
+    entry->options = *options;
+    entry->width = width;
+    entry->height = height;
+    entry->pixels = pixels;
+    entry->bytes = bytes;
+    entry->users = 1;
+
+    pthread_mutex_lock(&cache->mutex);
+    make_room(cache, bytes);
+    push_front(cache, entry);
+    cache->used += bytes;
+    pthread_mutex_unlock(&cache->mutex);
+    return entry;
+}
+
+void image_cache_release(image_cache_t * cache, image_cache_entry_t * entry){
+    if (entry==NULL) return;
+    pthread_mutex_lock(&cache->mutex);
+    entry->users--;
+    if (cache->used > cache->budget) make_room(cache, 0); //budget was lowered while the image was in use
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void image_cache_set_budget(image_cache_t * cache, size_t budget){
+    pthread_mutex_lock(&cache->mutex);
+    cache->budget = budget;
+    make_room(cache, 0);
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void image_cache_clear(image_cache_t * cache){
+    image_cache_entry_t * entry, * next;
+    pthread_mutex_lock(&cache->mutex);
+    for (entry = cache->first; entry!=NULL; entry = next){
+        next = entry->next;
+        if (entry->users==0) free_entry(cache, entry);
+    }
+    pthread_mutex_unlock(&cache->mutex);
+}
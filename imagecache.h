@@ -0,0 +1,68 @@
+//
+// Cache of decoded images: the pixels of an image file are decoded and converted to led colors once and kept
+// until the file is modified or the memory is needed for other images (least recently used images are dropped first).
+//
+
+#ifndef RPI_LEDMATRIX_SERVER_IMAGECACHE_H
+#define RPI_LEDMATRIX_SERVER_IMAGECACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+
+//conversion parameters, the same file converted with other parameters is cached separately
+typedef struct {
+    unsigned int back_color;    //color used for transparent pixels
+    int back_color_type;        //0 = background color of the file, 1 = back_color, 2 = alpha for the white leds
+    int color_size;             //3 = RGB, 4 = RGBW
+    int min_width;              //JPEG is decoded at the smallest DCT scale (1/2, 1/4, 1/8) that is still at least
+    int min_height;             //min_width*min_height, 0 = full size
+} image_cache_options_t;
+
+typedef struct image_cache_entry {
+    char * path;
+    struct timespec mtime;      //modification time and size of the file when it was decoded
+    off_t file_size;
+    image_cache_options_t options;
+    int width;
+    int height;
+    uint32_t * pixels;          //width*height led colors, row by row
+    size_t bytes;
+    int users;                  //entries in use are not dropped
+    struct image_cache_entry * prev; //more recently used
+    struct image_cache_entry * next; //less recently used
+} image_cache_entry_t;
+
+typedef struct {
+    image_cache_entry_t * first; //most recently used
+    image_cache_entry_t * last;  //least recently used
+    size_t used;                 //bytes of pixel data in the cache
+    size_t budget;               //maximum bytes of pixel data, 0 = caching disabled
+    unsigned int hits;
+    unsigned int misses;
+    pthread_mutex_t mutex;
+} image_cache_t;
+
+void image_cache_init(image_cache_t * cache, size_t budget);
+
+//returns the cached image of path if the file wasn't modified since it was decoded, NULL if it must be decoded
+//the returned entry must be given back with image_cache_release
+image_cache_entry_t * image_cache_get(image_cache_t * cache, const char * path, const image_cache_options_t * options);
+
+//adds the decoded pixels of path to the cache, the cache takes ownership of pixels
+//returns the entry (release it with image_cache_release) or NULL if caching is disabled or out of memory,
+//the caller still owns pixels then
+image_cache_entry_t * image_cache_put(image_cache_t * cache, const char * path, const image_cache_options_t * options,
+                                      uint32_t * pixels, int width, int height);
+
+void image_cache_release(image_cache_t * cache, image_cache_entry_t * entry);
+
+//changes the memory budget and drops images until the cache fits
+void image_cache_set_budget(image_cache_t * cache, size_t budget);
+
+//drops all images that are not in use
+void image_cache_clear(image_cache_t * cache);
+
+#endif //RPI_LEDMATRIX_SERVER_IMAGECACHE_H
@@ -0,0 +1,209 @@
+//
+// Pixel layout of a led matrix, see layout.h
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "layout.h"
+
+void led_layout_default_config(led_layout_config_t * config, int width, int height, int serpentine){
+    memset(config, 0, sizeof(led_layout_config_t));
+    config->width = width;
+    config->height = height;
+    config->serpentine = serpentine;
+}
+
+//computes the led index of logical x,y
+static int compute_index(const led_layout_config_t * c, int x, int y, int phys_width, int panel_width, int panel_height){
+    int px, py, panel_col, panel_row, panel_cols, qx, qy, line, pos, line_len;
+
+    if (c->flip_x) x = c->width - x - 1;
+    if (c->flip_y) y = c->height - y - 1;
+
+    switch (c->rotation){
+        case 90:
+            px = c->height - y - 1;
+            py = x;
+            break;
+        case 180:
+            px = c->width - x - 1;
+            py = c->height - y - 1;
+            break;
+        case 270:
+            px = y;
+            py = c->width - x - 1;
+            break;
+        default:
+            px = x;
+            py = y;
+            break;
+    }
+
+    panel_cols = phys_width / panel_width;
+    panel_col = px / panel_width;
+    panel_row = py / panel_height;
+    if (c->panel_serpentine && (panel_row % 2)) panel_col = panel_cols - panel_col - 1;
+    qx = px % panel_width;
+    qy = py % panel_height;
+
+    if (c->column_major){
+        line = qx;
+        pos = qy;
+        line_len = panel_height;
+    }else{
+        line = qy;
+        pos = qx;
+        line_len = panel_width;
+    }
+    if (c->serpentine && (line % 2)) pos = line_len - pos - 1;
+
+    return (panel_row * panel_cols + panel_col) * panel_width * panel_height + line * line_len + pos;
+}
+
+int led_layout_build(led_layout_t * layout, const led_layout_config_t * config){
+    int x, y, phys_width, phys_height, panel_width, panel_height;
+    int * index;
+    signed char * row_step;
+    uint16_t * led_x, * led_y;
+
+    if (config->width<=0 || config->height<=0) return -1;
+    if (config->rotation!=0 && config->rotation!=90 && config->rotation!=180 && config->rotation!=270) return -1;
+
+    if (config->rotation==90 || config->rotation==270){
+        phys_width = config->height;
+        phys_height = config->width;
+    }else{
+        phys_width = config->width;
+        phys_height = config->height;
+    }
+    panel_width = config->panel_width > 0 ? config->panel_width : phys_width;
+    panel_height = config->panel_height > 0 ? config->panel_height : phys_height;
+    if ((phys_width % panel_width)!=0 || (phys_height % panel_height)!=0) return -1; //panels must tile the canvas
+
+    index = (int *) malloc(sizeof(int) * config->width * config->height);
+    row_step = (signed char *) malloc(config->height);
+    led_x = (uint16_t *) malloc(sizeof(uint16_t) * config->width * config->height);
+    led_y = (uint16_t *) malloc(sizeof(uint16_t) * config->width * config->height);
+    if (index==NULL || row_step==NULL || led_x==NULL || led_y==NULL){
+        free(index);
+        free(row_step);
+        free(led_x);
+        free(led_y);
+        return -2;
+    }
+
+    for (y=0; y<config->height; y++){
+        int * row = &index[y * config->width];
+        for (x=0; x<config->width; x++){
+            row[x] = compute_index(config, x, y, phys_width, panel_width, panel_height);
+            led_x[row[x]] = x;
+            led_y[row[x]] = y;
+        }
+        row_step[y] = 0;
+        if (config->width > 1 && (row[1] - row[0] == 1 || row[1] - row[0] == -1)){
+            row_step[y] = row[1] - row[0];
+            for (x=2; x<config->width; x++){
+                if (row[x] - row[x-1] != row_step[y]){
+                    row_step[y] = 0;
+                    break;
+                }
+            }
+        }else if (config->width == 1){
+            row_step[y] = 1;
+        }
+    }
+
+    led_layout_free(layout);
+    layout->config = *config;
+    layout->width = config->width;
+    layout->height = config->height;
+    layout->index = index;
+    layout->row_step = row_step;
+    layout->led_x = led_x;
+    layout->led_y = led_y;
+
+    layout->viewport.width = layout->width;
+    layout->viewport.height = layout->height;
+    layout->viewport.index = index;
+    layout->viewport.led_x = led_x;
+    layout->viewport.led_y = led_y;
+    layout->viewport.offset_x = 0;
+    layout->viewport.offset_y = 0;
+    return 0;
+}
+
+void led_layout_free(led_layout_t * layout){
+    free(layout->index);
+    free(layout->row_step);
+    free(layout->led_x);
+    free(layout->led_y);
+    free(layout->scratch);
+    layout->index = NULL;
+    layout->row_step = NULL;
+    layout->led_x = NULL;
+    layout->led_y = NULL;
+    layout->scratch = NULL;
+    memset(&layout->viewport, 0, sizeof(ws2811_viewport_t));
+    layout->width = 0;
+    layout->height = 0;
+}
+
+void led_layout_get_row(const led_layout_t * layout, const ws2811_led_t * leds, int y, ws2811_led_t * row){
+    const int * index = &layout->index[y * layout->width];
+    int x;
+    switch (layout->row_step[y]){
+        case 1:
+            memcpy(row, &leds[index[0]], layout->width * sizeof(ws2811_led_t));
+            break;
+        case -1:
+            for (x=0; x<layout->width; x++) row[x] = leds[index[0] - x];
+            break;
+        default:
+            for (x=0; x<layout->width; x++) row[x] = leds[index[x]];
+            break;
+    }
+}
+
+void led_layout_set_row(const led_layout_t * layout, ws2811_led_t * leds, int y, const ws2811_led_t * row){
+    const int * index = &layout->index[y * layout->width];
+    int x;
+    switch (layout->row_step[y]){
+        case 1:
+            memcpy(&leds[index[0]], row, layout->width * sizeof(ws2811_led_t));
+            break;
+        case -1:
+            for (x=0; x<layout->width; x++) leds[index[0] - x] = row[x];
+            break;
+        default:
+            for (x=0; x<layout->width; x++) leds[index[x]] = row[x];
+            break;
+    }
+}
+
+void led_layout_scroll(led_layout_t * layout, int dx, int dy){
+    if (layout->width<=0 || layout->height<=0) return;
+    layout->viewport.offset_x = ((layout->viewport.offset_x + dx) % layout->width + layout->width) % layout->width;
+    layout->viewport.offset_y = ((layout->viewport.offset_y + dy) % layout->height + layout->height) % layout->height;
+}
+
+int led_layout_materialize(led_layout_t * layout, ws2811_led_t * leds){
+    int x, y, count = layout->width * layout->height;
+    int offset_x = layout->viewport.offset_x, offset_y = layout->viewport.offset_y;
+
+    if (!led_layout_scrolled(layout)) return 0;
+    if (layout->scratch==NULL){
+        layout->scratch = (ws2811_led_t *) malloc(sizeof(ws2811_led_t) * count);
+        if (layout->scratch==NULL) return -2;
+    }
+
+    for (y=0; y<layout->height; y++){
+        const int * dst = &layout->index[y * layout->width];
+        const int * src = &layout->index[((y + offset_y) % layout->height) * layout->width];
+        for (x=0; x<layout->width - offset_x; x++) layout->scratch[dst[x]] = leds[src[x + offset_x]];
+        for (; x<layout->width; x++) layout->scratch[dst[x]] = leds[src[x + offset_x - layout->width]];
+    }
+    memcpy(leds, layout->scratch, sizeof(ws2811_led_t) * count);
+    layout->viewport.offset_x = 0;
+    layout->viewport.offset_y = 0;
+    return 0;
+}
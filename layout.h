@@ -0,0 +1,64 @@
+//
+// Pixel layout of a led matrix: maps the (x,y) coordinates of the logical canvas to the index of the led in the strip.
+// The table is built once when a channel is set up, so drawing doesn't have to compute the wiring for every pixel.
+//
+
+#ifndef RPI_LEDMATRIX_SERVER_LAYOUT_H
+#define RPI_LEDMATRIX_SERVER_LAYOUT_H
+
+#include <stdint.h>
+#include "ws2811.h"
+
+typedef struct {
+    int width;              //width of the logical canvas (columns)
+    int height;             //height of the logical canvas (rows)
+    int serpentine;         //1 = every 2nd row (or column) of a panel is wired in reverse direction, 0 = progressive
+    int column_major;       //1 = the leds of a panel are wired column by column instead of row by row
+    int rotation;           //rotation of the panels relative to the canvas: 0, 90, 180 or 270 degrees
+    int flip_x;             //mirror the canvas horizontally
+    int flip_y;             //mirror the canvas vertically
+    int panel_width;        //width of one panel as it is wired (0 = only one panel)
+    int panel_height;       //height of one panel as it is wired (0 = only one panel)
+    int panel_serpentine;   //1 = every 2nd row of panels is chained in reverse direction
+} led_layout_config_t;
+
+typedef struct {
+    led_layout_config_t config;
+    int width;
+    int height;
+    int * index;            //width*height led indices, row by row
+    signed char * row_step; //per row: 1 if the leds of the row are consecutive, -1 if consecutive backwards, 0 otherwise
+    uint16_t * led_x;       //x of every led
+    uint16_t * led_y;       //y of every led
+    ws2811_viewport_t viewport; //scroll offset applied by ws2811_render, set channel->viewport to &viewport
+    ws2811_led_t * scratch; //buffer for led_layout_materialize
+} led_layout_t;
+
+//fills config with a single panel of width*height, rows wired progressive or serpentine
+void led_layout_default_config(led_layout_config_t * config, int width, int height, int serpentine);
+
+//builds the lookup table, returns 0 on success, -1 on invalid configuration, -2 out of memory
+int led_layout_build(led_layout_t * layout, const led_layout_config_t * config);
+
+void led_layout_free(led_layout_t * layout);
+
+//returns the led index of x,y (x,y must be inside the canvas)
+#define led_layout_index(layout, x, y) ((layout)->index[(y) * (layout)->width + (x)])
+
+//moves the viewport of the canvas by dx columns and dy rows (scrolls the content left / up for positive values)
+void led_layout_scroll(led_layout_t * layout, int dx, int dy);
+
+//returns 1 if the viewport is scrolled, the leds are not at their absolute position in the buffer then
+#define led_layout_scrolled(layout) ((layout)->viewport.offset_x!=0 || (layout)->viewport.offset_y!=0)
+
+//moves the pixels of a scrolled viewport to their absolute position and resets the offset
+//returns -2 if out of memory
+int led_layout_materialize(led_layout_t * layout, ws2811_led_t * leds);
+
+//copies row y of the canvas from leds to row (width leds)
+void led_layout_get_row(const led_layout_t * layout, const ws2811_led_t * leds, int y, ws2811_led_t * row);
+
+//copies row (width leds) to row y of the canvas in leds
+void led_layout_set_row(const led_layout_t * layout, ws2811_led_t * leds, int y, const ws2811_led_t * row);
+
+#endif //RPI_LEDMATRIX_SERVER_LAYOUT_H
@@ -15,11 +15,30 @@
 #include <pthread.h>
 #include <ctype.h>
 #include <errno.h>
+#include <poll.h>
 //#include "5x8_lcd_hd44780u_a02_font.h"
 //#include "BMSPA_font.h"
 //#include "Minimum_font.h"
 #include "myFont.h"
 #include "ws2811.h"
+#include "layout.h"
+#include "canvas.h"
+#include "imagecache.h"
+#include "anim.h"
+#include "resample.h"
+#include "rawframes.h"
+#include "bakedframes.h"
+#include "span.h"
+#include "prng.h"
+#include "colorspace.h"
+#include "colorcorrect.h"
+#include "transition.h"
+#include "snapshot.h"
+#include "statefile.h"
+#include "script.h"
+#include "confwatch.h"
+#include "metrics.h"
+#include "trace.h"
 
 #define DEFAULT_DEVICE_FILE "/dev/ws281x"
 #define DEFAULT_COMMAND_LINE_SIZE 2048
@@ -28,6 +47,8 @@
 #define MAX_KEY_LEN 255
 #define MAX_VAL_LEN 255
 #define MAX_LOOPS 32
+#define MAX_SEQUENCE_FRAMES 10000
+#define CLIENT_TIMEOUT 500 //ms a connected client can be idle before it is disconnected
 
 #define MODE_STDIN 0
 #define MODE_NAMED_PIPE 1
@@ -101,6 +122,9 @@ typedef struct {
 
 
 FILE *    input_file;         //the named pipe handle
+char      input_buffer[4096]; //read but not processed input of the named pipe or stdin
+int       input_length=0;
+int       input_position=0;
 char *    command_line;       //current command line
 char *    named_pipe_file;    //holds named pipe file name 
 char *    initialize_cmd=NULL; //initialize command
@@ -108,16 +132,57 @@ int       command_index;      //current position
 int       command_line_size;  //max bytes in command line
 int       exit_program=0;     //set to 1 to exit the program
 int       mode;               //mode we operate in (TCP, named pipe, file, stdin)
-do_loop   loops[MAX_LOOPS]={0};      //positions of 'do' in file loop, max 32 recursive loops
-int       loop_index=0;       //current loop index
+__thread do_loop loops[MAX_LOOPS]={0}; //positions of 'do' in file loop, max 32 recursive loops (each thread has its own)
+__thread int loop_index=0;    //current loop index
+__thread int thread_context=0; //1 in the thread that executes the thread buffer
 int       debug=0;            //set to 1 to enable debug output
 
-// size of led-matrix
-int       matrix_height=8;
-int       matrix_width=32;
+// size and wiring of the led-matrix of each channel, (x,y) -> led index lookup table built by setup / layout
+led_layout_t layouts[RPI_PWM_CHANNELS];
 
-// is every 2nd row reversed (like my longruner-led-matrix, where even rows start left and odd rows start right ...)
-int     reverse_2nd_row=1;
+// gamma / color correction of each channel, kept here because ws2811_fini frees the tables of the driver
+color_correction_t color_corrections[RPI_PWM_CHANNELS];
+uint8_t color_tables[RPI_PWM_CHANNELS][WS2811_GAMMA_TABLE_SIZE];
+int color_table_changed[RPI_PWM_CHANNELS]; //1 if the table must be installed after init
+
+// transition started by the transition command, played by the next render of the channel
+transition_t transitions[RPI_PWM_CHANNELS];
+long long transition_frame_ns[RPI_PWM_CHANNELS];
+
+#define DEFAULT_IMAGE_CACHE_SIZE 2048 //KB of decoded images kept in memory
+image_cache_t image_cache;
+
+#define DEFAULT_SNAPSHOT_MEMORY 1024 //KB of snapshots kept in memory
+snapshot_store_t snapshots;
+
+// scripts started with run, compiled once from the script directory
+script_library_t scripts;
+char running_script[SCRIPT_MAX_NAME+1]=""; //name of the script in the thread buffer
+unsigned int running_version=0;             //version of the compiled script in the thread buffer
+
+//settings of a configuration file, -1 / NULL = not in the file
+typedef struct {
+	int mode;
+	int port;
+	char * file;
+	char * pipe;
+	char * init;
+	int image_cache;
+	int snapshot_cache;
+	char * snapshot_dir;
+	char * script_dir;
+	char * metrics;
+	char * trace;
+	int debug;
+} config_t;
+
+char *         config_file=NULL; //configuration file given with -c, watched for changes
+config_t       config;           //settings of the configuration file that are in use
+config_watch_t config_watch = {-1, -1, -1, NULL};
+
+// performance counters, exported with the metrics command
+metrics_t        metrics;
+metrics_server_t metrics_server = {-1, NULL};
 
 // currently only one font with fixed size supported TODO: perhaps add fonts and make this dynamically...
 #define CHAR_HEIGHT 8
@@ -132,6 +197,7 @@ int port=0;
 
 #define JOIN_THREAD_CANCEL 0
 #define JOIN_THREAD_WAIT 1
+#define JOIN_THREAD_KEEP 2
 
 
 //for TCP/IP multithreading
@@ -149,9 +215,52 @@ int 		 join_thread_type=JOIN_THREAD_CANCEL;  //determines how next connection sh
 //pthread_mutex_t mutex_fifo_queue; 
 pthread_t thread; //a thread that will repeat code after client closed connection
 
+//the commands of the input and of the thread are executed one at a time: a command runs with command_mutex locked,
+//commands that wait (delay, animations) unlock it while they sleep so the other side can execute commands in between
+pthread_mutex_t command_mutex = PTHREAD_MUTEX_INITIALIZER;
+__thread int    command_lock_depth=0; //nested execute_command calls of this thread
+int             commands_sleeping=0;  //threads that are sleeping inside a command, changed with command_mutex locked
+
+void lock_commands(){
+	if (command_lock_depth++==0) pthread_mutex_lock(&command_mutex);
+}
+
+void unlock_commands(){
+	if (--command_lock_depth==0) pthread_mutex_unlock(&command_mutex);
+}
+
+//unlocks the commands while this thread waits, returns the depth for relock_commands
+int release_commands(){
+	int depth = command_lock_depth;
+	if (depth>0){
+		commands_sleeping++;
+		command_lock_depth=0;
+		pthread_mutex_unlock(&command_mutex);
+	}
+	return depth;
+}
+
+void relock_commands(int depth){
+	if (depth>0){
+		pthread_mutex_lock(&command_mutex);
+		command_lock_depth=depth;
+		commands_sleeping--;
+	}
+}
+
+//sleeps inside a command, other commands can run meanwhile
+void command_usleep(useconds_t us){
+	int depth = release_commands();
+	usleep(us);
+	relock_commands(depth);
+}
+
 ws2811_t ledstring;
 
 void process_character(char c);
+void add_command_character(char c, char * line, int * index, int size);
+void play_transition(int channel);
+void check_config_changes();
 
 //handles exit of program with CTRL+C
 static void ctrl_c_handler(int signum){
@@ -208,15 +317,13 @@ int color_rgbw (unsigned char r, unsigned char g, unsigned char b, unsigned char
 
 //returns a color from a 'color wheel' where wheelpos is the 'angle' 0-255
 int deg2color(unsigned char WheelPos) {
-	if(WheelPos < 85) {
-		return color(255 - WheelPos * 3,WheelPos * 3 , 0);
-	} else if(WheelPos < 170) {
-		WheelPos -= 85;
-		return color(0, 255 - WheelPos * 3, WheelPos * 3);
-	} else {
-		WheelPos -= 170;
-		return color(WheelPos * 3, 0, 255 - WheelPos * 3);
-	}
+	return color_wheel[WheelPos];
+}
+
+//returns the fully saturated color at position/steps of the way from hue start to hue stop (degrees)
+//the hue has 16 bit resolution, long gradients and slow changes don't show the 256 steps of the color wheel
+uint32_t hue_gradient(int start, int stop, long long position, long long steps){
+	return hsv_to_color((uint16_t) (HUE_DEGREES(start) + (long long) abs(stop - start) * 65536 * position / (360 * steps)), 255, 255);
 }
 
 //returns if channel is a valid led_string index number
@@ -225,11 +332,13 @@ int is_valid_channel_number(unsigned int channel){
 }
 
 //returns the index in the ledstrip depending on x and y coordinates
-int getLedIndex(int x, int y) {
-    if(reverse_2nd_row && y % 2) {
-        return y * matrix_width + matrix_width - x - 1;
-    }
-    return y * matrix_width + x;
+int getLedIndex(int channel, int x, int y) {
+    return led_layout_index(&layouts[channel], x, y);
+}
+
+//returns the 2D canvas of a channel for drawing at x,y coordinates
+void get_canvas(int channel, canvas_t * canvas){
+    canvas_init(canvas, &layouts[channel], ledstring.channel[channel].leds);
 }
 
 //reads key from argument buffer
@@ -343,12 +452,12 @@ char * read_color_arg(char * args, unsigned int * out_color, unsigned int color_
 //reads a hex brightness value
 char * read_brightness(char * args, unsigned int * brightness){
     unsigned int idx=0;
-    unsigned char str_brightness[2];
+    unsigned char str_brightness[2]={0,0};
 	if (args!=NULL && *args!=0){
 		*brightness=0;
 		while (*args!=0 && idx<2){
 			if (*args!=' ' && *args!='\t'){ //skip space
-				brightness[idx]=*args;
+				str_brightness[idx]=*args;
 				idx++;
 			}
 			args++;
@@ -358,11 +467,12 @@ char * read_brightness(char * args, unsigned int * brightness){
     return args;
 }
 
-#define OP_EQUAL 0
-#define OP_OR 1
-#define OP_AND 2
-#define OP_XOR 3
-#define OP_NOT 4
+#define OP_EQUAL SPAN_OP_SET
+#define OP_OR SPAN_OP_OR
+#define OP_AND SPAN_OP_AND
+#define OP_XOR SPAN_OP_XOR
+#define OP_NOT SPAN_OP_NOT
+#define OP_ADD SPAN_OP_ADD
 
 char * read_operation(char * args, char * op){
 	char value[MAX_VAL_LEN];
@@ -372,12 +482,24 @@ char * read_operation(char * args, char * op){
 		else if (strcmp(value, "AND")==0) *op=OP_AND;
 		else if (strcmp(value, "XOR")==0) *op=OP_XOR;
 		else if (strcmp(value, "NOT")==0) *op=OP_NOT;
+		else if (strcmp(value, "ADD")==0) *op=OP_ADD;
 		else if (strcmp(value, "=")==0) *op=OP_EQUAL;
 	}	
 	return args;
 }
 
 
+// glyph atlas of the compiled in font: the pixel columns and the trimmed width of every character
+// are cached once at startup, so rasterizing a text doesn't have to rescan the font table for each char.
+#define GLYPH_COUNT 96
+
+typedef struct {
+    unsigned char width;               //trimmed width in columns (without the spacing column)
+    unsigned char columns[CHAR_WIDTH]; //one byte per column, bit 0 is the top row
+} glyph_t;
+
+glyph_t glyph_atlas[GLYPH_COUNT];
+
 // convert the printable character to index of our font-table
 char indexOf(char c) {
     c = c & 0x7F;
@@ -389,93 +511,48 @@ char indexOf(char c) {
     return c;
 }
 
-//TODO
-int get_width(char c) {
-    if (c == ' ') return CHAR_WIDTH; //don't trim space (in fact should do that with other whitespace-chars too) ...
-    c=indexOf(c);
-    int w;
-    for(w = CHAR_WIDTH-1; w>0 && font[c][w] == 0; w--);
-    return w+1;
-}
-
-//TODO
-int is_printable_char(char c) {
-    return 1;
-}
-
-
-void render_into_vmatrix( char c, ws2811_led_t **vmatrix, int *vmatrix_width, unsigned int current_color) {
-    /*
-    //dummy: fill rectangles for each char:
-    ws2811_led_t *temp = realloc(*vmatrix, sizeof(ws2811_led_t) * (*vmatrix_width + 5) * matrix_height);
-    if(temp) {
-        *vmatrix = temp;
-        for(int i = *vmatrix_width*matrix_height;i < (*vmatrix_width + 5) * matrix_height; i++) {
-            (*vmatrix)[i].color = current_color;
-        }
-        *vmatrix_width += 5;
-    }
-    */
-
-    if (is_printable_char(c)){
-        int i,j,char_width=get_width(c);
-        ws2811_led_t *temp = realloc(*vmatrix, sizeof(ws2811_led_t) * (*vmatrix_width + 1 + char_width) * matrix_height);
-        if(temp) {
-            *vmatrix = temp;
-
-            // Convert the character to an index
-            c=indexOf(c);
-
-            // 'font' is a multidimensional array of [96][char_width]
-            // which is really just a 1D array of size 96*char_width.
-            // const unsigned char* chr = font[c*CHAR_WIDTH];
-            // Draw pixels
-            for (j=0; j<char_width; j++) {
-                for (i=0; i<CHAR_HEIGHT; i++) {
-                    if (font[c][j] & (1<<i)) {
-                        (*vmatrix + (*vmatrix_width+j) * CHAR_HEIGHT + i)->color = current_color;
-                    } else {
-                        (*vmatrix + (*vmatrix_width+j) * CHAR_HEIGHT + i)->color = 0;
-                    }
-                }
-            }
-            for (i=0; i<CHAR_HEIGHT;i++) {
-                (*vmatrix + (*vmatrix_width+j) * CHAR_HEIGHT + i)->color = 0;
-            }
-            *vmatrix_width += char_width+1;
+//builds the glyph atlas from the font table
+void init_glyph_atlas(){
+    int c,w;
+    for (c=0;c<GLYPH_COUNT;c++){
+        memcpy(glyph_atlas[c].columns, font[c], CHAR_WIDTH);
+        if (c==0){
+            w = CHAR_WIDTH; //don't trim space (in fact should do that with other whitespace-chars too) ...
+        }else{
+            for(w = CHAR_WIDTH-1; w>0 && font[c][w] == 0; w--);
+            w++;
         }
-
+        glyph_atlas[c].width = w;
     }
 }
 
+int get_width(char c) {
+    return glyph_atlas[(int)indexOf(c)].width;
+}
 
-char * read_text_into_vmatrix(char *args, ws2811_led_t **vmatrix, int *vmatrix_width, int inout, size_t color_size){
-    *vmatrix_width = 0;
-
-    unsigned int current_color=255; //(red)
-    if (args!=NULL && *args!=0){
-        if (*args==',') args++; //just in case someone made two commas?!? Or the original dev wanted to be failsafe if he forgot to increment args before calling his read_xxx functions. I'll just keep it for consistency.
-        while (*args!=0 && *args!=','){
-            if (*args == '/') { // we found our "escape-character"
-              if( *(args+1) == '/') {
-                  render_into_vmatrix('/', vmatrix, vmatrix_width, current_color);
-                  args++;
-              } else if (*(args+1) == ',') {
-                  render_into_vmatrix(',', vmatrix, vmatrix_width, current_color);
-                  args++;
-              } else {
-                  //we make no errorhandling here (yet). If / is not followed by / then it has to be followed by a color-definition.
-                  read_color(++args, &current_color, color_size);
-                  args+=2*color_size-1; //have to increas by on less than you would expect because of the "general" args++ ....
-              }
-            } else {
-                render_into_vmatrix(*args, vmatrix, vmatrix_width, current_color);
+//returns the next character to display from a marquee text and moves *text behind it
+//color escapes (/RRGGBB) change current_color, // and /, are the escaped / and ,
+//returns 0 at the end of the text (end of string or unescaped ,)
+char next_text_char(char **text, unsigned int *current_color, size_t color_size){
+    char *p = *text;
+    unsigned int i;
+    while (*p!=0 && *p!=','){
+        if (*p == '/') { // we found our "escape-character"
+            if (p[1] == '/' || p[1] == ',') {
+                *text = p+2;
+                return p[1];
             }
-            args++;
+            //we make no errorhandling here (yet). If / is not followed by / then it has to be followed by a color-definition.
+            read_color(p+1, current_color, color_size);
+            p++;
+            for (i=0; i<2*color_size && *p!=0; i++) p++;
+        } else {
+            *text = p+1;
+            return *p;
         }
     }
-
-    return args;
+    *text = p;
+    return 0;
 }
 
 //returns time stamp in ms
@@ -485,14 +562,35 @@ unsigned long long time_ms(){
 	return tp.tv_sec * 1000 + tp.tv_usec / 1000;
 }
 
-//initializes channels
+void join_thread(int cancel);
+
+//setup and init reallocate the leds and layouts that a sleeping command of the other thread still uses:
+//from the input the thread is stopped first, the thread can't run them while a command of the input sleeps
+//returns 0 if command can't run now
+int stop_other_commands(const char * command){
+    if (commands_sleeping==0) return 1;
+    if (!thread_context){
+        if (debug) printf("%s stops the thread\n", command);
+        join_thread(1);
+        return 1;
+    }
+    fprintf(stderr, "Error: %s can't run while a command of the input is running\n", command);
+    return 0;
+}
+
+//copies the gamma / color correction table of a channel to the driver, the encoder uses it from the next render
+void install_color_table(int channel){
+    if (color_table_changed[channel] && ledstring.device!=NULL && ledstring.channel[channel].gamma!=NULL){
+        memcpy(ledstring.channel[channel].gamma, color_tables[channel], WS2811_GAMMA_TABLE_SIZE);
+    }
+}
+
+//initializes channels, a second init only sets up what changed since the last one and keeps the leds
 //init <frequency>,<DMA>
 void init_channels(char * args){
     char value[MAX_VAL_LEN];
     int frequency=WS2811_TARGET_FREQ, dma=10;
     
-    if (ledstring.device!=NULL)	ws2811_fini(&ledstring);
-    
     if (args!=NULL){
         args = read_val(args, value, MAX_VAL_LEN);
         frequency=atoi(value);
@@ -502,12 +600,16 @@ void init_channels(char * args){
         }
     }
     
+    if (!stop_other_commands("init")) return;
     ledstring.dmanum=dma;
     ledstring.freq=frequency;
     if (debug) printf("Init ws2811 %d,%d\n", frequency, dma);
     ws2811_return_t ret;
-    if ((ret = ws2811_init(&ledstring))!= WS2811_SUCCESS){
+    if ((ret = ws2811_reconfigure(&ledstring))!= WS2811_SUCCESS){
         fprintf(stderr, "ws2811_init failed: %s\n", ws2811_get_return_t_str(ret));
+    }else{
+        int channel;
+        for (channel=0;channel<RPI_PWM_CHANNELS;channel++) install_color_table(channel);
     }
 }
 
@@ -531,11 +633,132 @@ void global_brightness(char * args){
     }
 }
 
+//sets the gamma exponent of a channel (1 = linear, 2.2 - 2.8 looks natural on most leds)
+//gamma <channel>,<exponent>
+void gamma_correct(char * args){
+    int channel=0;
+    char value[MAX_VAL_LEN]="";
+
+    args = read_channel(args, & channel);
+    args = read_val(args, value, MAX_VAL_LEN);
+
+    if (channel>=0 && channel<RPI_PWM_CHANNELS){
+        double exponent = *value!=0 ? atof(value) : 1.0;
+        if (exponent<=0 || exponent>10) exponent=1.0;
+
+        if (debug) printf("Gamma %d,%f\n", channel, exponent);
+
+        color_corrections[channel].gamma = exponent;
+        color_correction_build(&color_corrections[channel], color_tables[channel]);
+        color_table_changed[channel]=1;
+        install_color_table(channel);
+    }else{
+        fprintf(stderr,ERROR_INVALID_CHANNEL);
+    }
+}
+
+//sets the white balance and color temperature of a channel
+//color_correct <channel>,<r>,<g>,<b>,<temperature> (r,g,b: 0-255 = 0-100%, temperature in Kelvin, 0 = off)
+void color_correct(char * args){
+    int channel=0, r=255, g=255, b=255, temperature=0;
+
+    args = read_channel(args, & channel);
+    args = read_int(args, & r);
+    args = read_int(args, & g);
+    args = read_int(args, & b);
+    args = read_int(args, & temperature);
+
+    if (channel>=0 && channel<RPI_PWM_CHANNELS){
+        if (r<0 || r>255) r=255;
+        if (g<0 || g>255) g=255;
+        if (b<0 || b>255) b=255;
+        if (temperature<0) temperature=0;
+
+        if (debug) printf("Color correct %d,%d,%d,%d,%d\n", channel, r, g, b, temperature);
+
+        color_corrections[channel].scale[0] = r;
+        color_corrections[channel].scale[1] = g;
+        color_corrections[channel].scale[2] = b;
+        color_corrections[channel].temperature = temperature;
+        color_correction_build(&color_corrections[channel], color_tables[channel]);
+        color_table_changed[channel]=1;
+        install_color_table(channel);
+    }else{
+        fprintf(stderr,ERROR_INVALID_CHANNEL);
+    }
+}
+
+//saves the gamma / color correction table of a channel
+//save_gamma <channel>,<filename>
+void save_gamma(char * args){
+    int channel=0;
+    char filename[MAX_VAL_LEN]="";
+
+    args = read_channel(args, & channel);
+    args = read_str(args, filename, sizeof(filename));
+
+    if (channel>=0 && channel<RPI_PWM_CHANNELS){
+        if (debug) printf("save_gamma %d,%s\n", channel, filename);
+        if (color_table_save(filename, color_tables[channel])!=0){
+            fprintf(stderr, "Error: can't write %s\n", filename);
+        }
+    }else{
+        fprintf(stderr,ERROR_INVALID_CHANNEL);
+    }
+}
+
+//loads a gamma / color correction table saved with save_gamma or measured for the leds
+//load_gamma <channel>,<filename>
+void load_gamma(char * args){
+    int channel=0;
+    char filename[MAX_VAL_LEN]="";
+
+    args = read_channel(args, & channel);
+    args = read_str(args, filename, sizeof(filename));
+
+    if (channel>=0 && channel<RPI_PWM_CHANNELS){
+        if (debug) printf("load_gamma %d,%s\n", channel, filename);
+        if (color_table_load(filename, color_tables[channel])!=0){
+            fprintf(stderr, "Error: can't read a gamma table from %s\n", filename);
+            return;
+        }
+        color_table_changed[channel]=1;
+        install_color_table(channel);
+    }else{
+        fprintf(stderr,ERROR_INVALID_CHANNEL);
+    }
+}
+
+//limits the current of a channel, frames that would draw more are dimmed
+//power_limit <channel>,<max_current mA>,<led_current mA> (max_current 0 = no limit)
+void power_limit(char * args){
+    int channel=0, max_current=0, led_current=20;
+
+    args = read_channel(args, & channel);
+    args = read_int(args, & max_current);
+    args = read_int(args, & led_current);
+
+    if (channel>=0 && channel<RPI_PWM_CHANNELS){
+        if (max_current<0) max_current=0;
+        if (led_current<=0) led_current=20;
+
+        if (debug) printf("Power limit %d,%d,%d\n", channel, max_current, led_current);
+
+        ledstring.channel[channel].power.max_current = max_current;
+        ledstring.channel[channel].power.led_current = led_current;
+        ledstring.channel[channel].power.limited_frames = 0;
+    }else{
+        fprintf(stderr,ERROR_INVALID_CHANNEL);
+    }
+}
+
 //sets the ws2811 channels
 //setup channel, width, height, type, invert, global_brightness, GPIO
 void setup_ledstring(char * args){
     int channel=0, type=0, invert=0, brightness=255, GPIO=18;
-	reverse_2nd_row=1;
+    int matrix_width=32, matrix_height=8;
+    // is every 2nd row reversed (like my longruner-led-matrix, where even rows start left and odd rows start right ...)
+    int reverse_2nd_row=1;
     const int led_types[]={WS2811_STRIP_RGB, //0 
                            WS2811_STRIP_RBG, //1 
                            WS2811_STRIP_GRB, //2 
@@ -559,6 +782,7 @@ void setup_ledstring(char * args){
 	args = read_int(args, & reverse_2nd_row);
 	args = read_int(args, & GPIO);
     
+    if (!stop_other_commands("setup")) return;
     if (channel >=0 && channel < RPI_PWM_CHANNELS){
 
         if (debug) printf("Initialize channel %d,%d,%d,%d,%d,%d,%d,%d\n", channel, matrix_width, matrix_height, type, invert, brightness, reverse_2nd_row, GPIO);
@@ -579,6 +803,13 @@ void setup_ledstring(char * args){
         ledstring.channel[channel].gpionum = GPIO;
         ledstring.channel[channel].invert = invert;
         ledstring.channel[channel].count = matrix_width * matrix_height;
+
+        led_layout_config_t layout_config;
+        led_layout_default_config(&layout_config, matrix_width, matrix_height, reverse_2nd_row);
+        if (led_layout_build(&layouts[channel], &layout_config)!=0){
+            fprintf(stderr, "Unable to create the led layout for %dx%d leds\n", matrix_width, matrix_height);
+        }
+        ledstring.channel[channel].viewport = &layouts[channel].viewport;
         ledstring.channel[channel].strip_type=led_types[type];
         ledstring.channel[channel].brightness=brightness;
         ledstring.channel[channel].color_size=color_size;
@@ -597,6 +828,37 @@ void setup_ledstring(char * args){
     }
 }
 
+//changes how the leds of the matrix of a channel are wired, call after setup
+//layout <channel>,<serpentine>,<column_major>,<rotation>,<flip_x>,<flip_y>,<panel_width>,<panel_height>,<panel_serpentine>
+//serpentine = every 2nd row (column) is reversed, column_major = leds are wired column by column
+//rotation = 0, 90, 180 or 270 degrees, panel_width/height = size of one panel if the matrix is made of multiple panels
+void layout(char * args){
+    int channel=0;
+    led_layout_config_t config;
+
+    args = read_channel(args, & channel);
+    if (channel<0 || channel>=RPI_PWM_CHANNELS || layouts[channel].index==NULL){
+        fprintf(stderr, "Invalid channel number, did you call setup?\n");
+        return;
+    }
+    config = layouts[channel].config;
+    args = read_int(args, & config.serpentine);
+    args = read_int(args, & config.column_major);
+    args = read_int(args, & config.rotation);
+    args = read_int(args, & config.flip_x);
+    args = read_int(args, & config.flip_y);
+    args = read_int(args, & config.panel_width);
+    args = read_int(args, & config.panel_height);
+    args = read_int(args, & config.panel_serpentine);
+
+    if (debug) printf("layout %d,%d,%d,%d,%d,%d,%d,%d,%d\n", channel, config.serpentine, config.column_major, config.rotation,
+                      config.flip_x, config.flip_y, config.panel_width, config.panel_height, config.panel_serpentine);
+
+    if (led_layout_build(&layouts[channel], &config)!=0){
+        fprintf(stderr, "Invalid layout, rotation must be 0, 90, 180 or 270 and the panels must fill the %dx%d matrix\n", config.width, config.height);
+    }
+}
+
 //prints channel settings
 void print_settings(){
     unsigned int i;
@@ -609,9 +871,38 @@ void print_settings(){
         printf("    Count:  %d\n",ledstring.channel[i].count);
         printf("    Colors: %d\n", ledstring.channel[i].color_size);
         printf("    Type:   %d\n", ledstring.channel[i].strip_type);
+        printf("    Matrix: %dx%d\n", layouts[i].width, layouts[i].height);
+        if (ledstring.channel[i].power.max_current){
+            ws2811_power_t * power = &ledstring.channel[i].power;
+            printf("    Power:  %u mA of %u mA (%u mA without limit), brightness %u%%, %u frames dimmed\n",
+                   power->current, power->max_current, power->demand,
+                   power->scale && power->scale<256 ? power->scale * 100 / 256 : 100, power->limited_frames);
+        }
+    }
+}
+
+//moves the pixels of scrolled channels to their absolute position, must be done before
+//a command accesses the leds by their index
+void materialize_viewport(int channel){
+    if (ledstring.channel[channel].leds!=NULL && led_layout_scrolled(&layouts[channel])){
+        if (led_layout_materialize(&layouts[channel], ledstring.channel[channel].leds)!=0){
+            fprintf(stderr, "Out of memory while moving the pixels of channel %d\n", channel+1);
+        }
     }
 }
 
+void materialize_viewports(){
+    int channel;
+    for (channel=0; channel<RPI_PWM_CHANNELS; channel++) materialize_viewport(channel);
+}
+
+//sends the leds of all channels to the strips, the times the driver measured are added to the metrics
+ws2811_return_t render_leds(){
+	ws2811_return_t result = ws2811_render(&ledstring);
+	metrics_render(&metrics, &ledstring, 1, result);
+	return result;
+}
+
 //sends the buffer to the leds
 //render <channel>,0,AABBCCDDEEFF...
 //optional the colors for leds:
@@ -631,6 +922,7 @@ void render(char * args){
 		//channel = channel-1;
         if (is_valid_channel_number(channel)){
             if (*args!=0){
+                materialize_viewport(channel); //colors are given for absolute led positions
                 args = read_int(args, & start); //read start position
                 while (*args!=0 && (*args==' ' || *args==',')) args++; //skip white space
                 
@@ -653,51 +945,28 @@ void render(char * args){
         }
 	}
 	if (is_valid_channel_number(channel)){
-		ws2811_render(&ledstring);
+		if (transitions[channel].frames>0) play_transition(channel);
+		else render_leds();
 	}else{
 		fprintf(stderr,ERROR_INVALID_CHANNEL);
 	}
 }
 
+//rotates the matrix by scrolling its viewport, the pixels stay where they are and are
+//rendered with an offset (see ws2811_viewport_t), only the columns that move in are touched for a new color
 void rotate_strip(int channel, int nplaces, int direction, unsigned int new_color, int use_new_color, int new_brightness){
-	ws2811_led_t * tmp_leds=NULL; //avoid undefined behaviour when freeing memory.
-    ws2811_led_t * leds = ledstring.channel[channel].leds;
-    unsigned int led_count = ledstring.channel[channel].count;
-	unsigned int x,y;
-    int offset,fromIndex,toIndex,direction2;
-
-	direction2 = direction % 2; //direction is not limited to [0,1] so i just treat it as even as -1 and odd as 1
-    if(!direction2) direction2 = -1; //rotate to the right
-	offset=direction2*nplaces;
-	if(!use_new_color) {
-	    //store the leds we would overwrite
-	    tmp_leds =  malloc(sizeof(ws2811_led_t) * matrix_height * nplaces);
-	}
-
-	for(x=0; x< matrix_width; x++){
-	    for(y=0; y<matrix_height; y++) {
-	        // We could save execution-time by just calculating x-indices two times, instead of "matrix_height" times
-	        // But tbh., this would make it even more unreadable and is absolutely not needed.
-            toIndex = getLedIndex((x*direction2 + 2*matrix_width) % matrix_width,y);
-            fromIndex = getLedIndex((x*direction2 + 2*matrix_width + offset) % matrix_width,y);
-            if(!use_new_color && x<nplaces) { //store to temp
-                tmp_leds[y+x*nplaces]=leds[toIndex];
-            }
-            if(x >= (matrix_width - nplaces)) {
-                if(use_new_color) { //fill with new color
-                    leds[toIndex].brightness = new_brightness;
-                    leds[toIndex].color = new_color;
-                } else {    //fill from temp buffer
-                    leds[toIndex] = tmp_leds[(x - matrix_width + nplaces)*nplaces + y];
-                }
-            } else {
-                leds[toIndex] = leds [fromIndex];
-            }
-        }
-	}
-	//if(!use_new_color) { //still not sure, which solution to avoid freeing undefined memory is more beautiful.
-        free(tmp_leds);
-    //}
+    canvas_t canvas;
+    get_canvas(channel, &canvas);
+
+    //direction is not limited to [0,1] so i just treat it as even as right and odd as left
+    int left = (direction % 2) == 1;
+    canvas_scroll(&canvas, left ? nplaces : -nplaces, 0);
+
+    if(use_new_color) { //fill the columns that moved in with the new color
+        int x = left ? canvas.width - nplaces : 0;
+        canvas_fill_rect(&canvas, x, 0, nplaces, canvas.height, new_color);
+        canvas_brightness_rect(&canvas, x, 0, nplaces, canvas.height, new_brightness);
+    }
 }
 
 //shifts all colors 1 position
@@ -719,23 +988,194 @@ void rotate(char * args){
 	
 	if (debug) printf("Rotate %d %d %d %d %d\n", channel, nplaces, direction, new_color, new_brightness);
 
-	if(nplaces>=matrix_width) return; //no, we won't do that :)
-	
     if (is_valid_channel_number(channel)){
+		if(nplaces<0 || nplaces>=layouts[channel].width) return; //no, we won't do that :)
 		rotate_strip(channel, nplaces, direction, new_color, use_new_color, new_brightness);
     }else{
         fprintf(stderr,ERROR_INVALID_CHANNEL);
     }
 }
 
+//fills a rectangle of the matrix with a color
+//fill_rect <channel>,<color>,<x>,<y>,<width>,<height>,<brightness>
+//without brightness (0-255) the brightness of the leds is not changed
+void fill_rect(char * args){
+    int channel=0, x=0, y=0, width=-1, height=-1, brightness=-1;
+    unsigned int fill_color=0;
+
+    args = read_channel(args, & channel);
+    if (is_valid_channel_number(channel)) args = read_color_arg(args, & fill_color, ledstring.channel[channel].color_size);
+    args = read_int(args, & x);
+    args = read_int(args, & y);
+    args = read_int(args, & width);
+    args = read_int(args, & height);
+    args = read_int(args, & brightness);
+
+    if (is_valid_channel_number(channel)){
+        canvas_t canvas;
+        get_canvas(channel, &canvas);
+        if (width<0) width = canvas.width;
+        if (height<0) height = canvas.height;
+
+        if (debug) printf("fill_rect %d,%d,%d,%d,%d,%d,%d\n", channel, fill_color, x, y, width, height, brightness);
+
+        canvas_fill_rect(&canvas, x, y, width, height, fill_color);
+        if (brightness>=0 && brightness<=255) canvas_brightness_rect(&canvas, x, y, width, height, brightness);
+    }else{
+        fprintf(stderr,ERROR_INVALID_CHANNEL);
+    }
+}
+
+//changes the colors of a rectangle of the matrix, the rest of the matrix is not touched
+//draw <channel>,<x>,<y>,<width>,<height>,AABBCCDDEEFF...
+//the colors are given row by row (optionally separated by ,), missing colors are black, pixels outside the matrix are skipped
+void draw(char * args){
+    int channel=0, x=0, y=0, width=1, height=1, i=0;
+    uint32_t * colors;
+
+    args = read_channel(args, & channel);
+    args = read_int(args, & x);
+    args = read_int(args, & y);
+    args = read_int(args, & width);
+    args = read_int(args, & height);
+
+    if (!is_valid_channel_number(channel)){
+        fprintf(stderr,ERROR_INVALID_CHANNEL);
+        return;
+    }
+    if (width<=0 || height<=0) return;
+
+    if (debug) printf("draw %d,%d,%d,%d,%d\n", channel, x, y, width, height);
+
+    colors = (uint32_t *) calloc(width * height, sizeof(uint32_t));
+    if (colors==NULL){
+        fprintf(stderr, "Out of memory for %dx%d pixels\n", width, height);
+        return;
+    }
+    if (args!=NULL){
+        while (*args!=0 && i<width * height){
+            unsigned int color=0;
+            while (*args==' ' || *args==',') args++; //colors can be separated for readability
+            if (*args==0) break;
+            args = read_color(args, & color, ledstring.channel[channel].color_size);
+            colors[i++] = color;
+        }
+    }
+
+    canvas_t canvas;
+    get_canvas(channel, &canvas);
+    canvas_blit_colors(&canvas, x, y, colors, width, height, width);
+    free(colors);
+}
+
+//scrolls the matrix horizontal and vertical, the content wraps around unless a new color is given
+//scroll <channel>,<dx>,<dy>,<new_color>,<new_brightness>
+//positive values scroll left / up
+void scroll(char * args){
+    int channel=0, dx=1, dy=0, new_brightness=255;
+    unsigned int new_color=0;
+    int use_new_color=0;
+
+    args = read_channel(args, & channel);
+    args = read_int(args, & dx);
+    args = read_int(args, & dy);
+    if (is_valid_channel_number(channel)){
+        use_new_color = (args!=NULL && *args!=0);
+        args = read_color_arg(args, & new_color, ledstring.channel[channel].color_size);
+        args = read_int(args, & new_brightness);
+    }
+
+    if (debug) printf("scroll %d,%d,%d,%d,%d\n", channel, dx, dy, new_color, new_brightness);
+
+    if (is_valid_channel_number(channel)){
+        canvas_t canvas;
+        get_canvas(channel, &canvas);
+        if (abs(dx)>=canvas.width || abs(dy)>=canvas.height) return;
+
+        canvas_scroll(&canvas, dx, dy);
+        if (use_new_color){ //fill the columns and rows that moved in
+            int x = dx>0 ? canvas.width - dx : 0;
+            int y = dy>0 ? canvas.height - dy : 0;
+            canvas_fill_rect(&canvas, x, 0, abs(dx), canvas.height, new_color);
+            canvas_fill_rect(&canvas, 0, y, canvas.width, abs(dy), new_color);
+            canvas_brightness_rect(&canvas, x, 0, abs(dx), canvas.height, new_brightness);
+            canvas_brightness_rect(&canvas, 0, y, canvas.width, abs(dy), new_brightness);
+        }
+    }else{
+        fprintf(stderr,ERROR_INVALID_CHANNEL);
+    }
+}
+
+//mirrors (a rectangle of) the matrix
+//mirror <channel>,<vertical>,<x>,<y>,<width>,<height>
+//vertical = 0 swaps left and right (default), 1 swaps top and bottom
+void mirror(char * args){
+    int channel=0, vertical=0, x=0, y=0, width=-1, height=-1;
+
+    args = read_channel(args, & channel);
+    args = read_int(args, & vertical);
+    args = read_int(args, & x);
+    args = read_int(args, & y);
+    args = read_int(args, & width);
+    args = read_int(args, & height);
+
+    if (is_valid_channel_number(channel)){
+        canvas_t canvas;
+        get_canvas(channel, &canvas);
+        if (width<0) width = canvas.width;
+        if (height<0) height = canvas.height;
+
+        if (debug) printf("mirror %d,%d,%d,%d,%d,%d\n", channel, vertical, x, y, width, height);
+
+        if (canvas_mirror(&canvas, x, y, width, height, vertical)!=0) fprintf(stderr, "Out of memory while mirroring\n");
+    }else{
+        fprintf(stderr,ERROR_INVALID_CHANNEL);
+    }
+}
+
+//rotates a square of the matrix by 90 degrees
+//rotate90 <channel>,<turns>,<x>,<y>,<size>
+//turns = number of 90 degree turns clockwise, negative for counter clockwise (default 1)
+//size defaults to the width or height of the matrix, whichever is smaller
+void rotate90(char * args){
+    int channel=0, turns=1, x=0, y=0, size=-1;
+
+    args = read_channel(args, & channel);
+    args = read_int(args, & turns);
+    args = read_int(args, & x);
+    args = read_int(args, & y);
+    args = read_int(args, & size);
+
+    if (is_valid_channel_number(channel)){
+        canvas_t canvas;
+        get_canvas(channel, &canvas);
+        if (size<0) size = canvas.width < canvas.height ? canvas.width : canvas.height;
+
+        if (debug) printf("rotate90 %d,%d,%d,%d,%d\n", channel, turns, x, y, size);
+
+        switch (canvas_rotate90(&canvas, x, y, size, turns)){
+            case -1:
+                fprintf(stderr, "Square %d,%d size %d is not inside the matrix\n", x, y, size);
+                break;
+            case -2:
+                fprintf(stderr, "Out of memory while rotating\n");
+                break;
+        }
+    }else{
+        fprintf(stderr,ERROR_INVALID_CHANNEL);
+    }
+}
+
 //fills pixels with rainbow effect
 //count tells how many rainbows you want
-//rainbow <channel>,<count>,<startcolor>,<stopcolor>,<start>,<len>
+//rainbow <channel>,<count>,<startcolor>,<stopcolor>,<start>,<len>,<hsv>
 //start and stop = color values on color wheel (0-255)
+//hsv = 1: start and stop are hues in degrees (0-360), the colors are HSV colors
 void rainbow(char * args) {
-	int channel=0, count=1,start=0,stop=255,startled=0,len=matrix_width;
+	int channel=0, count=1,start=0,stop=-1,startled=0,len=0,matrix_width=0,hsv=0,max;
 
 	args = read_channel(args, & channel);
+	if (is_valid_channel_number(channel)) matrix_width = len = layouts[channel].width;
 	args = read_int(args, & count);
 	args = read_int(args, & start);
 	args = read_int(args, & stop);
@@ -745,24 +1185,29 @@ void rainbow(char * args) {
 	if((startled+len) > matrix_width) {
 	    len = matrix_width-startled;
 	}
+	args = read_int(args, & hsv);
 	
 	if (is_valid_channel_number(channel)){
-        if (start<0 || start > 255) start=0;
-        if (stop<0 || stop > 255) stop = 255;
+        max = hsv ? 360 : 255;
+        if (start<0 || start > max) start=0;
+        if (stop<0 || stop > max) stop = max;
         if (startled<0) startled=0;
         
-        if (debug) printf("Rainbow %d,%d,%d,%d,%d,%d\n", channel,count,start,stop,startled,len);
+        if (debug) printf("Rainbow %d,%d,%d,%d,%d,%d,%d\n", channel,count,start,stop,startled,len,hsv);
         
         int numCols = len; //ledstring.channel[channel].count;;
-        int i, j;
-        ws2811_led_t * leds = ledstring.channel[channel].leds;
-        uint32_t color;
+        int i;
+        canvas_t canvas;
+        uint32_t * colors = (uint32_t *) malloc(sizeof(uint32_t) * (numCols > 0 ? numCols : 1));
+        if (colors==NULL) return;
         for(i=0; i<numCols; i++) {
-            color = deg2color(abs(stop-start) * i * count / numCols + start);
-            for(j=0;j<matrix_height;j++){
-                leds[getLedIndex(i+startled,j)].color=color;
-            }
+            if (hsv) colors[i] = hue_gradient(start, stop, (long long) i * count, numCols);
+            else colors[i] = deg2color(abs(stop-start) * i * count / numCols + start);
         }
+        //every row of the matrix gets the same colors
+        get_canvas(channel, &canvas);
+        canvas_blit_colors(&canvas, startled, 0, colors, numCols, canvas.height, 0);
+        free(colors);
     }else{
         fprintf(stderr,ERROR_INVALID_CHANNEL);
     }
@@ -773,7 +1218,7 @@ void rainbow(char * args) {
 
 
 //fills leds with certain color
-//fill <channel>,<color>,<start>,<len>,<OR,AND,XOR,NOT,=>
+//fill <channel>,<color>,<start>,<len>,<OR,AND,XOR,NOT,ADD,=>
 void fill(char * args){
     char op=0;
 	int channel=0,start=0,len=-1;
@@ -792,36 +1237,17 @@ void fill(char * args){
 
         if (debug) printf("fill %d,%d,%d,%d,%d\n", channel, fill_color, start, len,op);
         
-        ws2811_led_t * leds = ledstring.channel[channel].leds;
-        unsigned int i;
-        for (i=start;i<start+len;i++){
-            switch (op){
-                case OP_EQUAL:
-                    leds[i].color=fill_color;
-                    break;
-                case OP_OR:
-                    leds[i].color|=fill_color;
-                    break;
-                case OP_AND:
-                    leds[i].color&=fill_color;
-                    break;
-                case OP_XOR:
-                    leds[i].color^=fill_color;
-                    break;
-                case OP_NOT:
-                    leds[i].color=~leds[i].color;
-                    break;
-            }
-        }
+        span_fill(&ledstring.channel[channel].leds[start], len, op, fill_color);
     }else{
         fprintf(stderr,ERROR_INVALID_CHANNEL);
     }
 }
 
 //dims leds
-//brightness <channel>,<brightness>,<start>,<len> (brightness: 0-255)
+//brightness <channel>,<brightness>,<start>,<len>,<scale> (brightness: 0-255)
+//scale = 1: the colors are multiplied by brightness/255 instead of setting the brightness of the leds
 void brightness(char * args){
-	int channel=0, brightness=255;
+	int channel=0, brightness=255, scale=0;
 	unsigned int start=0, len=0;
     if (is_valid_channel_number(channel)){
         len = ledstring.channel[channel].count;;
@@ -832,6 +1258,7 @@ void brightness(char * args){
 	args = read_int(args, & brightness);
 	args = read_int(args, & start);
 	args = read_int(args, & len);
+	args = read_int(args, & scale);
 	
 	
 	if (is_valid_channel_number(channel)){
@@ -840,13 +1267,118 @@ void brightness(char * args){
         if (start>=ledstring.channel[channel].count) start=0;
         if ((start+len)>ledstring.channel[channel].count) len=ledstring.channel[channel].count-start;
         
-        if (debug) printf("Changing brightness %d, %d, %d, %d\n", channel, brightness, start, len);
+        if (debug) printf("Changing brightness %d, %d, %d, %d, %d\n", channel, brightness, start, len, scale);
         
-        ws2811_led_t * leds = ledstring.channel[channel].leds;
-        unsigned int i;
-        for (i=start;i<start+len;i++){
-            leds[i].brightness=brightness;
-        }
+        if (scale) span_scale(&ledstring.channel[channel].leds[start], len, (brightness * 256 + 127) / 255);
+        else span_set_component(&ledstring.channel[channel].leds[start], len, SPAN_BRIGHTNESS, brightness);
+    }else{
+        fprintf(stderr,ERROR_INVALID_CHANNEL);
+    }
+}
+
+//rotates the hue of leds, saturation and value stay the same
+//hue_shift <channel>,<degrees>,<start>,<len>
+void hue_shift(char * args){
+	int channel=0, degrees=0;
+	unsigned int start=0, len=0;
+
+	args = read_channel(args, & channel);
+	if (is_valid_channel_number(channel)) len = ledstring.channel[channel].count;
+	args = read_int(args, & degrees);
+	args = read_uint(args, & start);
+	args = read_uint(args, & len);
+
+	if (is_valid_channel_number(channel)){
+        if (start>=ledstring.channel[channel].count) start=0;
+        if ((start+len)>ledstring.channel[channel].count) len=ledstring.channel[channel].count-start;
+
+        if (debug) printf("Hue shift %d, %d, %d, %d\n", channel, degrees, start, len);
+
+        span_hue_shift(&ledstring.channel[channel].leds[start], len, HUE_DEGREES(degrees % 360));
+    }else{
+        fprintf(stderr,ERROR_INVALID_CHANNEL);
+    }
+}
+
+//changes the saturation of leds, the largest component stays the same
+//saturate <channel>,<percent>,<start>,<len> (percent: 0 = gray, 100 = unchanged, 200 = twice as saturated)
+void saturate(char * args){
+	int channel=0, percent=100;
+	unsigned int start=0, len=0;
+
+	args = read_channel(args, & channel);
+	if (is_valid_channel_number(channel)) len = ledstring.channel[channel].count;
+	args = read_int(args, & percent);
+	args = read_uint(args, & start);
+	args = read_uint(args, & len);
+
+	if (is_valid_channel_number(channel)){
+        if (percent<0) percent=0;
+        if (percent>1000) percent=1000;
+        if (start>=ledstring.channel[channel].count) start=0;
+        if ((start+len)>ledstring.channel[channel].count) len=ledstring.channel[channel].count-start;
+
+        if (debug) printf("Saturate %d, %d, %d, %d\n", channel, percent, start, len);
+
+        span_saturate(&ledstring.channel[channel].leds[start], len, (percent * 256 + 50) / 100);
+    }else{
+        fprintf(stderr,ERROR_INVALID_CHANNEL);
+    }
+}
+
+//sets the HSV color of leds, -1 keeps the hue, saturation or value the led already has
+//fill_hsv <channel>,<hue>,<saturation>,<value>,<start>,<len> (hue in degrees 0-360, saturation and value 0-255)
+void fill_hsv(char * args){
+	int channel=0, hue=-1, saturation=-1, value=-1;
+	unsigned int start=0, len=0;
+
+	args = read_channel(args, & channel);
+	if (is_valid_channel_number(channel)) len = ledstring.channel[channel].count;
+	args = read_int(args, & hue);
+	args = read_int(args, & saturation);
+	args = read_int(args, & value);
+	args = read_uint(args, & start);
+	args = read_uint(args, & len);
+
+	if (is_valid_channel_number(channel)){
+        if (hue>=0) hue = HUE_DEGREES(hue % 360);
+        if (saturation>255) saturation=255;
+        if (value>255) value=255;
+        if (start>=ledstring.channel[channel].count) start=0;
+        if ((start+len)>ledstring.channel[channel].count) len=ledstring.channel[channel].count-start;
+
+        if (debug) printf("Fill HSV %d, %d, %d, %d, %d, %d\n", channel, hue, saturation, value, start, len);
+
+        span_set_hsv(&ledstring.channel[channel].leds[start], len, hue, saturation, value);
+    }else{
+        fprintf(stderr,ERROR_INVALID_CHANNEL);
+    }
+}
+
+//sets the HSL color of leds, -1 keeps the hue, saturation or lightness the led already has
+//fill_hsl <channel>,<hue>,<saturation>,<lightness>,<start>,<len> (hue in degrees 0-360, saturation and lightness 0-255)
+void fill_hsl(char * args){
+	int channel=0, hue=-1, saturation=-1, lightness=-1;
+	unsigned int start=0, len=0;
+
+	args = read_channel(args, & channel);
+	if (is_valid_channel_number(channel)) len = ledstring.channel[channel].count;
+	args = read_int(args, & hue);
+	args = read_int(args, & saturation);
+	args = read_int(args, & lightness);
+	args = read_uint(args, & start);
+	args = read_uint(args, & len);
+
+	if (is_valid_channel_number(channel)){
+        if (hue>=0) hue = HUE_DEGREES(hue % 360);
+        if (saturation>255) saturation=255;
+        if (lightness>255) lightness=255;
+        if (start>=ledstring.channel[channel].count) start=0;
+        if ((start+len)>ledstring.channel[channel].count) len=ledstring.channel[channel].count-start;
+
+        if (debug) printf("Fill HSL %d, %d, %d, %d, %d, %d\n", channel, hue, saturation, lightness, start, len);
+
+        span_set_hsl(&ledstring.channel[channel].leds[start], len, hue, saturation, lightness);
     }else{
         fprintf(stderr,ERROR_INVALID_CHANNEL);
     }
@@ -890,14 +1422,10 @@ void fade (char * args){
         
         if (debug) printf("fade %d, %d, %d, %d, %d, %d, %d\n", channel, startbrightness, endbrightness, delay, step,start,len);
         
-        ws2811_led_t * leds = ledstring.channel[channel].leds;
-        int i;
         for (brightness=startbrightness; (startbrightness > endbrightness ? brightness>=endbrightness:  brightness<=endbrightness) ;brightness+=step){
-            for (i=start;i<start+len;i++){
-                leds[i].brightness=brightness;
-            }
-            ws2811_render(&ledstring);
-            usleep(delay * 1000);
+            span_set_component(&ledstring.channel[channel].leds[start], len, SPAN_BRIGHTNESS, brightness);
+            render_leds();
+            command_usleep(delay * 1000);
 			if (end_current_command) break; //signal to exit this command
         } 
     }else{
@@ -938,18 +1466,11 @@ void blink (char * args){
         
         if (debug) printf("blink %d, %d, %d, %d, %d, %d, %d\n", channel, color1, color2, delay, count, start, len);
         
-        ws2811_led_t * leds = ledstring.channel[channel].leds;
-        int i,blinks;
+        int blinks;
         for (blinks=0; blinks<count;blinks++){
-            for (i=start;i<start+len;i++){
-                if ((blinks%2)==0) {
-					leds[i].color=color1;
-				}else{
-					leds[i].color=color2;
-				}
-            }
-            ws2811_render(&ledstring);
-            usleep(delay * 1000);
+            span_fill(&ledstring.channel[channel].leds[start], len, SPAN_OP_SET, (blinks%2)==0 ? color1 : color2);
+            render_leds();
+            command_usleep(delay * 1000);
 			if (end_current_command) break; //signal to exit this command
         } 
     }else{
@@ -984,52 +1505,45 @@ void gradient (char * args){
 	if (is_valid_channel_number(channel)){
         if (startlevel>0xFF) startlevel=255;
         if (endlevel>0xFF) endlevel=255;
+        if (startlevel<0) startlevel=0;
+        if (endlevel<0) endlevel=0;
         
         if (start>=ledstring.channel[channel].count) start=0;
         if ((start+len)>ledstring.channel[channel].count) len=ledstring.channel[channel].count-start;
         
         
-        float step = 1.0*(endlevel-startlevel) / (float)(len-1);
-        
         if (debug) printf("gradient %d, %c, %d, %d, %d,%d\n", channel, component, startlevel, endlevel, start,len);
         
-        ws2811_led_t * leds = ledstring.channel[channel].leds;
-        
-        float flevel = startlevel;
-        int i;
-        for (i=0; i<len;i++){
-            unsigned int level = (unsigned int) flevel;
-            if (i==len-1) level = endlevel;
-            switch (component){
-                case 'R':
-                    leds[i+start].color = (leds[i+start].color & 0xFFFFFF00) | level;
-                    break;
-                case 'G':
-                    leds[i+start].color = (leds[i+start].color & 0xFFFF00FF) | (level << 8);
-                    break;
-                case 'B':
-                    leds[i+start].color = (leds[i+start].color & 0xFF00FFFF) | (level << 16);
-                    break;
-                case 'W':
-                    leds[i+start].color = (leds[i+start].color & 0x00FFFFFF) | (level << 24);
-                    break;
-                case 'L':
-                    leds[i+start].brightness=level;
-                    break;
-            }
-            flevel+=step;
-        } 
+        switch (component){
+            case 'R':
+                span_ramp(&ledstring.channel[channel].leds[start], len, SPAN_RED, startlevel, endlevel);
+                break;
+            case 'G':
+                span_ramp(&ledstring.channel[channel].leds[start], len, SPAN_GREEN, startlevel, endlevel);
+                break;
+            case 'B':
+                span_ramp(&ledstring.channel[channel].leds[start], len, SPAN_BLUE, startlevel, endlevel);
+                break;
+            case 'W':
+                span_ramp(&ledstring.channel[channel].leds[start], len, SPAN_WHITE, startlevel, endlevel);
+                break;
+            case 'L':
+                span_ramp(&ledstring.channel[channel].leds[start], len, SPAN_BRIGHTNESS, startlevel, endlevel);
+                break;
+        }
     }else{
         fprintf(stderr,ERROR_INVALID_CHANNEL);
     }
 }
 
 //generates random colors
-//random <channel>,<start>,<len>,<RGBWL>
+//random <channel>,<start>,<len>,<RGBWL>,<seed>
+//seed = start value of the random generator, the same seed gives the same colors (default 0 = random)
 void add_random(char * args){
     char value[MAX_VAL_LEN];
 	int channel=0;
-	unsigned int start=0, len=0;
+	unsigned int start=0, len=0, seed=0;
+	prng_t prng;
     char component='L'; //L is brightness level
     int use_r=1, use_g=1, use_b=1, use_w=1, use_l=1;
     
@@ -1067,27 +1581,31 @@ void add_random(char * args){
 			}
 		}
 	}	
+	args = read_uint(args, &seed);
     
     if (is_valid_channel_number(channel)){
 
         if (start>=ledstring.channel[channel].count) start=0;
         if ((start+len)>ledstring.channel[channel].count) len=ledstring.channel[channel].count-start;
      
-        if (debug) printf("random %d,%d,%d\n", channel, start, len);
+        seed = (unsigned int) prng_seed(&prng, seed);
+        if (debug) printf("random %d,%d,%d,%u\n", channel, start, len, seed);
         
         ws2811_led_t * leds = ledstring.channel[channel].leds;
-        //unsigned int colors = ledstring[channel].color_size;
-        unsigned char r=0,g=0,b=0,w=0,l=0;
-        unsigned int i;
-        for (i=0; i<len;i++){
-            if (use_r) r = rand() % 256;
-            if (use_g) g = rand() % 256;
-            if (use_b) b = rand() % 256;
-            if (use_w) w = rand() % 256;
-            if (use_l) l = rand() % 256;
-            
-            if (use_r || use_g || use_b || use_w) leds[start+i].color = color_rgbw(r,g,b,w);
-            if (use_l) leds[start+i].brightness = l;
+        uint32_t mask = color_rgbw(use_r ? 0xFF : 0, use_g ? 0xFF : 0, use_b ? 0xFF : 0, use_w ? 0xFF : 0);
+        uint32_t random_colors[64];
+        unsigned int i, n;
+        //one random 32 bit word has all components of a led, brightness takes the low byte of a second word
+        for (i=0; i<len; i+=n){
+            n = len - i < 64 ? len - i : 64;
+            if (mask!=0){
+                prng_fill(&prng, random_colors, n * sizeof(uint32_t));
+                span_copy_colors(&leds[start+i], n, random_colors, mask);
+            }
+            if (use_l){
+                prng_fill(&prng, random_colors, n * sizeof(uint32_t));
+                span_copy_component(&leds[start+i], n, SPAN_BRIGHTNESS, random_colors);
+            }
         }
     }else{
         fprintf(stderr,ERROR_INVALID_CHANNEL);
@@ -1102,46 +1620,65 @@ typedef struct {
 	int start_color;
 }fade_in_out_led_status;
 
-//finds a random index which is currently not used by random_fade_in_out
-int find_random_free_led_index(fade_in_out_led_status * led_status, unsigned int count, unsigned int start, unsigned int len){
-	int i,j,k;
-	int index=-1;
-	int found = 1;
-	k=0;
-	//first try random
-	while (found && k < (len * 2)){ //k to prevent endless loop
-		index = start + (rand() % len);
-		found = 0;
-		for (j=0; j<count;j++) {
-			if (led_status[j].led_index == index){
-				found = 1;
-				break;
-			}
-		}
-		k++;
-	}
-	if (found){
-		index = -1;
-		//if count is too high just search for one index still available
-		for (j=start;j<start+len;j++){
-			found=0;
-			for (i=0; i<count;i++) {
-				if (led_status[i].led_index == j){
-					found = 1;//found it
-					break;
-				}
-			}
-			if (found==0){ //didn't find, can use this index
-				index=j;	
-				break;
-			}
-		}
+//leds that are not used by random_fade_in_out, a random free led is taken and given back in O(1):
+//the first count entries of leds are the free leds, position tells where a led is in leds
+typedef struct {
+	int * leds;
+	unsigned int * position;
+	unsigned int count;
+	unsigned int start;
+} led_pool_t;
+
+//puts leds start..start+len-1 in the pool, returns -2 if out of memory
+int led_pool_init(led_pool_t * pool, unsigned int start, unsigned int len){
+	unsigned int i;
+	pool->leds = (int *) malloc(sizeof(int) * len);
+	pool->position = (unsigned int *) malloc(sizeof(unsigned int) * len);
+	pool->count = len;
+	pool->start = start;
+	if (pool->leds==NULL || pool->position==NULL) return -2;
+	for (i=0; i<len; i++){
+		pool->leds[i] = start + i;
+		pool->position[i] = i;
 	}
+	return 0;
+}
+
+void led_pool_free(led_pool_t * pool){
+	free(pool->leds);
+	free(pool->position);
+}
+
+//takes a random led out of the pool, returns -1 if all leds are used
+int led_pool_take(led_pool_t * pool, prng_t * prng){
+	unsigned int pos;
+	int index, last;
+
+	if (pool->count==0) return -1;
+	pos = prng_range(prng, pool->count);
+	index = pool->leds[pos];
+	pool->count--;
+	last = pool->leds[pool->count]; //the last free led takes the place of the taken led
+	pool->leds[pos] = last;
+	pool->position[last - pool->start] = pos;
+	pool->leds[pool->count] = index;
+	pool->position[index - pool->start] = pool->count;
 	return index;
 }
 
+//gives a led taken with led_pool_take back
+void led_pool_give(led_pool_t * pool, int index){
+	unsigned int pos = pool->position[index - pool->start];
+	int first_used = pool->leds[pool->count]; //swap with the first used led
+	pool->leds[pos] = first_used;
+	pool->position[first_used - pool->start] = pos;
+	pool->leds[pool->count] = index;
+	pool->position[index - pool->start] = pool->count;
+	pool->count++;
+}
+
 //creates some kind of random blinking leds effect
-//random_fade_in_out <channel>,<duration Sec>,<count>,<delay>,<step>,<sync_delay>,<inc_dec>,<brightness>,<start>,<len>,<color>
+//random_fade_in_out <channel>,<duration Sec>,<count>,<delay>,<step>,<sync_delay>,<inc_dec>,<brightness>,<start>,<len>,<color>,<max brightness>,<seed>
 //duration = total max duration of effect
 //count = max number of leds that will fade in or out at same time
 //delay = delay between changes in brightness
@@ -1151,9 +1688,14 @@ int find_random_free_led_index(fade_in_out_led_status * led_status, unsigned int
 //len  = stop at led position
 //color  = use specific color, after blink effect color will return to initial
 //brightness = max brightness of blinking led
+//max brightness = brightness in hex (00-FF), overrides brightness
+//seed = start value of the random generator, the same seed repeats the same effect (default 0 = random)
 void random_fade_in_out(char * args){
-	unsigned int channel=0, start=0, len=0, count=0, duration=10, delay=1, step=20, sync_delay=0, inc_dec=1, brightness=255,color=0, change_color=0, i;
+	unsigned int channel=0, start=0, len=0, count=0, duration=10, delay=1, step=20, sync_delay=0, inc_dec=1, brightness=255,color=0, change_color=0, i, seed=0;
+	char value[MAX_VAL_LEN]="";
     fade_in_out_led_status *led_status;
+	prng_t prng;
+	led_pool_t pool;
 	
     if (is_valid_channel_number(channel)){
         len = ledstring.channel[channel].count;;
@@ -1172,26 +1714,36 @@ void random_fade_in_out(char * args){
 		args = read_int(args, & brightness);
 		args = read_int(args, & start);
 		args = read_int(args, & len);
-		change_color = args!=NULL && *args!=0;
-		args = read_color_arg(args, & color, ledstring.channel[channel].color_size);
-		args = read_brightness(args, & brightness);
+		args = read_str(args, value, sizeof(value));
+		change_color = value[0]!=0;
+		if (change_color) read_color(value, & color, ledstring.channel[channel].color_size);
+		args = read_str(args, value, sizeof(value));
+		read_brightness(value, & brightness);
+		args = read_uint(args, & seed);
 		
 		if (start>=ledstring.channel[channel].count) start=0;
         if ((start+len)>ledstring.channel[channel].count) len=ledstring.channel[channel].count-start;
 		if (count>len) count = len;
 		
-		if (debug) printf("random_fade_in_out %d, %d, %d, %d, %d, %d, %d, %d, %d, %d\n", channel, count, delay, step, sync_delay, inc_dec, brightness, start, len, color);
+		seed = (unsigned int) prng_seed(&prng, seed);
+		if (debug) printf("random_fade_in_out %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %u\n", channel, count, delay, step, sync_delay, inc_dec, brightness, start, len, color, seed);
 		
 		led_status = (fade_in_out_led_status *)malloc(count * sizeof(fade_in_out_led_status));
+		if (led_pool_init(&pool, start, len)!=0 || led_status==NULL){
+			fprintf(stderr, "Out of memory for random_fade_in_out\n");
+			free(led_status);
+			led_pool_free(&pool);
+			return;
+		}
 		ws2811_led_t * leds = ledstring.channel[channel].leds;
 		
-		ws2811_render(&ledstring);
+		render_leds();
 		
 		for (i=0; i<count;i++){ //first assign count random leds for fading
-			int index=find_random_free_led_index(led_status, count, start, len);
+			int index=led_pool_take(&pool, &prng);
 			led_status[i].led_index = index;
 			if (index!=-1){ //assign
-				led_status[i].delay = sync_delay ?  (rand() % sync_delay) : 0;
+				led_status[i].delay = sync_delay ?  prng_range(&prng, sync_delay) : 0;
 				led_status[i].start_brightness = leds[index].brightness;
 				led_status[i].start_color = leds[index].color;
 				led_status[i].led_index = index;
@@ -1211,30 +1763,34 @@ void random_fade_in_out(char * args){
 						if ((inc_dec==1 && led_status[i].brightness <= led_status[i].start_brightness) || (inc_dec==0 && led_status[i].brightness >= led_status[i].start_brightness)){
 							leds[led_status[i].led_index].brightness = led_status[i].start_brightness;
 							if (change_color) leds[led_status[i].led_index].color = led_status[i].start_color;
-							int index=find_random_free_led_index(led_status, count, start, len);
-							if (index!=-1){	
-								led_status[i].led_index = index;
-								led_status[i].brightness = brightness;
-								led_status[i].start_brightness = leds[led_status[i].led_index].brightness;
-								led_status[i].start_color = leds[led_status[i].led_index].color;
-								led_status[i].delay = sync_delay ?  (rand() % sync_delay) : 0;
-							}
+							//the next led is taken before this one is given back, so the same led doesn't start again
+							//unless all leds are fading
+							int index=led_pool_take(&pool, &prng);
+							if (index!=-1) led_pool_give(&pool, led_status[i].led_index);
+							else index=led_status[i].led_index;
+							led_status[i].led_index = index;
+							led_status[i].brightness = brightness;
+							led_status[i].start_brightness = leds[led_status[i].led_index].brightness;
+							led_status[i].start_color = leds[led_status[i].led_index].color;
+							led_status[i].delay = sync_delay ?  prng_range(&prng, sync_delay) : 0;
 						}
 					}
 				}else{
 					led_status[i].delay--;
 				}
 			}		
-			ws2811_render(&ledstring);
-			usleep(delay * 1000);				
+			render_leds();
+			command_usleep(delay * 1000);				
 		}
 		
 		for (i=0;i<count;i++){
+			if (led_status[i].led_index==-1) continue;
 			leds[led_status[i].led_index].brightness = led_status[i].start_brightness;
 			if (change_color) leds[led_status[i].led_index].color = led_status[i].start_color;
 		}
-		ws2811_render(&ledstring);
+		render_leds();
 		free (led_status);
+		led_pool_free(&pool);
 	}else{
 		fprintf(stderr, ERROR_INVALID_CHANNEL);
 		
@@ -1301,8 +1857,8 @@ void chaser(char * args){
 				}
 			}
 			
-			ws2811_render(&ledstring);
-			usleep(delay * 1000);
+			render_leds();
+			command_usleep(delay * 1000);
 			
 			for (n=0;n<count;n++){
 				index = direction==1 ? i - n : len - i + n;
@@ -1328,10 +1884,11 @@ void chaser(char * args){
 
 //fills pixels with rainbow effect
 //count tells how many rainbows you want
-//color_change <channel>,<startcolor>,<stopcolor>,<duration>,<start>,<len>
+//color_change <channel>,<startcolor>,<stopcolor>,<duration>,<start>,<len>,<hsv>
 //start and stop = color values on color wheel (0-255)
+//hsv = 1: start and stop are hues in degrees (0-360), the colors are HSV colors
 void color_change(char * args) {
-	int channel=0, count=1,start=0,stop=255,startled=0, len=0, duration=10000, delay=10;
+	int channel=0, count=1,start=0,stop=-1,startled=0, len=0, duration=10000, delay=10, hsv=0, max;
 	
     if (is_valid_channel_number(channel)) len=ledstring.channel[channel].count;
 	args = read_channel(args, & channel);
@@ -1341,14 +1898,16 @@ void color_change(char * args) {
 	args = read_int(args, & duration);
 	args = read_int(args, & startled);
 	args = read_int(args, & len);
+	args = read_int(args, & hsv);
 	
 	if (is_valid_channel_number(channel)){
-        if (start<0 || start > 255) start=0;
-        if (stop<0 || stop > 255) stop = 255;
+        max = hsv ? 360 : 255;
+        if (start<0 || start > max) start=0;
+        if (stop<0 || stop > max) stop = max;
         if (startled<0) startled=0;
         if (startled+len> ledstring.channel[channel].count) len = ledstring.channel[channel].count-startled;
         
-        if (debug) printf("color_change %d,%d,%d,%d,%d,%d\n", channel, start, stop, duration, startled, len);
+        if (debug) printf("color_change %d,%d,%d,%d,%d,%d,%d\n", channel, start, stop, duration, startled, len, hsv);
         
         int numPixels = len; //ledstring.channel[channel].count;;
         int i, j;
@@ -1358,14 +1917,14 @@ void color_change(char * args) {
 		unsigned long long curr_time = time_ms() - start_time;
 		
 		while (curr_time < duration){
-			unsigned int color = deg2color(abs(stop-start) * curr_time / duration + start);
+			unsigned int color = hsv ? hue_gradient(start, stop, curr_time, duration) : deg2color(abs(stop-start) * curr_time / duration + start);
 			
 			for(i=0; i<numPixels; i++) {
 				leds[startled+i].color = color;
 			}			
 			
-			ws2811_render(&ledstring);
-			usleep(delay * 1000);	
+			render_leds();
+			command_usleep(delay * 1000);	
 			curr_time = time_ms() - start_time;	
 			if (end_current_command) break; //signal to exit this command			
 		}
@@ -1416,7 +1975,7 @@ void fly_in(char * args) {
 			leds[start+i].brightness=start_brightness;
 		}
 		
-		ws2811_render(&ledstring);
+		render_leds();
 		for (i=0;i<len;i++){
 			if (use_color){
 				repl_color = color;
@@ -1437,8 +1996,8 @@ void fly_in(char * args) {
 					tmp_color = leds[start+len-j-1].color;
 					leds[start+len-j-1].color = repl_color;
 				}
-				ws2811_render(&ledstring);
-				usleep(delay * 1000);
+				render_leds();
+				command_usleep(delay * 1000);
 				if (direction){
 					leds[start+j].brightness = start_brightness;	
 					leds[start+j].color = tmp_color;
@@ -1455,8 +2014,8 @@ void fly_in(char * args) {
 				leds[start+i].brightness = brightness;
 				leds[start+i].color = repl_color;				
 			}
-			ws2811_render(&ledstring);
-			usleep(delay * 1000);		
+			render_leds();
+			command_usleep(delay * 1000);		
 			if (end_current_command) break; //signal to exit this command
 		}
 
@@ -1500,7 +2059,7 @@ void fly_out(char * args) {
         int i, j;
         ws2811_led_t * leds = ledstring.channel[channel].leds;
 		
-		ws2811_render(&ledstring);
+		render_leds();
 		for (i=0;i<len;i++){
 			if (direction){
 				repl_color = leds[start+i].color;
@@ -1525,8 +2084,8 @@ void fly_out(char * args) {
 					tmp_color = leds[start+len-i-1+j].color;
 					leds[start+len-i-1+j].color = repl_color;
 				}
-				ws2811_render(&ledstring);
-				usleep(delay * 1000);
+				render_leds();
+				command_usleep(delay * 1000);
 				if (direction){
 					leds[start+i-j].brightness = end_brightness;	
 					leds[start+i-j].color = tmp_color;
@@ -1538,8 +2097,8 @@ void fly_out(char * args) {
 			}
 			
 			if (end_current_command) break; //signal to exit this command
-			ws2811_render(&ledstring);
-			usleep(delay * 1000);
+			render_leds();
+			command_usleep(delay * 1000);
 						
 		}
 
@@ -1548,30 +2107,114 @@ void fly_out(char * args) {
     }
 }
 
-//adds a "black" space in front and at the end of my virtual matrix (size of matrix_width)
-void add_in_out_space(ws2811_led_t **vmatrix, int *vmatrix_width){
-    int i;
-    ws2811_led_t *new_vmatrix = malloc(sizeof(ws2811_led_t)*(*vmatrix_width+2*matrix_width)*matrix_height);
-    if(new_vmatrix) {
-        ws2811_led_t *temp = new_vmatrix;
-        //prepend black:
-        for(i=0;i<matrix_width*matrix_height;i++){
-            (temp++)->color=0;
-        }
-        //copy vmatrix:
-        for(i=0;i<(*vmatrix_width)*matrix_height;i++){
-            (temp++)->color = (*vmatrix)[i].color;
-        }
-        //append black:
-        for(i=0;i<matrix_width*matrix_height;i++){
-            (temp++)->color=0;
-        }
-        free(*vmatrix); //free the old memory of vmatrix
-        *vmatrix = new_vmatrix;
-        *vmatrix_width+=2*matrix_width;
-    } else {
-        //just do nothing in case of oom, outer function will free memory anyways.
+#define MARQUEE_TEXT_NEXT_LOOP 0  //marquee_text replaces the text when the current text has scrolled through
+#define MARQUEE_TEXT_APPEND 1     //marquee_text appends to the text that is scrolling
+#define MARQUEE_TEXT_NOW 2        //marquee_text replaces the text starting with the next character
+
+//state of the marquee scrolling on a channel, columns of the text are produced on demand
+//the text can be changed by marquee_text (from another client) while the marquee is running
+typedef struct {
+    int running;                //1 while a marquee command is scrolling on this channel
+    char * text;                //text to display with color escapes, only the part behind pos is still needed
+    int pos;                    //position of the next character in text
+    char * next_text;           //text to use after the current text has scrolled through (MARQUEE_TEXT_NEXT_LOOP)
+    unsigned int color;         //current color (changed by the escapes in text)
+    size_t color_size;
+    const glyph_t * glyph;      //glyph currently scrolling in, NULL if the next character must be read
+    unsigned int glyph_color;
+    int glyph_column;           //next column of glyph, glyph->width is the spacing column
+} marquee_state_t;
+
+marquee_state_t marquees[RPI_PWM_CHANNELS];
+pthread_mutex_t marquee_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//copies the (escaped) text up to the next unescaped , or end of string, returns args behind the text
+char * copy_marquee_text(char * args, char ** text){
+    char * start, * end;
+    int len;
+    if (args!=NULL && *args==',') args++;
+    start = args;
+    end = args;
+    while (end!=NULL && *end!=0 && *end!=','){
+        if (*end=='/' && end[1]!=0) end++; //escaped / and , or start of a color
+        end++;
+    }
+    len = end!=NULL ? end - start : 0;
+    *text = (char *) malloc(len + 1);
+    if (*text!=NULL){
+        if (len>0) memcpy(*text, start, len);
+        (*text)[len] = 0;
+    }
+    return end;
+}
+
+//starts the text of a marquee from the beginning, takes over the text set with MARQUEE_TEXT_NEXT_LOOP
+void marquee_restart_text(marquee_state_t * m){
+    if (m->next_text!=NULL){
+        free(m->text);
+        m->text = m->next_text;
+        m->next_text = NULL;
     }
+    m->pos = 0;
+    m->color = 255; //(red)
+}
+
+//changes the text of a marquee, see MARQUEE_TEXT_xxx for mode, takes ownership of text
+void marquee_set_text(marquee_state_t * m, char * text, int mode){
+    switch (mode){
+        case MARQUEE_TEXT_APPEND:
+            if (m->next_text!=NULL){ //a pending replacement gets the appended text too
+                char * tmp = realloc(m->next_text, strlen(m->next_text) + strlen(text) + 1);
+                if (tmp!=NULL){
+                    m->next_text = tmp;
+                    strcat(m->next_text, text);
+                }
+            }else{
+                //drop the part that already scrolled in, so a never ending ticker keeps constant memory
+                int rest = strlen(m->text + m->pos);
+                char * tmp = (char *) malloc(rest + strlen(text) + 1);
+                if (tmp!=NULL){
+                    memcpy(tmp, m->text + m->pos, rest);
+                    strcpy(tmp + rest, text);
+                    free(m->text);
+                    m->text = tmp;
+                    m->pos = 0;
+                }
+            }
+            free(text);
+            break;
+        case MARQUEE_TEXT_NOW:
+            free(m->next_text);
+            m->next_text = text;
+            marquee_restart_text(m);
+            break;
+        default:
+            free(m->next_text);
+            m->next_text = text;
+            break;
+    }
+}
+
+//produces the next column of the scrolling text (rows pixels), returns 0 at the end of the text
+int marquee_next_column(marquee_state_t * m, uint32_t * column, int rows){
+    int i, height = rows < CHAR_HEIGHT ? rows : CHAR_HEIGHT;
+    unsigned char bits=0;
+
+    if (m->glyph==NULL){
+        char * p = m->text + m->pos;
+        char c = next_text_char(&p, &m->color, m->color_size);
+        m->pos = p - m->text;
+        if (c==0) return 0;
+        m->glyph = &glyph_atlas[(int)indexOf(c)];
+        m->glyph_color = m->color;
+        m->glyph_column = 0;
+    }
+    if (m->glyph_column < m->glyph->width) bits = m->glyph->columns[m->glyph_column];
+    for (i=0; i<rows; i++){
+        column[i] = (i<height && (bits & (1<<i))) ? m->glyph_color : 0;
+    }
+    if (++m->glyph_column > m->glyph->width) m->glyph = NULL; //spacing column done
+    return 1;
 }
 
 //create some "marquee" (hope my translation for "Laufschrift" is correct, dict.cc wasn't too helpful ...)
@@ -1579,7 +2222,7 @@ void add_in_out_space(ws2811_led_t **vmatrix, int *vmatrix_width){
           .. currently  / is treated as escape-char for colors (// if you want to display /)
           .. For example: /FF0000red /335566and /00FF00green /335566are colors.
     delay .. number of ms between showing next position (more or less, we are no realtime-system..)
-    loops .. (int) Number of loops the text runs through the matrix.
+    loops .. (int) Number of loops the text runs through the matrix, 0 = forever (ticker, change the text with marquee_text)
     inout .. (int) If yes, empty space is pre- and appended, so the text runs into an empty matrix and leaves an empty matrix when finished ... (default yes)
     reverse_2nd_row .. (int) On my longruner-matrix the leds are arranged like a "snake" (bottom row from right to left, the row above from left to right and so on...)
                        thus, on such matrices (correct plural?) we have to reverse the index of every second row.
@@ -1587,65 +2230,657 @@ void add_in_out_space(ws2811_led_t **vmatrix, int *vmatrix_width){
  */
 void marquee(char * args){
     int channel=0, marquee_loops=1, inout = 1, delay=50;
-    // we render the text once and store it into a "virtual matrix" with variable width but bigger than our led-matrix.
-    // as vmatrix has to be extended, as the text grows, the "first dimension" of matrix is width ...
-    // TODO: Check if we have a problem if text is smaller than our matrix and inout is set to false...
-    int vmatrix_width;
-    ws2811_led_t *vmatrix=NULL;  //No need to malloc, will get "realloc"ated when adding characters to the matrix
-    int current_position=0,loops_finished=0;
+    // the text is never rendered as a whole: the columns are produced when they scroll in, the matrix
+    // is scrolled through its viewport and only the new column is drawn, so memory doesn't depend on the length of the text.
+    uint32_t *column=NULL;
+    canvas_t canvas;
+    int loops_finished=0, blank_columns=0, x;
+    char *text=NULL;
+    marquee_state_t *m;
 
     args = read_channel(args, &channel);
-    args = read_text_into_vmatrix(args, &vmatrix, &vmatrix_width, inout, ledstring.channel[channel].color_size);
+    args = copy_marquee_text(args, &text);
     args = read_int(args, &delay);
     args = read_int(args, &marquee_loops);
     //args = read_int(args, &reverse_2nd_row);
     args = read_int(args, &inout);
-    if (inout) add_in_out_space(&vmatrix,&vmatrix_width);
-    if (is_valid_channel_number(channel)){
-        while (!end_current_command && (/*marquee_loops == 0 ||*/ marquee_loops > loops_finished) ) {
 
-            // display matrix ...
-            for (int x = 0; x < matrix_width; x++) {
-                for (int y = 0; y < matrix_height; y++) {
-                    ledstring.channel[channel].leds[getLedIndex(x,y)].color = vmatrix[(x+current_position) * matrix_height + y].color;
+    if (!is_valid_channel_number(channel)){
+        fprintf(stderr,ERROR_INVALID_CHANNEL);
+        free(text);
+        return;
+    }
+    int matrix_width = layouts[channel].width, matrix_height = layouts[channel].height;
+    m = &marquees[channel];
+    column = (uint32_t *) calloc(matrix_height, sizeof(uint32_t));
+    if (text==NULL || column==NULL){
+        free(text);
+        free(column);
+        return;
+    }
+
+    if (debug) printf("marquee %d,%s,%d,%d,%d\n", channel, text, delay, marquee_loops, inout);
+
+    pthread_mutex_lock(&marquee_mutex); //running is tested and set at once, only one marquee starts on a channel
+    if (m->running){
+        pthread_mutex_unlock(&marquee_mutex);
+        fprintf(stderr, "Marquee already running on channel %d\n", channel+1);
+        free(text);
+        free(column);
+        return;
+    }
+    memset(m, 0, sizeof(marquee_state_t));
+    m->text = text;
+    m->color_size = ledstring.channel[channel].color_size;
+    marquee_restart_text(m);
+    m->running = 1;
+    get_canvas(channel, &canvas);
+    canvas_fill_rect(&canvas, 0, 0, matrix_width, matrix_height, 0);
+    if (!inout){ //start with the matrix already showing the beginning of the text
+        for (x=0; x<matrix_width; x++){
+            if (!marquee_next_column(m, column, matrix_height)) break;
+            canvas_blit_colors(&canvas, x, 0, column, 1, matrix_height, 1);
+        }
+    }
+    pthread_mutex_unlock(&marquee_mutex);
+
+    while (!end_current_command && (marquee_loops == 0 || marquee_loops > loops_finished)) {
+
+        render_leds();
+        command_usleep(delay * 1000);
+
+        //scroll in the next column
+        pthread_mutex_lock(&marquee_mutex);
+        if (blank_columns==0 && !marquee_next_column(m, column, matrix_height)){
+            //end of text, with inout the text scrolls out of the matrix first
+            if (inout){
+                blank_columns = matrix_width;
+            }else{
+                loops_finished++;
+                marquee_restart_text(m);
+                if (marquee_loops != 0 && marquee_loops <= loops_finished) {
+                    pthread_mutex_unlock(&marquee_mutex);
+                    break;
                 }
+                if (!marquee_next_column(m, column, matrix_height)) memset(column, 0, matrix_height * sizeof(uint32_t));
             }
-            if(++current_position > vmatrix_width-matrix_width) {
-                current_position = 0;
+        }
+        if (blank_columns>0){
+            memset(column, 0, matrix_height * sizeof(uint32_t));
+            if (--blank_columns==0){
                 loops_finished++;
+                marquee_restart_text(m);
             }
-            ws2811_render(&ledstring);
-            usleep(delay * 1000);
         }
+        pthread_mutex_unlock(&marquee_mutex);
+        canvas_scroll(&canvas, 1, 0);
+        canvas_blit_colors(&canvas, matrix_width - 1, 0, column, 1, matrix_height, 1);
+    }
+
+    pthread_mutex_lock(&marquee_mutex);
+    m->running = 0;
+    free(m->text);
+    free(m->next_text);
+    m->text = NULL;
+    m->next_text = NULL;
+    pthread_mutex_unlock(&marquee_mutex);
+    free(column);
+}
+
+//changes the text of a running marquee
+//marquee_text <channel>,<text>,<mode>
+//mode = 0 use the new text after the current text has scrolled through (default), 1 append the text, 2 replace starting with the next character
+void marquee_text(char * args){
+    int channel=0, mode=MARQUEE_TEXT_NEXT_LOOP;
+    char * text=NULL;
+
+    args = read_channel(args, &channel);
+    args = copy_marquee_text(args, &text);
+    args = read_int(args, &mode);
+
+    if (text==NULL) return;
+    if (debug) printf("marquee_text %d,%s,%d\n", channel, text, mode);
+
+    if (is_valid_channel_number(channel)){
+        pthread_mutex_lock(&marquee_mutex);
+        if (marquees[channel].running){
+            marquee_set_text(&marquees[channel], text, mode);
+            text = NULL;
+        }else{
+            fprintf(stderr, "No marquee running on channel %d\n", channel+1);
+        }
+        pthread_mutex_unlock(&marquee_mutex);
+    }else{
+        fprintf(stderr,ERROR_INVALID_CHANNEL);
     }
+    free(text);
+}
+
+//returns 1 if filename is a PNG sequence pattern with exactly one %d (optional with zero padding like %03d)
+int is_sequence_pattern(const char * filename){
+	const char * p = strchr(filename, '%');
+	if (p==NULL) return 0;
+	p++;
+	while (isdigit(*p)) p++;
+	return *p=='d' && strchr(p, '%')==NULL;
+}
+
+//loads the frames of an animation scaled to the matrix, returns 0 on success
+int load_animation(anim_t * anim, char * filename){
+	size_t len = strlen(filename);
+	if (len>4 && strcasecmp(filename + len - 4, ".gif")==0) return anim_load_gif(anim, filename);
+#ifdef USE_PNG
+	if (is_sequence_pattern(filename)){ //numbered files, starting at 0 or 1
+		char frame_file[MAX_VAL_LEN + 16];
+		int n, result=0;
+		for (n=0; n<MAX_SEQUENCE_FRAMES && result==0; n++){
+			struct stat st;
+			snprintf(frame_file, sizeof(frame_file), filename, n);
+			if (stat(frame_file, &st)!=0){
+				if (n==0) continue;
+				break;
+			}
+			result = anim_load_png(anim, frame_file);
+		}
+		return anim->frame_count > 0 ? result : -1;
+	}
+	return anim_load_png(anim, filename);
+#else
+	fprintf(stderr, "PNG support is not compiled in\n");
+	return -1;
+#endif
+}
+
+//moves the frame schedule *next by frame_ns and sleeps until the next frame is due
+//if we are more than a frame late a new schedule is started, the time to render a frame doesn't add up
+//the frames that are skipped and how late the frames start are added to the metrics
+void wait_frame(struct timespec * next, long long frame_ns){
+	struct timespec now;
+	long long late;
+
+	next->tv_sec += frame_ns / 1000000000LL;
+	next->tv_nsec += frame_ns % 1000000000LL;
+	if (next->tv_nsec >= 1000000000L){
+		next->tv_sec++;
+		next->tv_nsec -= 1000000000L;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	late = (now.tv_sec - next->tv_sec) * 1000000000LL + (now.tv_nsec - next->tv_nsec);
+	if (late > frame_ns){
+		metrics_add(&metrics.frames_dropped, late / frame_ns);
+		*next = now;
+	}else{
+		int depth = release_commands();
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL);
+		relock_commands(depth);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		late = (now.tv_sec - next->tv_sec) * 1000000000LL + (now.tv_nsec - next->tv_nsec);
+		metrics_observe(&metrics.sleep_overshoot, late > 0 ? late : 0);
+	}
+}
+
+//starts a transition: the current leds are kept as the start frame, the next render of the channel
+//shows the transition from there to what was drawn in the meantime
+//transition <channel>,<type>,<duration_ms>,<fps>
+//type = crossfade, wipe, slide or dissolve (default crossfade)
+//fps = frames per second (default 50)
+void transition(char * args){
+	int channel=0, duration=500, fps=50, type;
+	char type_name[MAX_VAL_LEN]="crossfade";
+	prng_t prng;
+
+	args = read_channel(args, & channel);
+	args = read_str(args, type_name, sizeof(type_name));
+	args = read_int(args, & duration);
+	args = read_int(args, & fps);
+
+	if (is_valid_channel_number(channel)){
+		if ((type = transition_type(type_name))<0){
+			fprintf(stderr, "Unknown transition type %s\n", type_name);
+			return;
+		}
+		if (duration<0) duration=0;
+		if (fps<=0 || fps>1000) fps=50;
+
+		if (debug) printf("transition %d,%d,%d,%d\n", channel, type, duration, fps);
+
+		prng_seed(&prng, 0);
+		transition_free(&transitions[channel]);
+		transition_frame_ns[channel] = 1000000000LL / fps;
+		switch (transition_start(&transitions[channel], type, ledstring.channel[channel].leds, ledstring.channel[channel].count,
+		                         &layouts[channel], (long long) duration * fps / 1000, &prng)){
+			case -1:
+				fprintf(stderr, "Transition %s needs a matrix set up with setup or layout\n", type_name);
+				break;
+			case -2:
+				fprintf(stderr, "Out of memory for the transition\n");
+				break;
+		}
+	}else{
+		fprintf(stderr,ERROR_INVALID_CHANNEL);
+	}
+}
+
+//plays the transition of a channel to the current leds and renders every frame
+void play_transition(int channel){
+	transition_t * t = &transitions[channel];
+	struct timespec next;
+	int frame;
+
+	if (t->count!=ledstring.channel[channel].count){ //channel was set up again
+		transition_free(t);
+		render_leds();
+		return;
+	}
+	materialize_viewport(channel);
+	transition_set_target(t, ledstring.channel[channel].leds);
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (frame=1; frame<=t->frames && !end_current_command; frame++){
+		transition_frame(t, ledstring.channel[channel].leds, frame);
+		render_leds();
+		if (frame<t->frames) wait_frame(&next, transition_frame_ns[channel]);
+	}
+	if (frame<=t->frames){ //interrupted, show the target
+		transition_frame(t, ledstring.channel[channel].leds, t->frames);
+		render_leds();
+	}
+	transition_free(t);
+}
+
+//plays an animated GIF, an APNG or a numbered sequence of PNG files
+//play <channel>,<file>,<loops>,<mode>,<first_frame>,<last_frame>,<delay>
+//file = .gif, .png (animated or not) or a PNG file name with %d for the frame number (frame_%d.png loads frame_0.png or frame_1.png, frame_2.png,...)
+//loops = number of times the animation is played, 0 = forever (default 1)
+//mode = 0 loop, 1 ping-pong (forward and backward)
+//first_frame, last_frame = only play these frames (default all frames, -1 = last frame)
+//delay = delay in ms for frames without a delay of their own like a PNG sequence (default 100)
+//all frames are decoded and scaled to the matrix before playing starts, frames are shown on a fixed schedule so the
+//time spent to render a frame doesn't add up
+void play(char * args){
+	int channel=0, loops=1, play_mode=0, first=0, last=-1, delay=100;
+	char filename[MAX_VAL_LEN]="";
+	anim_t anim;
+	canvas_t canvas;
+	struct timespec next;
+	int loop, frame, step, result;
+
+	args = read_channel(args, & channel);
+	args = read_str(args, filename, sizeof(filename));
+	args = read_int(args, & loops);
+	args = read_int(args, & play_mode);
+	args = read_int(args, & first);
+	args = read_int(args, & last);
+	args = read_int(args, & delay);
+
+	if (!is_valid_channel_number(channel)){
+		fprintf(stderr,ERROR_INVALID_CHANNEL);
+		return;
+	}
+
+	if (debug) printf("play %d,%s,%d,%d,%d,%d,%d\n", channel, filename, loops, play_mode, first, last, delay);
+
+	get_canvas(channel, &canvas);
+	anim_init(&anim, canvas.width, canvas.height);
+	result = load_animation(&anim, filename);
+	if (result!=0){
+		if (result==-2) fprintf(stderr, "Out of memory while loading %s\n", filename);
+		else fprintf(stderr, "Error: can't read animation %s\n", filename);
+		anim_free(&anim);
+		return;
+	}
+	if (debug) printf("Loaded %d frames\n", anim.frame_count);
+
+	if (last<0 || last>=anim.frame_count) last = anim.frame_count-1;
+	if (first<0 || first>last) first = 0;
+	if (delay<=0) delay=100;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (loop=0; (loops<=0 || loop<loops) && !end_current_command; loop++){
+		frame = first;
+		step = 1;
+		while (!end_current_command){
+			unsigned int frame_delay = anim.delays[frame] ? anim.delays[frame] : delay;
+
+			canvas_blit_colors(&canvas, 0, 0, anim_frame(&anim, frame), anim.width, anim.height, anim.width);
+			render_leds();
+
+			wait_frame(&next, frame_delay * 1000000LL);
+
+			if (frame==last && step==1){
+				if (play_mode!=1 || first==last) break;
+				step = -1; //ping-pong: go back to the first frame
+			}
+			frame += step;
+			if (step==-1 && frame==first) break; //first frame is shown again at the start of the next loop
+		}
+	}
+	anim_free(&anim);
+}
+
+//plays a pre-rendered show from a raw frame file (see rawframes.h for the format)
+//playraw <channel>,<file>,<fps>,<loops>
+//fps = frames per second, 0 = use the fps of the file (default)
+//loops = number of times the show is played, 0 = forever (default 1)
+//the file is memory mapped and read ahead by the kernel, every frame is copied to the leds without parsing or allocation
+void playraw(char * args){
+	int channel=0, fps=0, loops=1, loop;
+	char filename[MAX_VAL_LEN]="";
+	raw_frames_t raw;
+	canvas_t canvas;
+	struct timespec next;
+	uint32_t * row=NULL;
+	unsigned int frame;
+	int result, y;
+
+	args = read_channel(args, & channel);
+	args = read_str(args, filename, sizeof(filename));
+	args = read_int(args, & fps);
+	args = read_int(args, & loops);
+
+	if (!is_valid_channel_number(channel)){
+		fprintf(stderr,ERROR_INVALID_CHANNEL);
+		return;
+	}
+
+	if (debug) printf("playraw %d,%s,%d,%d\n", channel, filename, fps, loops);
+
+	result = raw_frames_open(&raw, filename);
+	if (result!=0){
+		if (result==-3) fprintf(stderr, "Error: %s is not a raw frame file\n", filename);
+		else fprintf(stderr, "Error: can't open %s\n", filename);
+		return;
+	}
+	if (fps<=0) fps = raw.fps;
+	if (fps<=0) fps = 25;
+	if (debug) printf("%d frames %dx%d format %d at %d fps\n", raw.frame_count, raw.width, raw.height, raw.format, fps);
+
+	if (raw.format!=RAW_FORMAT_LED){
+		row = (uint32_t *) malloc(sizeof(uint32_t) * raw.width);
+		if (row==NULL){
+			fprintf(stderr, "Out of memory for %s\n", filename);
+			raw_frames_close(&raw);
+			return;
+		}
+	}
+
+	get_canvas(channel, &canvas);
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (loop=0; (loops<=0 || loop<loops) && !end_current_command && raw.frame_count>0; loop++){
+		for (frame=0; frame<raw.frame_count && !end_current_command; frame++){
+			const uint8_t * data = raw_frame(&raw, frame);
+
+			if (raw.format==RAW_FORMAT_LED){
+				canvas_blit_colors(&canvas, 0, 0, (const uint32_t *) data, raw.width, raw.height, raw.width);
+			}else{
+				for (y=0; y<raw.height && y<canvas.height; y++){
+					raw_frames_to_colors(&raw, data + (size_t) y * (raw.frame_size / raw.height), row, raw.width);
+					canvas_blit_colors(&canvas, 0, y, row, raw.width, 1, raw.width);
+				}
+			}
+			render_leds();
+			wait_frame(&next, 1000000000LL / fps);
+		}
+	}
+	free(row);
+	raw_frames_close(&raw);
+}
+
+//encodes the frames of a raw frame file or an animation to the PWM/PCM/SPI symbols of the current configuration
+//bake <channel>,<source>,<file>,<fps>
+//source = raw frame file (see playraw) or any animation play can read, the frames are drawn on <channel>
+//file = baked frame file to write, play it with playbaked
+//fps = frames per second, 0 = fps of the raw frame file or the delays of the animation (default)
+//the baked file can only be played with the same strip type, brightness, gamma, invert and driver of all channels
+void bake(char * args){
+	int channel=0, fps=0, result;
+	char source[MAX_VAL_LEN]="", filename[MAX_VAL_LEN]="";
+	raw_frames_t raw;
+	anim_t anim;
+	canvas_t canvas;
+	ws2811_raw_config_t config;
+	baked_writer_t writer;
+	ws2811_led_t * saved_leds;
+	uint8_t * encoded;
+	uint32_t * row=NULL;
+	unsigned int frame, frame_count;
+	int y;
+
+	args = read_channel(args, & channel);
+	args = read_str(args, source, sizeof(source));
+	args = read_str(args, filename, sizeof(filename));
+	args = read_int(args, & fps);
+
+	if (!is_valid_channel_number(channel)){
+		fprintf(stderr,ERROR_INVALID_CHANNEL);
+		return;
+	}
+
+	if (debug) printf("bake %d,%s,%s,%d\n", channel, source, filename, fps);
+
+	get_canvas(channel, &canvas);
+	anim_init(&anim, canvas.width, canvas.height);
+	result = raw_frames_open(&raw, source);
+	if (result==0){
+		frame_count = raw.frame_count;
+		if (fps<=0) fps = raw.fps;
+		if (raw.format!=RAW_FORMAT_LED) row = (uint32_t *) malloc(sizeof(uint32_t) * raw.width);
+	}else{
+		//not a raw frame file, a numbered image sequence can't even be opened as a file: try the animation formats
+		result = load_animation(&anim, source);
+		if (result!=0){
+			fprintf(stderr, "Error: can't read %s\n", source);
+			anim_free(&anim);
+			return;
+		}
+		frame_count = anim.frame_count;
+	}
+	if (fps<=0 && raw.map!=NULL) fps = 25;
+
+	ws2811_get_raw_config(&ledstring, &config);
+	encoded = (uint8_t *) malloc(config.raw_size);
+	saved_leds = (ws2811_led_t *) malloc(sizeof(ws2811_led_t) * ledstring.channel[channel].count);
+	if (encoded==NULL || saved_leds==NULL || (raw.map!=NULL && raw.format!=RAW_FORMAT_LED && row==NULL)){
+		fprintf(stderr, "Out of memory for baking %s\n", source);
+	}else if (baked_create(&writer, filename, &config)!=0){
+		fprintf(stderr, "Error: can't write %s\n", filename);
+	}else{
+		//the frames are drawn on the leds to encode them, the leds are restored afterwards
+		memcpy(saved_leds, ledstring.channel[channel].leds, sizeof(ws2811_led_t) * ledstring.channel[channel].count);
+		ws2811_wait(&ledstring); //the idle and reset bits are taken from the DMA buffer
+		for (frame=0, result=0; frame<frame_count && result==0 && !end_current_command; frame++){
+			uint32_t delay;
+
+			if (raw.map!=NULL){
+				const uint8_t * data = raw_frame(&raw, frame);
+				if (raw.format==RAW_FORMAT_LED){
+					canvas_blit_colors(&canvas, 0, 0, (const uint32_t *) data, raw.width, raw.height, raw.width);
+				}else{
+					for (y=0; y<raw.height && y<canvas.height; y++){
+						raw_frames_to_colors(&raw, data + (size_t) y * (raw.frame_size / raw.height), row, raw.width);
+						canvas_blit_colors(&canvas, 0, y, row, raw.width, 1, raw.width);
+					}
+				}
+				delay = 1000000 / fps;
+			}else{
+				canvas_blit_colors(&canvas, 0, 0, anim_frame(&anim, frame), anim.width, anim.height, anim.width);
+				if (fps>0) delay = 1000000 / fps;
+				else delay = (anim.delays[frame] ? anim.delays[frame] : 100) * 1000;
+			}
+			ws2811_encode(&ledstring, encoded, frame==0);
+			result = baked_write_frame(&writer, encoded, delay);
+		}
+		memcpy(ledstring.channel[channel].leds, saved_leds, sizeof(ws2811_led_t) * ledstring.channel[channel].count);
+		if (baked_finish(&writer)!=0 || result!=0) fprintf(stderr, "Error: can't write %s\n", filename);
+		else if (debug) printf("Baked %d frames of %d bytes\n", writer.header.frame_count, config.raw_size);
+	}
+	free(encoded);
+	free(saved_leds);
+	free(row);
+	raw_frames_close(&raw);
+	anim_free(&anim);
+}
+
+//plays a file written by bake, the frames are copied to the DMA buffer as they are
+//playbaked <file>,<loops>,<fps>
+//loops = number of times the frames are played, 0 = forever (default 1)
+//fps = frames per second, 0 = the frame times stored by bake (default)
+//the frames are sent without the power limiter, so nothing is played while a channel has a power_limit
+void playbaked(char * args){
+	int loops=1, fps=0, loop, result, channel;
+	char filename[MAX_VAL_LEN]="";
+	baked_frames_t baked;
+	ws2811_raw_config_t config;
+	struct timespec next;
+	unsigned int frame;
+
+	args = read_str(args, filename, sizeof(filename));
+	args = read_int(args, & loops);
+	args = read_int(args, & fps);
 
-    free(vmatrix);
+	if (debug) printf("playbaked %s,%d,%d\n", filename, loops, fps);
+
+	if (ledstring.device==NULL){
+		fprintf(stderr, "Error: can't play %s, call setup and init first\n", filename);
+		return;
+	}
+	for (channel=0; channel<RPI_PWM_CHANNELS; channel++){
+		if (ledstring.channel[channel].power.max_current){
+			fprintf(stderr, "Error: can't play %s, channel %d has a power_limit and baked frames can't be dimmed\n", filename, channel+1);
+			return;
+		}
+	}
+
+	ws2811_get_raw_config(&ledstring, &config);
+	result = baked_open(&baked, filename, &config);
+	if (result!=0){
+		if (result==-4) fprintf(stderr, "Error: %s was baked with another led configuration, bake it again\n", filename);
+		else if (result==-3) fprintf(stderr, "Error: %s is not a baked frame file\n", filename);
+		else fprintf(stderr, "Error: can't open %s\n", filename);
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (loop=0; (loops<=0 || loop<loops) && !end_current_command && baked.header.frame_count>0; loop++){
+		for (frame=0; frame<baked.header.frame_count && !end_current_command; frame++){
+			metrics_render(&metrics, &ledstring, 0, ws2811_render_raw(&ledstring, baked_frame(&baked, frame)));
+			wait_frame(&next, fps>0 ? 1000000000LL / fps : baked_frame_delay(&baked, frame) * 1000LL);
+		}
+	}
+	baked_close(&baked);
+}
+
+//stores the leds of all channels in memory
+//snapshot <name>,<persist>
+//persist = 1 also writes the snapshot to the snapshot directory (in the background) so it can be recalled after a restart
+void snapshot(char * args){
+	char name[MAX_VAL_LEN]="";
+	int persist=0;
+
+	args = read_str(args, name, sizeof(name));
+	args = read_int(args, & persist);
+
+	if (debug) printf("snapshot %s,%d\n", name, persist);
+
+	switch (snapshot_save(&snapshots, name, &ledstring, persist)){
+		case -1:
+			fprintf(stderr, "Invalid snapshot name %s (use letters, digits, _ - .)\n", name);
+			break;
+		case -2:
+			fprintf(stderr, "Not enough memory for snapshot %s, see snapshot_cache\n", name);
+			break;
+		case -3:
+			fprintf(stderr, "Can't save snapshot %s, no snapshot_dir set\n", name);
+			break;
+	}
+}
+
+//restores the leds of all channels from a snapshot
+//recall <name>
+void recall(char * args){
+	char name[MAX_VAL_LEN]="";
+
+	args = read_str(args, name, sizeof(name));
+
+	if (debug) printf("recall %s\n", name);
+
+	switch (snapshot_recall(&snapshots, name, &ledstring)){
+		case -1:
+			fprintf(stderr, "Snapshot %s not found\n", name);
+			break;
+		case -2:
+			fprintf(stderr, "Snapshot %s was taken with another number of leds, changed channels are not restored\n", name);
+			break;
+	}
+}
+
+//removes a snapshot from memory and disk
+//snapshot_delete <name>
+void delete_snapshot(char * args){
+	char name[MAX_VAL_LEN]="";
+
+	args = read_str(args, name, sizeof(name));
+
+	if (debug) printf("snapshot_delete %s\n", name);
+	if (snapshot_delete(&snapshots, name)!=0) fprintf(stderr, "Snapshot %s not found\n", name);
+}
+
+//changes the memory used for snapshots
+//snapshot_cache <size>
+void set_snapshot_cache(char * args){
+	int size=DEFAULT_SNAPSHOT_MEMORY;
+	args = read_int(args, & size);
+	if (size<0) size=0;
+	if (debug) printf("snapshot_cache %d (used %zu KB)\n", size, snapshots.used / 1024);
+	snapshot_set_budget(&snapshots, (size_t) size * 1024);
+}
+
+//sets the directory of persistent snapshots
+//snapshot_dir <directory>
+void set_snapshot_dir(char * args){
+	char directory[MAX_VAL_LEN]="";
+	args = read_str(args, directory, sizeof(directory));
+	if (debug) printf("snapshot_dir %s\n", directory);
+	if (snapshot_set_directory(&snapshots, directory)!=0) fprintf(stderr, "Out of memory\n");
 }
 
-//save_state <channel>,<filename>,<start>,<len>
+//save_state <channel>,<filename>,<start>,<len>,<format>
+//format = binary (default) or csv (text file of older versions, one line per led)
 void save_state(char * args){
 	int channel=0,start=0, len=0, color, brightness,i=0;
 	char filename[MAX_VAL_LEN];
+	char format[MAX_VAL_LEN]="binary";
 
 	args = read_channel(args, & channel);
 	if (is_valid_channel_number(channel)) len=ledstring.channel[channel].count;
 	args = read_str(args, filename, sizeof(filename));
 	args = read_int(args, & start);
 	args = read_int(args, & len);
+	args = read_str(args, format, sizeof(format));
 	
 	if (is_valid_channel_number(channel)){		
 		FILE * outfile;
 
 		if (start<0) start=0;
+		if (start>ledstring.channel[channel].count) start=ledstring.channel[channel].count;
         if (start+len> ledstring.channel[channel].count) len = ledstring.channel[channel].count-start;
+		if (len<0) len=0;
 		
-		if (debug) printf("save_state %d,%s,%d,%d\n", channel, filename, start, len);
+		if (debug) printf("save_state %d,%s,%d,%d,%s\n", channel, filename, start, len, format);
 		
+		ws2811_led_t * leds = ledstring.channel[channel].leds;
+
+		if (strcmp(format, "csv")!=0){
+			if (state_file_save(filename, &leds[start], len, start, &ledstring.channel[channel], layouts[channel].width, layouts[channel].height)!=0){
+				fprintf(stderr, "Error: can't write %s\n", filename);
+			}
+			return;
+		}
+
 		if ((outfile = fopen(filename, "wb")) == NULL) {
 			fprintf(stderr, "Error: can't open %s\n", filename);
 			return;
 		}
-		ws2811_led_t * leds = ledstring.channel[channel].leds;
 		
 		for (i=0;i<len;i++){
 			color = leds[start+i].color;
@@ -1658,11 +2893,13 @@ void save_state(char * args){
 }
 
 //load_state <channel>,<filename>,<start>,<len>
+//loads binary files and the text files of older versions
 void load_state(char * args){
 	FILE * infile;		/* source file */
 	int channel=0,start=0, len=0, color, brightness, i=0;
 	char filename[MAX_VAL_LEN];
 	char fline[MAX_VAL_LEN];
+	state_file_t state;
 
 	args = read_channel(args, & channel);
 	if (is_valid_channel_number(channel)) len=ledstring.channel[channel].count;
@@ -1673,17 +2910,36 @@ void load_state(char * args){
 	if (is_valid_channel_number(channel)){	
 	
 		if (start<0) start=0;
+		if (start>ledstring.channel[channel].count) start=ledstring.channel[channel].count;
 		if (start+len> ledstring.channel[channel].count) len = ledstring.channel[channel].count-start;
+		if (len<0) len=0;
 		
 		if (debug) printf("load_state %d,%s,%d,%d\n", channel, filename, start, len);
 		
+		ws2811_led_t * leds = ledstring.channel[channel].leds;
+
+		switch (state_file_open(&state, filename)){
+			case 0:
+				if (debug && state.color_size!=ledstring.channel[channel].color_size){
+					printf("load_state: %s was saved from a channel with %d colors\n", filename, state.color_size);
+				}
+				state_file_to_leds(&state, &leds[start], len);
+				state_file_close(&state);
+				return;
+			case -1:
+				fprintf(stderr, "Error: can't open %s\n", filename);
+				return;
+			case -4:
+				fprintf(stderr, "Error: %s is damaged or was saved by a newer version\n", filename);
+				return;
+		}
+
+		//text file: one line per led
 		if ((infile = fopen(filename, "rb")) == NULL) {
 			fprintf(stderr, "Error: can't open %s\n", filename);
 			return;
 		}
 		
-		ws2811_led_t * leds = ledstring.channel[channel].leds;
-		
 		while (i < len && !feof(infile) && fscanf(infile, "%x,%x", & color, & brightness)>0){
 			leds[start+i].color = color;
 			leds[start+i].brightness=brightness;
@@ -1695,7 +2951,7 @@ void load_state(char * args){
 }
 
 void start_loop (char * args){
-    if (mode==MODE_FILE){
+    if (mode==MODE_FILE && !thread_context){
         if (loop_index>=MAX_LOOPS){
             loop_index=MAX_LOOPS-1;
             printf("Warning max nested loops reached!\n");
@@ -1705,7 +2961,7 @@ void start_loop (char * args){
         loops[loop_index].do_pos = ftell(input_file);
         loops[loop_index].n_loops=0;
         loop_index++;
-    }else if (mode==MODE_TCP){
+    }else if (mode==MODE_TCP || thread_context){
         if (loop_index<MAX_LOOPS){
             if (debug) printf ("do %d\n", thread_read_index);
             loops[loop_index].do_pos = thread_read_index;
@@ -1724,7 +2980,7 @@ void end_loop(char * args){
 		args = read_int(args, &max_loops);
 		args = read_int(args, &step);
     }
-    if (mode==MODE_FILE){
+    if (mode==MODE_FILE && !thread_context){
         if (debug) printf ("loop %d, %d, %d\n", ftell(input_file), max_loops, step);
         if (loop_index==0){ //no do found!
             fseek(input_file, 0, SEEK_SET);
@@ -1736,7 +2992,7 @@ void end_loop(char * args){
                 if (loop_index>0) loop_index--; //exit loop
             }
         }
-    }else if (mode==MODE_TCP){
+    }else if (mode==MODE_TCP || thread_context){
         if (debug) printf("loop %d\n", thread_read_index);
         if (loop_index==0){
             thread_read_index=0; 
@@ -1753,27 +3009,215 @@ void end_loop(char * args){
 
 
 
-//read JPEG image and put pixel data to LEDS
-//readjpg <channel>,<FILE>,<start>,<len>,<offset>,<OR AND XOR NOT =>,<delay>
-//offset = where to start in JPEG file
-//DELAY = delay ms between 2 reads of LEN pixels, default=0 if 0 only <len> bytes at <offset> will be read
-#ifdef USE_JPEG
-void readjpg(char * args){
-	struct jpeg_decompress_struct cinfo;
-	struct my_error_mgr jerr;
-	
-	char value[MAX_VAL_LEN];
-	int channel=0;
-	char filename[MAX_VAL_LEN];
-	unsigned int start=0, len=1, offset=0;
-	int op=0,delay=0;
-    
-	args = read_channel(args, & channel);
-	if (is_valid_channel_number(channel)) len=ledstring.channel[channel].count;
-	args = read_str(args, filename, sizeof(filename));
-	args = read_int(args, &start);
-	args = read_int(args, &len);
+//state of putting the pixels of an image to the leds, the pixels can be given in parts (e.g. row by row)
+typedef struct {
+	int channel;
+	unsigned int start, len, offset;
+	int op, delay;
+	unsigned int pixel;		//index in the image of the next pixel given to image_feed
+	unsigned int led_idx;
+} image_feed_t;
+
+//pixel <offset> of the image goes to led <start>, with a delay the next <len> pixels are shown after delay ms until the end of the image
+//returns 0 if no pixels are needed
+int image_feed_init(image_feed_t * feed, int channel, unsigned int start, unsigned int len, unsigned int offset, int op, int delay){
+	if (start>=ledstring.channel[channel].count) start=0;
+	if ((start+len)>ledstring.channel[channel].count) len=ledstring.channel[channel].count-start;
+	feed->channel=channel;
+	feed->start=start;
+	feed->len=len;
+	feed->offset=offset;
+	feed->op=op;
+	feed->delay=delay;
+	feed->pixel=0;
+	feed->led_idx=start; //start at this led index
+	return len!=0;
+}
+
+//skips the next count pixels if they are all before offset, these pixels don't have to be decoded
+//returns 0 if the pixels are needed and must be given to image_feed
+int image_feed_skip(image_feed_t * feed, unsigned int count){
+	if (feed->pixel + count > feed->offset) return 0;
+	feed->pixel+=count;
+	return 1;
+}
+
+//puts the next count pixels of the image to the leds, returns 0 if no more pixels are needed
+int image_feed(image_feed_t * feed, const uint32_t * pixels, unsigned int count){
+	ws2811_led_t * leds = ledstring.channel[feed->channel].leds;
+	unsigned int i = 0;
+
+	if (feed->pixel < feed->offset){
+		i = feed->offset - feed->pixel;
+		if (i > count) i = count;
+	}
+	for (; i<count && end_current_command==0; i++){
+		switch (feed->op){
+			case 0:
+				leds[feed->led_idx].color=pixels[i];
+				break;
+			case 1:
+				leds[feed->led_idx].color|=pixels[i];
+				break;
+			case 2:
+				leds[feed->led_idx].color&=pixels[i];
+				break;
+			case 3:
+				leds[feed->led_idx].color^=pixels[i];
+				break;
+			case 4:
+				leds[feed->led_idx].color=~pixels[i];
+				break;
+		}
+		feed->led_idx++;
+		if (feed->led_idx==feed->start + feed->len){
+			if (feed->delay!=0){//reset led index if we are at end of led string and delay
+				feed->led_idx=feed->start;
+				render_leds();
+				command_usleep(feed->delay * 1000);
+			}else{
+				feed->pixel+=i+1;
+				return 0;
+			}
+		}
+	}
+	feed->pixel+=count;
+	return end_current_command==0;
+}
+
+//puts the pixels of a decoded image to the leds, see image_feed_init
+void image_to_leds(int channel, const uint32_t * pixels, unsigned int pixel_count, unsigned int start, unsigned int len, unsigned int offset, int op, int delay){
+	image_feed_t feed;
+	if (image_feed_init(&feed, channel, start, len, offset, op, delay)) image_feed(&feed, pixels, pixel_count);
+}
+
+//decodes an image file to width*height led colors, returns NULL on error
+typedef uint32_t * (*image_decoder_t)(char * filename, const image_cache_options_t * options, int * width, int * height);
+
+//gets the pixels of an image from the image cache, images that are not cached (or modified) are decoded and added to the cache
+//returns the cache entry that must be released after use, if NULL is returned the caller must free *pixels
+image_cache_entry_t * load_image(char * filename, const image_cache_options_t * options, image_decoder_t decoder, uint32_t ** pixels, int * width, int * height){
+	image_cache_entry_t * entry = image_cache_get(&image_cache, filename, options);
+	if (entry==NULL){
+		if (debug) printf("Decoding %s\n", filename);
+		TRACE_BEGIN("decode");
+		*pixels = decoder(filename, options, width, height);
+		TRACE_END();
+		if (*pixels==NULL) return NULL;
+		entry = image_cache_put(&image_cache, filename, options, *pixels, *width, *height);
+		if (entry==NULL) return NULL;
+	}
+	*pixels = entry->pixels;
+	*width = entry->width;
+	*height = entry->height;
+	return entry;
+}
+
+//changes the memory used for caching decoded images
+//image_cache <size>
+//size = maximum KB of pixel data to keep in memory, 0 = disable the cache
+void set_image_cache(char * args){
+	int size=DEFAULT_IMAGE_CACHE_SIZE;
+	args = read_int(args, &size);
+	if (size<0) size=0;
+	if (debug) printf("image_cache %d (used %zu KB, %d hits, %d misses)\n", size, image_cache.used / 1024, image_cache.hits, image_cache.misses);
+	image_cache_set_budget(&image_cache, (size_t) size * 1024);
+}
+
+#ifdef USE_JPEG
+uint32_t * decode_jpg(char * filename, const image_cache_options_t * options, int * width, int * height){
+	struct jpeg_decompress_struct cinfo;
+	struct my_error_mgr jerr;
+	FILE * infile;		/* source file */
+	uint32_t * volatile pixels = NULL;
+	int row_stride;		/* physical row width in output buffer */
+
+	if ((infile = fopen(filename, "rb")) == NULL) {
+		fprintf(stderr, "Error: can't open %s\n", filename);
+		return NULL;
+	}
+
+	// We set up the normal JPEG error routines, then override error_exit.
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = my_error_exit;
+	// Establish the setjmp return context for my_error_exit to use.
+	if (setjmp(jerr.setjmp_buffer)) {
+		/* If we get here, the JPEG code has signaled an error.
+		 * We need to clean up the JPEG object, close the input file, and return.
+		 */
+		jpeg_destroy_decompress(&cinfo);
+		fclose(infile);
+		free(pixels);
+		return NULL;
+	}
+
+	// Now we can initialize the JPEG decompression object.
+	jpeg_create_decompress(&cinfo);
+	jpeg_stdio_src(&cinfo, infile);
+
+	jpeg_read_header(&cinfo, TRUE);
+	if (options->min_width>0 && options->min_height>0){ //let libjpeg skip the detail we don't need
+		cinfo.scale_num = 1;
+		cinfo.scale_denom = 1;
+		while (cinfo.scale_denom < 8 && cinfo.image_width / (cinfo.scale_denom * 2) >= options->min_width &&
+		       cinfo.image_height / (cinfo.scale_denom * 2) >= options->min_height){
+			cinfo.scale_denom *= 2;
+		}
+		if (cinfo.scale_denom > 1) cinfo.dct_method = JDCT_IFAST;
+	}
+	jpeg_start_decompress(&cinfo);
+
+	row_stride = cinfo.output_width * cinfo.output_components;
+	pixels = (uint32_t *) malloc(sizeof(uint32_t) * cinfo.output_width * cinfo.output_height);
+	if (pixels!=NULL){
+		JSAMPARRAY buffer;	// Output row buffer
+		uint32_t * dst = pixels;
+		int i;
+		buffer = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE, row_stride, 1);
+
+		while (cinfo.output_scanline < cinfo.output_height) {
+			jpeg_read_scanlines(&cinfo, buffer, 1);
+			for(i=0;i<cinfo.output_width;i++){
+				unsigned char * src = &buffer[0][i*cinfo.output_components];
+				if (cinfo.output_components==1){ //grayscale image
+					*dst++ = color(src[0], src[0], src[0]);
+				}else{
+					*dst++ = color(src[0], src[1], src[2]);
+				}
+			}
+		}
+		*width = cinfo.output_width;
+		*height = cinfo.output_height;
+	}else{
+		fprintf(stderr, "Out of memory for JPEG image %s\n", filename);
+		jpeg_abort_decompress(&cinfo);
+	}
+
+	if (pixels!=NULL) jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	fclose(infile);
+	return pixels;
+}
+
+//read JPEG image and put pixel data to LEDS
+//readjpg <channel>,<FILE>,<start>,<len>,<offset>,<OR AND XOR NOT =>,<delay>
+//offset = where to start in JPEG file
+//DELAY = delay ms between 2 reads of LEN pixels, default=0 if 0 only <len> bytes at <offset> will be read
+//the decoded image is kept in the image cache, reading it again only copies the pixels
+void readjpg(char * args){
+	char value[MAX_VAL_LEN]="";
+	int channel=0;
+	char filename[MAX_VAL_LEN];
+	unsigned int start=0, len=1, offset=0;
+	int op=0,delay=0;
+    
+	args = read_channel(args, & channel);
+	if (is_valid_channel_number(channel)) len=ledstring.channel[channel].count;
+	args = read_str(args, filename, sizeof(filename));
+	args = read_int(args, &start);
+	args = read_int(args, &len);
 	args = read_int(args, &offset);
+	value[0]=0;
 	args = read_str(args, value, sizeof(value));
 	if (strcmp(value, "OR")==0) op=1;
 	else if (strcmp(value, "AND")==0) op=2;
@@ -1783,121 +3227,236 @@ void readjpg(char * args){
 	if (len<=0) len =1;
     
     if (is_valid_channel_number(channel)){
-		FILE * infile;		/* source file */
-		int row_stride;		/* physical row width in output buffer */
-		
-		
+		image_cache_options_t options = {0, 0, 3}; //JPEG has no transparency
+		image_cache_entry_t * entry;
+		uint32_t * pixels=NULL;
+		int width=0, height=0;
+
 		if (debug) printf("readjpg %d,%s,%d,%d,%d,%d,%d\n", channel, filename, start, len, offset, op, delay);
-		
-		if ((infile = fopen(filename, "rb")) == NULL) {
-			fprintf(stderr, "Error: can't open %s\n", filename);
-			return;
+
+		entry = load_image(filename, &options, decode_jpg, &pixels, &width, &height);
+		if (pixels!=NULL){
+			image_to_leds(channel, pixels, width * height, start, len, offset, op, delay);
+			if (entry!=NULL) image_cache_release(&image_cache, entry);
+			else free(pixels);
 		}
+	}
+}
+#endif
 
-		// We set up the normal JPEG error routines, then override error_exit.
-		cinfo.err = jpeg_std_error(&jerr.pub);
-		jerr.pub.error_exit = my_error_exit;
-		// Establish the setjmp return context for my_error_exit to use.
-		if (setjmp(jerr.setjmp_buffer)) {
-			/* If we get here, the JPEG code has signaled an error.
-			 * We need to clean up the JPEG object, close the input file, and return.
-			 */
-			jpeg_destroy_decompress(&cinfo);
-			fclose(infile);
-			return;
+#ifdef USE_PNG
+//opens a PNG file and reads the header with readpng_init, returns NULL on error
+FILE * open_png(char * filename, ulg * width, ulg * height){
+	FILE * infile;		/* source file */
+	int rc;
+
+	if ((infile = fopen(filename, "rb")) == NULL) {
+		fprintf(stderr, "Error: can't open %s\n", filename);
+		return NULL;
+	}
+
+	if ((rc = readpng_init(infile, width, height)) != 0) {
+		switch (rc) {
+			case 1:
+				fprintf(stderr, "[%s] is not a PNG file: incorrect signature.\n", filename);
+				break;
+			case 2:
+				fprintf(stderr, "[%s] has bad IHDR (libpng longjmp).\n", filename);
+				break;
+			case 4:
+				fprintf(stderr, "Read PNG insufficient memory.\n");
+				break;
+			default:
+				fprintf(stderr, "Unknown readpng_init() error.\n");
+				break;
 		}
-		
-		// Now we can initialize the JPEG decompression object.
-		jpeg_create_decompress(&cinfo);
-		jpeg_stdio_src(&cinfo, infile);
+		fclose(infile);
+		return NULL;
+	}
+	return infile;
+}
 
-		jpeg_read_header(&cinfo, TRUE);
-		jpeg_start_decompress(&cinfo);
+//gets the background color (for transparency support) of a PNG file opened with open_png
+//returns 0 on success
+int get_png_background(const image_cache_options_t * options, uch * bg_red, uch * bg_green, uch * bg_blue){
+	*bg_red = *bg_green = *bg_blue = 0;
+	if (options->back_color_type==0){
+		if (readpng_get_bgcolor(bg_red, bg_green, bg_blue) > 1){
+			fprintf(stderr, "libpng error while checking for background color\n");
+			return -1;
+		}
+	}else{
+		*bg_red = get_red(options->back_color);
+		*bg_green = get_green(options->back_color);
+		*bg_blue = get_blue(options->back_color);
+	}
+	return 0;
+}
 
-		row_stride = cinfo.output_width * cinfo.output_components;
+//converts a row of RGB or RGBA pixels (readpng_get_image/readpng_read_row) to led colors
+void png_row_to_colors(const uch * src, uint32_t * dst, ulg width, int channels, const image_cache_options_t * options, uch bg_red, uch bg_green, uch bg_blue){
+	uch r, g, b, a=255;
+	ulg i;
+
+	for (i = width;  i > 0;  --i) {
+		r = *src++;
+		g = *src++;
+		b = *src++;
+
+		if (channels != 3){
+			a = *src++;
+			if (options->back_color_type!=2){
+				r = alpha_component(r, bg_red,a);
+				g = alpha_component(g, bg_green,a);
+				b = alpha_component(b, bg_blue,a);
+			}
+		}
+		if (options->back_color_type==2 && options->color_size>3){
+			*dst++ = color_rgbw(r,g,b,a);
+		}else{
+			*dst++ = color(r,g,b);
+		}
+	}
+}
 
-		JSAMPARRAY buffer;	// Output row buffer
-		int i=0,jpg_idx=0,led_idx; //pixel index for current row, jpeg image, led string
-		buffer = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE, row_stride, 1);
+uint32_t * decode_png(char * filename, const image_cache_options_t * options, int * width, int * height){
+	FILE * infile;		/* source file */
+	ulg image_width, image_height, image_rowbytes, row;
+	int image_channels,rc;
+	uch *image_data=NULL;
+	uch bg_red, bg_green, bg_blue;
+	uint32_t * pixels = NULL;
 
-		ws2811_led_t * leds = ledstring.channel[channel].leds;
-		
-		if (start>=ledstring.channel[channel].count) start=0;
-		if ((start+len)>ledstring.channel[channel].count) len=ledstring.channel[channel].count-start;
-		
-		led_idx=start; //start at this led index
-		
-		int eofstring=0;
-		while (eofstring==0 && cinfo.output_scanline < cinfo.output_height && end_current_command==0) {
-			jpeg_read_scanlines(&cinfo, buffer, 1);
-			for(i=0;i<cinfo.image_width;i++){
-				if (jpg_idx>=offset){ //check jpeg offset
-					unsigned char r,g,b;
-					r = buffer[0][i*cinfo.output_components];
-					g = buffer[0][i*cinfo.output_components+1];
-					b = buffer[0][i*cinfo.output_components+2];
-					if (cinfo.output_components==1){ //grayscale image
-						g = r;
-						b = r;
-					}
-					if (led_idx<start+len){
-						if (debug) printf("led %d= r %d,g %d,b %d, jpg idx=%d\n", led_idx, r, g, b,jpg_idx);
-						int fill_color = color(r,g,b);
-						switch (op){
-							case 0:
-								leds[led_idx].color=fill_color;
-								break;
-							case 1:
-								leds[i].color|=fill_color;
-								break;
-							case 2:
-								leds[i].color&=fill_color;
-								break;
-							case 3:
-								leds[i].color^=fill_color;
-								break;
-							case 4:
-								leds[i].color=~fill_color;
-								break;
-						}
-					}
-					led_idx++;
-					if ( led_idx== start + len){ 
-						if (delay!=0){//reset led index if we are at end of led string and delay
-							led_idx=start;
-							ws2811_render(&ledstring);
-							usleep(delay * 1000);
-						}else{
-							eofstring=1;
-							break;
-						}
+	if ((infile = open_png(filename, &image_width, &image_height)) == NULL) return NULL;
+
+	if (get_png_background(options, &bg_red, &bg_green, &bg_blue)!=0){
+		readpng_cleanup(TRUE);
+		fclose(infile);
+		return NULL;
+	}
+
+	//non interlaced images are read row by row into the led colors, only interlaced images need the whole RGB(A) data
+	rc = readpng_start_rows(2.2, &image_channels, &image_rowbytes);
+	if (rc==0) image_data = (uch *) malloc(image_rowbytes);
+	else if (rc==1) image_data = readpng_get_image(2.2, &image_channels, &image_rowbytes);
+
+	if (image_data) {
+		pixels = (uint32_t *) malloc(sizeof(uint32_t) * image_width * image_height);
+		if (pixels!=NULL){
+			//convert all pixels
+			for (row = 0;  row < image_height; row++) {
+				if (rc==0){
+					if (readpng_read_row(image_data)!=0){
+						fprintf(stderr, "Unable to decode PNG image\n");
+						free(pixels);
+						pixels=NULL;
+						break;
 					}
+					png_row_to_colors(image_data, pixels + row * image_width, image_width, image_channels, options, bg_red, bg_green, bg_blue);
+				}else{
+					png_row_to_colors(image_data + row * image_rowbytes, pixels + row * image_width, image_width, image_channels, options, bg_red, bg_green, bg_blue);
 				}
-				if (end_current_command) break; //signal to exit this command
-				jpg_idx++;
 			}
+			if (pixels!=NULL){
+				*width = image_width;
+				*height = image_height;
+			}
+		}else{
+			fprintf(stderr, "Out of memory for PNG image %s\n", filename);
 		}
+		if (rc==0) free(image_data);
+		readpng_cleanup(rc==1);
+	}else{
+		readpng_cleanup(FALSE);
+		fprintf(stderr, "Unable to decode PNG image\n");
+	}
+	fclose(infile);
+	return pixels;
+}
 
-		jpeg_finish_decompress(&cinfo);
-		jpeg_destroy_decompress(&cinfo);
+//reads a PNG file row by row and puts the pixels to the leds without decoding the whole image, memory
+//is needed for one row only. rows before the offset are not converted and reading stops when the
+//requested pixels are on the leds. interlaced images can't be read by row, they are decoded completely
+void stream_png(char * filename, const image_cache_options_t * options, image_feed_t * feed){
+	FILE * infile;
+	ulg image_width, image_height, image_rowbytes, row;
+	int image_channels, rc;
+	uch * row_data;
+	uch bg_red, bg_green, bg_blue;
+	uint32_t * colors;
+
+	if ((infile = open_png(filename, &image_width, &image_height)) == NULL) return;
+
+	if (get_png_background(options, &bg_red, &bg_green, &bg_blue)!=0){
+		readpng_cleanup(TRUE);
+		fclose(infile);
+		return;
+	}
+
+	rc = readpng_start_rows(2.2, &image_channels, &image_rowbytes);
+	if (rc==1){
+		int width, height;
+		uint32_t * pixels;
+
+		readpng_cleanup(FALSE);
 		fclose(infile);
+		pixels = decode_png(filename, options, &width, &height);
+		if (pixels!=NULL){
+			image_feed(feed, pixels, width * height);
+			free(pixels);
+		}
+		return;
+	}
+
+	row_data = rc==0 ? (uch *) malloc(image_rowbytes) : NULL;
+	colors = rc==0 ? (uint32_t *) malloc(sizeof(uint32_t) * image_width) : NULL;
+	if (row_data!=NULL && colors!=NULL){
+		for (row = 0;  row < image_height; row++) {
+			if (readpng_read_row(row_data)!=0){
+				fprintf(stderr, "Unable to decode PNG image\n");
+				break;
+			}
+			if (image_feed_skip(feed, image_width)) continue;
+			png_row_to_colors(row_data, colors, image_width, image_channels, options, bg_red, bg_green, bg_blue);
+			if (!image_feed(feed, colors, image_width)) break;
+		}
+	}else{
+		fprintf(stderr, rc==0 ? "Out of memory for PNG image %s\n" : "Unable to decode PNG image %s\n", filename);
 	}
+	free(row_data);
+	free(colors);
+	readpng_cleanup(FALSE);
+	fclose(infile);
+}
+
+//reads the size of a PNG file from the IHDR chunk, returns 0 on success
+int get_png_size(char * filename, unsigned int * width, unsigned int * height){
+	static const uch signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+	uch header[24];
+	FILE * infile = fopen(filename, "rb");
+	size_t n = 0;
+
+	if (infile!=NULL){
+		n = fread(header, 1, sizeof(header), infile);
+		fclose(infile);
+	}
+	if (n!=sizeof(header) || memcmp(header, signature, sizeof(signature))!=0 || memcmp(header + 12, "IHDR", 4)!=0) return -1;
+	*width = ((unsigned int) header[16] << 24) | (header[17] << 16) | (header[18] << 8) | header[19];
+	*height = ((unsigned int) header[20] << 24) | (header[21] << 16) | (header[22] << 8) | header[23];
+	return 0;
 }
-#endif
 
 //read PNG image and put pixel data to LEDS
-//readjpg <channel>,<FILE>,<BACKCOLOR>,<start>,<len>,<offset>,<OR AND XOR =>,<DELAY>
+//readpng <channel>,<FILE>,<BACKCOLOR>,<start>,<len>,<offset>,<OR AND XOR =>,<DELAY>
 //offset = where to start in PNG file
 //backcolor = color to use for transparent area, FF0000 = RED
 //P = use the PNG backcolor (default)
 //W = use the alpha data for the White leds in RGBW LED strips
 //DELAY = delay ms between 2 reads of LEN pixels, default=0 if 0 only <len> bytes at <offset> will be read
-#ifdef USE_PNG
+//the decoded image is kept in the image cache, reading it again only copies the pixels
+//images larger than the image cache are read row by row and only until the requested pixels are read
 void readpng(char * args){
-	struct jpeg_decompress_struct cinfo;
-	struct my_error_mgr jerr;
-	
-	char value[MAX_VAL_LEN];
+	char value[MAX_VAL_LEN]="";
 	int channel=0;
 	char filename[MAX_VAL_LEN];
 	unsigned int start=0, len=0, offset=0;
@@ -1921,6 +3480,7 @@ void readpng(char * args){
 	args = read_int(args, &start);
 	args = read_int(args, &len);
 	args = read_int(args, &offset);
+	value[0]=0;
 	args = read_str(args, value, sizeof(value));
 	if (strcmp(value, "OR")==0) op=1;
 	else if (strcmp(value, "AND")==0) op=2;
@@ -1929,147 +3489,120 @@ void readpng(char * args){
 	args = read_int(args, &delay);
 	
 	if (is_valid_channel_number(channel)){
-		FILE * infile;		/* source file */
-		ulg image_width, image_height, image_rowbytes;
-		int image_channels,rc;
-		uch *image_data;
-		uch bg_red=0, bg_green=0, bg_blue=0;
+		image_cache_options_t options = {backcolor, backcolortype, ledstring.channel[channel].color_size};
+		image_cache_entry_t * entry;
+		uint32_t * pixels=NULL;
+		int width=0, height=0;
+		unsigned int image_width, image_height;
+		image_feed_t feed;
 
-		if (start<0) start=0;
-        if (start+len> ledstring.channel[channel].count) len = ledstring.channel[channel].count-start;
-		
 		if (debug) printf("readpng %d,%s,%d,%d,%d,%d,%d,%d\n", channel, filename, backcolor, start, len,offset,op, delay);
-		
-		if ((infile = fopen(filename, "rb")) == NULL) {
-			fprintf(stderr, "Error: can't open %s\n", filename);
-			return;
-		}
-		
-		if ((rc = readpng_init(infile, &image_width, &image_height)) != 0) {
-            switch (rc) {
-                case 1:
-                    fprintf(stderr, "[%s] is not a PNG file: incorrect signature.\n", filename);
-                    break;
-                case 2:
-                    fprintf(stderr, "[%s] has bad IHDR (libpng longjmp).\n", filename);
-                    break;
-                case 4:
-                    fprintf(stderr, "Read PNG insufficient memory.\n");
-                    break;
-                default:
-                    fprintf(stderr, "Unknown readpng_init() error.\n");
-                    break;
-            }
-            fclose(infile);
+
+		if (!image_feed_init(&feed, channel, start, len, offset, op, delay)) return;
+
+		//images too large for the cache are not decoded completely, they are read row by row
+		if (get_png_size(filename, &image_width, &image_height)==0 &&
+		    (size_t) image_width * image_height * sizeof(uint32_t) > image_cache.budget){
+			if (debug) printf("Streaming %s\n", filename);
+			stream_png(filename, &options, &feed);
 			return;
-        }
-		
-		//get the background color (for transparency support)
-		if (backcolortype==0){
-			if (readpng_get_bgcolor(&bg_red, &bg_green, &bg_blue) > 1){
-				readpng_cleanup(TRUE);
-				fclose(infile);
-				fprintf(stderr, "libpng error while checking for background color\n");
-				return;
-			}
-		}else{
-			bg_red = get_red(backcolor);
-			bg_green = get_green(backcolor);
-			bg_blue = get_blue(backcolor);
 		}
-		
-		//read entire image data
-		image_data = readpng_get_image(2.2, &image_channels, &image_rowbytes);
-		
-		if (image_data) {
-			int row=0, led_idx=0, png_idx=0, i=0;
-			uch r, g, b, a;
-			uch *src;
-			
-			ws2811_led_t * leds = ledstring.channel[channel].leds;
-		
-			if (start>=ledstring.channel[channel].count) start=0;
-			if ((start+len)>ledstring.channel[channel].count) len=ledstring.channel[channel].count-start;
-			
-			led_idx=start; //start at this led index
-			//load all pixels
-			for (row = 0;  row < image_height; row++) {
-				src = image_data + row * image_rowbytes;
-				
-				for (i = image_width;  i > 0;  --i) {
-					r = *src++;
-					g = *src++;
-					b = *src++;
-					
-					if (image_channels != 3){
-						a = *src++;
-						if (backcolortype!=2){
-							r = alpha_component(r, bg_red,a);
-							g = alpha_component(g, bg_green,a);
-							b = alpha_component(b, bg_blue,a);
-						}
-					}					
-					if (png_idx>=offset){
-						if (debug) printf("led %d= r %d,g %d,b %d,a %d, PNG channels=%d, PNG idx=%d\n", led_idx, r, g, b, a,image_channels,png_idx);
-						if (led_idx < start + len){
-							int fill_color;
-							if (backcolortype==2 && ledstring.channel[channel].color_size>3){
-								fill_color=color_rgbw(r,g,b,a);
-							}else{
-								fill_color=color(r,g,b);
-							}
-		
-							switch (op){
-								case 0:
-									leds[led_idx].color=fill_color;
-									break;
-								case 1:
-									leds[i].color|=fill_color;
-									break;
-								case 2:
-									leds[i].color&=fill_color;
-									break;
-								case 3:
-									leds[i].color^=fill_color;
-									break;
-								case 4:
-									leds[i].color=~fill_color;
-									break;
-							}
-							
-						}
-						led_idx++;
-						if ( led_idx==start + len){ 
-							if (delay!=0){//reset led index if we are at end of led string and delay
-								led_idx=start;
-								ws2811_render(&ledstring);
-								usleep(delay * 1000);
-							}else{
-								row = image_height; //exit reading
-								i=0;
-								break;
-							}
-						}
-					}
-					png_idx++;
-					if (end_current_command) break; //signal to exit this command
-				}
-				if (end_current_command) break;
-			}
-			readpng_cleanup(TRUE);
-		}else{
-			readpng_cleanup(FALSE);
-			fprintf(stderr, "Unable to decode PNG image\n");
+
+		entry = load_image(filename, &options, decode_png, &pixels, &width, &height);
+		if (pixels!=NULL){
+			image_feed(&feed, pixels, width * height);
+			if (entry!=NULL) image_cache_release(&image_cache, entry);
+			else free(pixels);
 		}
-		fclose(infile);
     }
 }
 #endif
 
+//reads a JPEG or PNG image scaled to the matrix
+//readimage <channel>,<FILE>,<mode>,<BACKCOLOR>
+//mode = 0 fit: whole image visible, the borders get the back color (default)
+//       1 fill: matrix covered, the image is cropped
+//       2 stretch: image scaled to the matrix without keeping the aspect ratio
+//       3 crop: no scaling, the center of the image is shown
+//backcolor = color for transparent pixels and borders, P = use the PNG backcolor (default), W = use alpha for the white leds
+//large JPEG images are decoded at a reduced size (DCT scaling) and all images are scaled with area averaging
+void readimage(char * args){
+	char value[MAX_VAL_LEN]="";
+	char filename[MAX_VAL_LEN]="";
+	int channel=0, resample_mode=RESAMPLE_FIT;
+	unsigned int backcolor=0;
+	int backcolortype=0; //see readpng
+	image_decoder_t decoder=NULL;
+
+	args = read_channel(args, & channel);
+	args = read_str(args, filename, sizeof(filename));
+	args = read_int(args, & resample_mode);
+	args = read_str(args, value, sizeof(value));
+
+	if (!is_valid_channel_number(channel)){
+		fprintf(stderr,ERROR_INVALID_CHANNEL);
+		return;
+	}
+	if (strlen(value)>=6){
+		read_color(value, & backcolor, ledstring.channel[channel].color_size);
+		backcolortype=1;
+	}else if (strcmp(value, "W")==0){
+		backcolortype=2;
+	}
+
+	size_t len = strlen(filename);
+	#ifdef USE_JPEG
+	if ((len>4 && strcasecmp(filename + len - 4, ".jpg")==0) || (len>5 && strcasecmp(filename + len - 5, ".jpeg")==0)) decoder = decode_jpg;
+	#endif
+	#ifdef USE_PNG
+	if (len>4 && strcasecmp(filename + len - 4, ".png")==0) decoder = decode_png;
+	#endif
+	if (decoder==NULL){
+		fprintf(stderr, "Unsupported image type %s\n", filename);
+		return;
+	}
+
+	if (debug) printf("readimage %d,%s,%d,%d\n", channel, filename, resample_mode, backcolor);
+
+	canvas_t canvas;
+	get_canvas(channel, &canvas);
+
+	image_cache_options_t options = {backcolor, backcolortype, ledstring.channel[channel].color_size, 0, 0};
+	if (resample_mode!=RESAMPLE_CROP){ //no need to decode more pixels than the matrix has
+		options.min_width = canvas.width;
+		options.min_height = canvas.height;
+	}
+
+	image_cache_entry_t * entry;
+	uint32_t * pixels=NULL;
+	int width=0, height=0;
+	entry = load_image(filename, &options, decoder, &pixels, &width, &height);
+	if (pixels==NULL) return;
+
+	resample_rect_t src, dst;
+	resample_layout(resample_mode, width, height, canvas.width, canvas.height, &src, &dst);
+
+	uint32_t * scaled = (uint32_t *) malloc(sizeof(uint32_t) * dst.width * dst.height);
+	if (scaled!=NULL && resample_area(&pixels[src.y * width + src.x], src.width, src.height, width, scaled, dst.width, dst.height)==0){
+		//borders around the image
+		canvas_fill_rect(&canvas, 0, 0, canvas.width, dst.y, backcolor);
+		canvas_fill_rect(&canvas, 0, dst.y + dst.height, canvas.width, canvas.height - dst.y - dst.height, backcolor);
+		canvas_fill_rect(&canvas, 0, dst.y, dst.x, dst.height, backcolor);
+		canvas_fill_rect(&canvas, dst.x + dst.width, dst.y, canvas.width - dst.x - dst.width, dst.height, backcolor);
+		canvas_blit_colors(&canvas, dst.x, dst.y, scaled, dst.width, dst.height, dst.width);
+	}else{
+		fprintf(stderr, "Out of memory while scaling %s\n", filename);
+	}
+	free(scaled);
+
+	if (entry!=NULL) image_cache_release(&image_cache, entry);
+	else free(pixels);
+}
+
 //sets join type for next socket connect if thread is active
 // set_thread_exit_type_type <thread_index>,<join_type>
 //<thread_index> = 0
-//<join_type> 0 -> Cancel, 1 -> wait
+//<join_type> 0 -> Cancel, 1 -> wait, 2 -> keep running while the next client sends commands (e.g. marquee_text)
 void set_thread_exit_type(char * args){
 	
 	int thread_index = 0;
@@ -2078,7 +3611,7 @@ void set_thread_exit_type(char * args){
 	args = read_int(args, & thread_index);
 	args = read_int(args, & join_type);
 	
-	if (join_type==JOIN_THREAD_CANCEL || join_type==JOIN_THREAD_WAIT){
+	if (join_type==JOIN_THREAD_CANCEL || join_type==JOIN_THREAD_WAIT || join_type==JOIN_THREAD_KEEP){
 		
 		join_thread_type=join_type;
 	}else{
@@ -2087,6 +3620,139 @@ void set_thread_exit_type(char * args){
 	
 }
 
+void start_thread_func();
+void join_thread(int cancel);
+
+//starts a script of the script library in the thread, a running script or thread is stopped first
+//run <name>
+//from a script the thread continues with the other script
+void run_script(char * args){
+	char name[MAX_VAL_LEN]="";
+	int len;
+
+	args = read_str(args, name, sizeof(name));
+
+	if (debug) printf("run %s\n", name);
+
+	if (!thread_context) join_thread(1);
+	len = script_get_code(&scripts, name, &thread_data, &thread_data_size);
+	if (len<0){
+		if (len==-2) fprintf(stderr, "Out of memory\n");
+		else fprintf(stderr, "Script %s not found\n", name);
+		if (thread_context) thread_running=0;
+		return;
+	}
+
+	strcpy(running_script, name);
+	running_version = script_version(&scripts, name);
+	thread_write_index=len;
+	if (thread_context){
+		loop_index=0;
+		thread_read_index=-1; //thread_func continues at 0
+	}else{
+		write_to_thread_buffer=0;
+		start_thread=0;
+		thread_read_index=0;
+		if (len>0) start_thread_func();
+	}
+}
+
+//stops the running script (or the thread started with thread_start)
+//stop <name>
+//without name any script is stopped
+void stop_script(char * args){
+	char name[MAX_VAL_LEN]="";
+
+	if (args!=NULL) args = read_str(args, name, sizeof(name));
+
+	if (debug) printf("stop %s\n", name);
+
+	if (name[0]!=0 && strcmp(name, running_script)!=0){
+		fprintf(stderr, "Script %s is not running\n", name);
+	}else if (thread_context){
+		thread_running=0; //the thread ends after this command
+	}else{
+		join_thread(1);
+	}
+}
+
+//lists the scripts that can be started with run
+//list
+void list_scripts(char * args){
+	script_t * script;
+
+	pthread_mutex_lock(&scripts.mutex);
+	if (scripts.directory==NULL) printf("No script_dir set\n");
+	for (script=scripts.first; script!=NULL; script=script->next){
+		int running = thread_running && strcmp(script->name, running_script)==0;
+		printf("%s %zu bytes%s\n", script->name, script->length, running ? " (running)" : "");
+	}
+	pthread_mutex_unlock(&scripts.mutex);
+}
+
+//sets the script directory and compiles all scripts in it
+//script_dir <directory>
+void set_script_dir(char * args){
+	char directory[MAX_VAL_LEN]="";
+	args = read_str(args, directory, sizeof(directory));
+	if (debug) printf("script_dir %s\n", directory);
+	config_watch_scripts(&config_watch, directory);
+	switch (script_library_load(&scripts, directory)){
+		case -1:
+			fprintf(stderr, "Error: can't read %s\n", directory);
+			break;
+		case -2:
+			fprintf(stderr, "Out of memory\n");
+			break;
+	}
+}
+
+//exports the metrics on address: a TCP port (HTTP) or the path of a Unix socket, "" or "0" stops exporting
+void start_metrics(const char * address){
+	metrics_server_stop(&metrics_server);
+	if (address[0]==0 || strcmp(address, "0")==0) return;
+	if (metrics_server_start(&metrics_server, &metrics, address)!=0) fprintf(stderr, "Error: can't export metrics on %s\n", address);
+	else printf("Metrics on %s.\n", address);
+}
+
+//exports the performance metrics in the Prometheus text format
+//metrics <port or socket>
+//port = TCP port for HTTP (e.g. 9100), socket = path of a Unix socket, 0 = stop exporting
+void set_metrics(char * args){
+	char address[MAX_VAL_LEN]="";
+	if (args!=NULL) args = read_str(args, address, sizeof(address));
+	if (debug) printf("metrics %s\n", address);
+	start_metrics(address);
+}
+
+//starts or stops recording the timeline of commands and frames
+//trace <enable>,<file>
+//enable = 1 starts recording (the events recorded before are removed), 0 stops
+//file = file that is written on SIGUSR1 (default /tmp/ws2812svr_trace.json)
+void set_trace(char * args){
+	int enable=1;
+	char filename[MAX_VAL_LEN]="";
+	if (args!=NULL){
+		args = read_int(args, &enable);
+		args = read_str(args, filename, sizeof(filename));
+	}
+	if (debug) printf("trace %d,%s\n", enable, filename);
+	if (trace_set(enable, filename)!=0) fprintf(stderr, "Tracing is not compiled in\n");
+}
+
+//writes the recorded events in the Chrome trace JSON format (chrome://tracing or ui.perfetto.dev)
+//trace_dump <file>
+//file = JSON file, default the file of the trace command
+void write_trace(char * args){
+	char filename[MAX_VAL_LEN]="";
+	int count;
+	if (args!=NULL) args = read_str(args, filename, sizeof(filename));
+	if (debug) printf("trace_dump %s\n", filename);
+	count = trace_dump(filename);
+	if (count<0) fprintf(stderr, "Error: can't write the trace file\n");
+	else printf("Trace with %d events written.\n", count);
+}
+
 //initializes the memory for a TCP/IP multithread buffer
 void init_thread(char * data){
     if (thread_data==NULL){
@@ -2120,20 +3786,89 @@ void write_thread_buffer (char c){
 }
 
 //this function can be run in other thread for TCP/IP to enable do ... loops  (useful for websites)
+//the thread has its own command line, commands from the client or file can be executed next to it
 void thread_func (void * param){
+    char * line = (char *) malloc(command_line_size+1);
+    int line_index=0;
+
+    thread_context=1;
     thread_read_index=0;
     if (debug) printf("Enter thread %d,%d,%d.\n", thread_running,thread_read_index,thread_write_index);
-    while (thread_running){
+    while (thread_running && line!=NULL && thread_read_index<thread_write_index){
         char c = thread_data[thread_read_index];
-        process_character(c);
+        add_command_character(c, line, &line_index, command_line_size);
         thread_read_index++;
-        if (thread_read_index>=thread_write_index) break; //exit loop if we are at the end of the file
     }
+    free(line);
     thread_running=0;
     if (debug) printf("Exit thread.\n");
     pthread_exit(NULL); //exit the tread
 }
 
+//starts executing the thread buffer in a new thread
+void start_thread_func(){
+    thread_active=1;
+    thread_running=1; //thread will run until thread_running becomes 0 (this is after a new client has connected)
+    int s = pthread_create(& thread, NULL, (void* (*)(void*)) & thread_func, NULL);
+    if (s!=0){
+        thread_active=0;
+        thread_running=0;
+        fprintf(stderr,"Error creating new thread: %d", s);
+        perror(NULL);
+    }
+}
+
+//waits ms milliseconds (delay command), the end is computed once so the time does not drift with the steps
+//sleeps in steps of at most 10 ms: a stopped script doesn't wait for the end of the delay
+void delay_ms(int ms){
+    struct timespec end, step, now;
+    long long left;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_sec += ms / 1000;
+    end.tv_nsec += (ms % 1000) * 1000000L;
+    if (end.tv_nsec >= 1000000000L){
+        end.tv_sec++;
+        end.tv_nsec -= 1000000000L;
+    }
+    while (!end_current_command){
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left = (end.tv_sec - now.tv_sec) * 1000000000LL + (end.tv_nsec - now.tv_nsec);
+        if (left<=0) break;
+        step = end;
+        if (left>10000000LL){
+            step = now;
+            step.tv_nsec += 10000000L;
+            if (step.tv_nsec >= 1000000000L){
+                step.tv_sec++;
+                step.tv_nsec -= 1000000000L;
+            }
+        }
+        int depth = release_commands();
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &step, NULL);
+        relock_commands(depth);
+    }
+}
+
+//waits until the thread has finished, cancel=1 ends the thread at the current command
+void join_thread(int cancel){
+    if (!thread_active) return;
+    if (cancel){
+        end_current_command=1; //end current command
+        thread_running=0; //exit the thread
+    }
+    int depth = release_commands(); //the thread needs the lock to end its command
+    int res = pthread_join(thread,NULL); //wait for thread to finish, clean up and exit
+    relock_commands(depth);
+    if (res!=0){
+        fprintf(stderr,"Error join thread: %d ", res);
+        perror(NULL);
+    }
+    end_current_command=0;
+    thread_active=0;
+    running_script[0]=0;
+}
+
 void str_replace(char * dst, char * src, char * find, char * replace){
 	char *p;
 	size_t replace_len = strlen(replace);
@@ -2154,9 +3889,12 @@ void str_replace(char * dst, char * src, char * find, char * replace){
 
 //executes 1 command line
 void execute_command(char * command_line){
+    uint64_t start = metrics_now(), parsed;
+    char name[METRICS_MAX_NAME]; //commands like setup can replace the command line
     
     if (command_line[0]=='#') return; //=comments
     
+    lock_commands();
     if (write_to_thread_buffer){
         if (strncmp(command_line, "thread_stop", 11)==0){
             if (mode==MODE_TCP){
@@ -2197,23 +3935,58 @@ void execute_command(char * command_line){
 			}
 		}
         
+        parsed = metrics_now();
+        snprintf(name, sizeof(name), "%s", command);
+        TRACE_BEGIN(name);
+        //commands that access the leds by their absolute position first move the pixels of a scrolled viewport (see rotate)
+        //to their place, the other commands keep the viewport as it is
         if (strcmp(command, "render")==0){
             render(arg);
         }else if (strcmp(command, "rotate")==0){
             rotate(arg);
         }else if (strcmp(command, "delay")==0){
-            if (arg!=NULL)	usleep((atoi(arg)+1)*1000);
+            if (arg!=NULL) delay_ms(atoi(arg));
         }else if (strcmp(command, "brightness")==0){
+            materialize_viewports();
             brightness(arg);
+        }else if (strcmp(command, "transition")==0){
+            materialize_viewports();
+            transition(arg);
+        }else if (strcmp(command, "hue_shift")==0){
+            materialize_viewports();
+            hue_shift(arg);
+        }else if (strcmp(command, "saturate")==0){
+            materialize_viewports();
+            saturate(arg);
+        }else if (strcmp(command, "fill_hsv")==0){
+            materialize_viewports();
+            fill_hsv(arg);
+        }else if (strcmp(command, "fill_hsl")==0){
+            materialize_viewports();
+            fill_hsl(arg);
         }else if (strcmp(command, "rainbow")==0){
             rainbow(arg);
+        }else if (strcmp(command, "fill_rect")==0){
+            fill_rect(arg);
+        }else if (strcmp(command, "draw")==0){
+            draw(arg);
+        }else if (strcmp(command, "scroll")==0){
+            scroll(arg);
+        }else if (strcmp(command, "mirror")==0){
+            mirror(arg);
+        }else if (strcmp(command, "rotate90")==0){
+            rotate90(arg);
         }else if (strcmp(command, "fill")==0){	
+            materialize_viewports();
             fill(arg);
         }else if (strcmp(command, "fade")==0){
+            materialize_viewports();
             fade(arg);
         }else if (strcmp(command, "gradient")==0){
+            materialize_viewports();
             gradient(arg);
         }else if (strcmp(command, "random")==0){
+            materialize_viewports();
             add_random(arg);
         }else if (strcmp(command, "do")==0){
             start_loop(arg);
@@ -2222,35 +3995,74 @@ void execute_command(char * command_line){
         }else if (strcmp(command, "thread_start")==0){ //start a new thread that processes code
             if (thread_active==0 && mode==MODE_TCP) init_thread(arg);
         }else if (strcmp(command, "init")==0){ //first init ammount of channels wanted
+            materialize_viewports();
             init_channels(arg);
         }else if (strcmp(command, "setup")==0){ //setup the channels
+            materialize_viewports();
             setup_ledstring(arg);
+        }else if (strcmp(command, "layout")==0){ //wiring of the matrix
+            materialize_viewports();
+            layout(arg);
         }else if (strcmp(command, "settings")==0){
             print_settings();
         }else if (strcmp(command, "global_brightness")==0){
             global_brightness(arg);
+        }else if (strcmp(command, "gamma")==0){
+            gamma_correct(arg);
+        }else if (strcmp(command, "color_correct")==0){
+            color_correct(arg);
+        }else if (strcmp(command, "save_gamma")==0){
+            save_gamma(arg);
+        }else if (strcmp(command, "load_gamma")==0){
+            load_gamma(arg);
+        }else if (strcmp(command, "power_limit")==0){
+            power_limit(arg);
 		}else if (strcmp(command, "blink")==0){
+			materialize_viewports();
 			blink(arg);
 		}else if (strcmp(command, "random_fade_in_out")==0){
+			materialize_viewports();
 			random_fade_in_out(arg);
 		}else if (strcmp(command, "chaser")==0){
+			materialize_viewports();
 			chaser(arg);
 		}else if (strcmp(command, "color_change")==0){
+			materialize_viewports();
 			color_change(arg);
 		}else if (strcmp(command, "fly_in")==0){
+			materialize_viewports();
 			fly_in(arg);
 		}else if (strcmp(command, "fly_out")==0){
+			materialize_viewports();
 			fly_out(arg);
         }else if (strcmp(command, "marquee")==0){
             marquee(arg);
+        }else if (strcmp(command, "marquee_text")==0){
+            marquee_text(arg);
+        }else if (strcmp(command, "play")==0){
+            play(arg);
+        }else if (strcmp(command, "playraw")==0){
+            playraw(arg);
+        }else if (strcmp(command, "playbaked")==0){
+            playbaked(arg);
+        }else if (strcmp(command, "bake")==0){
+            materialize_viewports();
+            bake(arg);
 		#ifdef USE_JPEG
 		}else if (strcmp(command, "readjpg")==0){
+			materialize_viewports();
 			readjpg(arg);
 		#endif
 		#ifdef USE_PNG
 		}else if (strcmp(command, "readpng")==0){
+			materialize_viewports();
 			readpng(arg);
 		#endif
+        }else if (strcmp(command, "readimage")==0){
+            readimage(arg);
+        }else if (strcmp(command, "image_cache")==0){
+            materialize_viewports();
+            set_image_cache(arg);
         }else if (strcmp(command, "help")==0){
             printf("debug (enables some debug output)\n");
             printf("setup <channel>, <led_count>, <led_type>, <invert>, <global_brightness>, <gpionum>\n");
@@ -2267,35 +4079,99 @@ void execute_command(char * command_line){
             printf("     9  SK6812_STRIP_GBRW\n");
             printf("     10 SK6812_STRIP_BRGW\n");
             printf("     11 SK6812_STRIP_BGRW\n");
+            printf("layout <channel>,<serpentine>,<column_major>,<rotation>,<flip_x>,<flip_y>,<panel_width>,<panel_height>,<panel_serpentine>\n");
             printf("init <frequency>,<DMA> (initializes PWM output, call after all setup commands)\n");
             printf("render <channel>,<start>,<RRGGBBWWRRGGBBWW>\n");
             printf("rotate <channel>,<places>,<direction>,<new_color>,<new_brightness>\n");
-            printf("rainbow <channel>,<count>,<start_color>,<stop_color>,<start_column>,<len>\n");
-            printf("fill <channel>,<color>,<start>,<len>,<OR,AND,XOR,NOT,=>\n");
-            printf("brightness <channel>,<brightness>,<start>,<len> (brightness: 0-255)\n");
+            printf("rainbow <channel>,<count>,<start_color>,<stop_color>,<start_column>,<len>,<hsv>\n");
+            printf("fill <channel>,<color>,<start>,<len>,<OR,AND,XOR,NOT,ADD,=>\n");
+            printf("fill_rect <channel>,<color>,<x>,<y>,<width>,<height>,<brightness>\n");
+            printf("draw <channel>,<x>,<y>,<width>,<height>,<RRGGBBWWRRGGBBWW>\n");
+            printf("scroll <channel>,<dx>,<dy>,<new_color>,<new_brightness>\n");
+            printf("mirror <channel>,<vertical>,<x>,<y>,<width>,<height>\n");
+            printf("rotate90 <channel>,<turns>,<x>,<y>,<size>\n");
+            printf("brightness <channel>,<brightness>,<start>,<len>,<scale> (brightness: 0-255)\n");
             printf("fade <channel>,<start_brightness>,<end_brightness>,<delay ms>,<step>,<start_led>,<len>\n");
             printf("gradient <channel>,<RGBWL>,<start_level>,<end_level>,<start_led>,<len>\n");
-            printf("random <channel>,<start>,<len>,<RGBWL>\n");
-			printf("random_fade_in_out <channel>,<duration Sec>,<count>,<delay>,<step>,<sync_delay>,<inc_dec>,<brightness>,<start>,<len>,<color>");
+            printf("hue_shift <channel>,<degrees>,<start>,<len>\n");
+            printf("transition <channel>,<crossfade|wipe|slide|dissolve>,<duration_ms>,<fps> (plays at the next render)\n");
+            printf("saturate <channel>,<percent>,<start>,<len> (percent: 0 = gray, 100 = unchanged)\n");
+            printf("fill_hsv <channel>,<hue>,<saturation>,<value>,<start>,<len> (-1 keeps the led's own)\n");
+            printf("fill_hsl <channel>,<hue>,<saturation>,<lightness>,<start>,<len> (-1 keeps the led's own)\n");
+            printf("random <channel>,<start>,<len>,<RGBWL>,<seed>\n");
+			printf("random_fade_in_out <channel>,<duration Sec>,<count>,<delay>,<step>,<sync_delay>,<inc_dec>,<brightness>,<start>,<len>,<color>,<max brightness>,<seed>\n");
 			printf("chaser <channel>,<duration>,<color>,<count>,<direction>,<delay>,<start>,<len>,<brightness>,<loops>\n");
-			printf("color_change <channel>,<startcolor>,<stopcolor>,<duration>,<start>,<len>\n");
+			printf("color_change <channel>,<startcolor>,<stopcolor>,<duration>,<start>,<len>,<hsv>\n");
 			printf("fly_in <channel>,<direction>,<delay>,<brightness>,<start>,<len>,<start_brightness>,<color>\n");
 			printf("fly_out <channel>,<direction>,<delay>,<brightness>,<start>,<len>,<end_brightness>,<color>\n");
-			printf("save_state <channel>,<file_name>,<start>,<len>\n");
+			printf("marquee <channel>,<text>,<delay>,<loops>,<inout>\n");
+			printf("marquee_text <channel>,<text>,<mode>\n");
+			printf("play <channel>,<file>,<loops>,<mode>,<first_frame>,<last_frame>,<delay>\n");
+			printf("playraw <channel>,<file>,<fps>,<loops>\n");
+			printf("bake <channel>,<source>,<file>,<fps>\n");
+			printf("playbaked <file>,<loops>,<fps>\n");
+			printf("save_state <channel>,<file_name>,<start>,<len>,<binary|csv>\n");
 			printf("load_state <channel>,<file_name>,<start>,<len>\n");
+			printf("snapshot <name>,<persist>\n");
+			printf("recall <name>\n");
+			printf("snapshot_delete <name>\n");
+			printf("snapshot_cache <size> (KB of snapshots kept in memory)\n");
+			printf("snapshot_dir <directory> (where persistent snapshots are saved)\n");
+			printf("run <name> (starts script <name>.txt of the script_dir)\n");
+			printf("stop <name>\n");
+			printf("list (scripts of the script_dir)\n");
+			printf("script_dir <directory>\n");
+			printf("metrics <port or socket> (exports performance metrics for Prometheus, 0 = stop)\n");
+			printf("trace <enable>,<file> (records a timeline of commands and frames, written to <file> on SIGUSR1)\n");
+			printf("trace_dump <file>\n");
+			printf("gamma <channel>,<exponent>\n");
+			printf("color_correct <channel>,<r>,<g>,<b>,<temperature>\n");
+			printf("save_gamma <channel>,<file_name>\n");
+			printf("load_gamma <channel>,<file_name>\n");
+			printf("power_limit <channel>,<max_current mA>,<led_current mA>\n");
 			#ifdef USE_JPEG
 			printf("readjpg <channel>,<file>,<LED start>,<len>,<JPEG Pixel offset>,<OR,AND,XOR,NOT,=>\n");
 			#endif
 			#ifdef USE_PNG
 			printf("readpng <channel>,<file>,<BACKCOLOR>,<LED start>,<len>,<PNG Pixel offset>,<OR,AND,XOR,NOT,=>\n     BACKCOLOR=XXXXXX for color, PNG=USE PNG Back color (default), W=Use alpha for white leds in RGBW strips.\n");
 			#endif
+            printf("readimage <channel>,<file>,<mode>,<BACKCOLOR>\n     mode 0=fit, 1=fill, 2=stretch, 3=crop\n");
+            printf("image_cache <size> (KB of decoded images kept in memory, 0 = disabled)\n");
             printf("settings\n");
             printf("do ... loop (TCP / File mode only)\n");
 			printf("Inside a finite loop {x} will be replaced by the current loop index number. x stands for the loop number in case of multiple nested loops (default use 0).");
             printf("exit\n");
         }else if (strcmp(command, "save_state")==0){
+			materialize_viewports();
 			save_state(arg);
+		}else if (strcmp(command, "snapshot")==0){
+			materialize_viewports();
+			snapshot(arg);
+		}else if (strcmp(command, "recall")==0){
+			materialize_viewports();
+			recall(arg);
+		}else if (strcmp(command, "snapshot_delete")==0){
+			delete_snapshot(arg);
+		}else if (strcmp(command, "snapshot_cache")==0){
+			set_snapshot_cache(arg);
+		}else if (strcmp(command, "snapshot_dir")==0){
+			set_snapshot_dir(arg);
+		}else if (strcmp(command, "run")==0){
+			run_script(arg);
+		}else if (strcmp(command, "stop")==0){
+			stop_script(arg);
+		}else if (strcmp(command, "list")==0){
+			list_scripts(arg);
+		}else if (strcmp(command, "script_dir")==0){
+			set_script_dir(arg);
+		}else if (strcmp(command, "metrics")==0){
+			set_metrics(arg);
+		}else if (strcmp(command, "trace")==0){
+			set_trace(arg);
+		}else if (strcmp(command, "trace_dump")==0){
+			write_trace(arg);
 		}else if (strcmp(command, "load_state")==0){
+			materialize_viewports();
 			load_state(arg);
 		}else if (strcmp(command, "set_thread_exit_type")==0){
 			set_thread_exit_type(arg);
@@ -2307,24 +4183,79 @@ void execute_command(char * command_line){
             exit_program=1;
         }else{
             printf("Unknown cmd: %s\n", command_line);
+            name[0] = 0;
         }
+		metrics_command(&metrics, name[0]!=0 ? name : NULL, parsed - start, metrics_now() - parsed); //empty name = unknown command
+		TRACE_END();
 		if (arg!=NULL) free(arg);
     }
+    unlock_commands();
 }
 
-void process_character(char c){
+//adds a character to a command line of size bytes, the line is executed at the end of the command
+void add_command_character(char c, char * line, int * index, int size){
     if (c=='\n' || c == '\r' || c == ';'){
-        if (command_index>0){
-            command_line[command_index]=0; //terminate with 0
-            execute_command(command_line);
-            command_index=0;
+        if (*index>0){
+            line[*index]=0; //terminate with 0
+            execute_command(line);
+            *index=0;
         }
     }else{
-        if (!(command_index==0 && c==' ')){
-            command_line[command_index]=(char)c;
-            command_index++;
-            if (command_index==command_line_size) command_index=0;
+        if (!(*index==0 && c==' ')){
+            line[*index]=(char)c;
+            (*index)++;
+            if (*index==size) *index=0;
+        }
+    }
+}
+
+void process_character(char c){
+    add_command_character(c, command_line, &command_index, command_line_size);
+}
+
+//waits until fd can be read, changes of the configuration file are applied meanwhile
+//timeout in ms, -1 = no timeout, returns 0 after the timeout
+int wait_for_input(int fd, int timeout){
+    while (config_watch.fd>=0 && !exit_program){
+        struct pollfd fds[2] = {{fd, POLLIN, 0}, {config_watch.fd, POLLIN, 0}};
+        int ready = poll(fds, 2, timeout);
+        if (ready<0){
+            if (errno==EINTR) continue;
+            break; //the read reports the error
         }
+        if (ready==0) return 0;
+        if (fds[1].revents & POLLIN) check_config_changes();
+        if (fds[0].revents) break;
+    }
+    return 1;
+}
+
+//reads the next character of the named pipe or stdin, EOF at the end or on a read error
+//the input is buffered here instead of by stdio: poll only sees what stdio hasn't read yet
+int read_input(){
+    if (input_position>=input_length){
+        if (input_file==NULL) return EOF;
+        wait_for_input(fileno(input_file), -1);
+        input_length = read(fileno(input_file), input_buffer, sizeof(input_buffer));
+        input_position = 0;
+        if (input_length<=0){
+            input_length = 0;
+            return EOF;
+        }
+    }
+    return (unsigned char) input_buffer[input_position++];
+}
+
+//waits until a client connects, changes of the configuration file are applied meanwhile
+void wait_for_client(){
+    while (config_watch.fd>=0 && !exit_program){
+        struct pollfd fds[2] = {{sockfd, POLLIN, 0}, {config_watch.fd, POLLIN, 0}};
+        if (poll(fds, 2, -1)<0){
+            if (errno==EINTR) continue;
+            break;
+        }
+        if (fds[1].revents & POLLIN) check_config_changes(); //can change sockfd
+        else if (fds[0].revents) break;
     }
 }
 
@@ -2340,51 +4271,39 @@ void tcp_wait_connection (){
 	
     if (start_thread){
         if (debug) printf("Running thread.\n");
-		thread_active=1;
-        thread_running=1; //thread will run until thread_running becomes 0 (this is after a new client has connected)
-        int s = pthread_create(& thread, NULL, (void* (*)(void*)) & thread_func, NULL);
-		if (s!=0){
-			fprintf(stderr,"Error creating new thread: %d", s);
-			perror(NULL);
-		}
+        start_thread_func();
     }    
     
     printf("Waiting for client to connect.\n");
     
     clilen = sizeof(cli_addr);
+    TRACE_BEGIN("wait_client");
+    wait_for_client();
     active_socket = accept(sockfd, (struct sockaddr *) &cli_addr, &clilen);
+    TRACE_END();
     if (active_socket!=-1){
+		TRACE_INSTANT("accept");
+		metrics_add(&metrics.client_connects, 1);
 		//if (setsockopt(active_socket, SOL_SOCKET, SO_KEEPALIVE, &sock_opt, optlen)) printf("Error set SO_KEEPALIVE\n");
 		struct timeval tv;
         tv.tv_sec = 0; //we want a fast timeout
-        tv.tv_usec = 500000;
+        tv.tv_usec = CLIENT_TIMEOUT * 1000;
         if (setsockopt(active_socket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv)) printf("Error set SO_RCVTIMEO\n");
+		//with JOIN_THREAD_KEEP a running thread continues and this client's commands are executed next to it
+		int keep_thread = thread_active && thread_running && join_thread_type==JOIN_THREAD_KEEP;
 		//if there is a thread active we exit it 
-		if (thread_active){
-			switch (join_thread_type){
-				case JOIN_THREAD_WAIT:
-		
-					break;
-				default: //default is cancel
-					end_current_command=1; //end current command
-					thread_running=0; //exit the thread
-					break;
-			}
-			int res = pthread_join(thread,NULL); //wait for thread to finish, clean up and exit
-			if (res!=0){
-				fprintf(stderr,"Error join thread: %d ", res);
-				perror(NULL);
-			}		
-			end_current_command=0;
-			thread_active=0;
+		if (thread_active && !keep_thread){
+			join_thread(join_thread_type!=JOIN_THREAD_WAIT); //default is cancel
 		}
 		
 		write(active_socket, "HTTP/1.1 200 OK\r\nContent-Length: 7\r\nConnection: close\r\n\r\nREADY\r\n", 64);
 		
-		write_to_thread_buffer=0;
-		thread_write_index=0;
-		thread_read_index=0;
-		start_thread=0;
+		if (!keep_thread){
+			write_to_thread_buffer=0;
+			thread_write_index=0;
+			thread_read_index=0;
+			start_thread=0;
+		}
 		 
 		printf("Client connected.\n");
 	}else{
@@ -2393,12 +4312,12 @@ void tcp_wait_connection (){
 }
 
 //sets up sockets
-void start_tcpip(int port){
-	
-     sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-     if (sockfd < 0) {
+//opens a socket that listens on port, returns -1 on error
+int open_socket(int port){
+     int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+     if (fd < 0) {
         fprintf(stderr,"ERROR opening socket\n");
-        exit(1);
+        return -1;
      }
 
      bzero((char *) &serv_addr, sizeof(serv_addr));
@@ -2406,90 +4325,334 @@ void start_tcpip(int port){
      serv_addr.sin_family = AF_INET;
      serv_addr.sin_addr.s_addr = INADDR_ANY;
      serv_addr.sin_port = htons(port);
-     if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
+     if (bind(fd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
         fprintf(stderr,"ERROR on binding.\n");
-        exit(1);
+        close(fd);
+        return -1;
      }
+     listen(fd,5);
+     return fd;
+}
+
+void start_tcpip(int port){
+	
+     sockfd = open_socket(port);
+     if (sockfd < 0) exit(1);
 	 
 	 printf("Listening on %d.\n", port);
-     listen(sockfd,5);
      tcp_wait_connection();
 }
 
-void load_config_file(char * filename){
+void free_config(config_t * cfg){
+	free(cfg->file);
+	free(cfg->pipe);
+	free(cfg->init);
+	free(cfg->snapshot_dir);
+	free(cfg->script_dir);
+	free(cfg->metrics);
+	free(cfg->trace);
+}
+
+//1 if both strings are NULL or equal
+int same_str(const char * a, const char * b){
+	if (a==NULL || b==NULL) return a==b;
+	return strcmp(a, b)==0;
+}
+
+//reads the settings of a configuration file, returns 0 on success, -1 if the file can't be opened
+int read_config_file(char * filename, config_t * cfg_values){
 	FILE * file = fopen(filename, "r");
 	
 	if (debug) printf("Reading config file %s\n", filename);
-	if (!file) {
-		fprintf(stderr, "Error opening config file %s\nExiting.", filename);
-		exit(10);
-	}
+	if (!file) return -1;
+	
+	memset(cfg_values, 0, sizeof(config_t));
+	cfg_values->mode=-1;
+	cfg_values->port=-1;
+	cfg_values->image_cache=-1;
+	cfg_values->snapshot_cache=-1;
+	cfg_values->debug=-1;
 	
 	char line[1024];
     while (fgets(line, sizeof(line), file) != NULL) {
 		char * val = strchr(line, '=');
 		char * cfg =  strtok(line, " =\t\r\n");
 		
+		if (cfg==NULL) continue; //empty line
 		if (val!=NULL) val++;
 		if (debug) printf("Reading Config line %s, cfg=%s, val=%s\n", line, cfg, val);
 		
 		if (val!=NULL) val = strtok(val, "\r\n");
 		while (val!=NULL && val[0]!=0 && (val[0]==' ' || val[0]=='\t')) val++;
+		if (val==NULL) continue;
 		
-		
-		if (strcmp(cfg, "mode")==0 && val!=NULL){
-			if (debug) printf("Setting mode %s\n", val);
+		if (strcmp(cfg, "mode")==0){
 			if (strcmp(val, "tcp")==0){
-				mode = MODE_TCP;
+				cfg_values->mode = MODE_TCP;
 			}else if (strcmp(val, "file")==0){
-				mode = MODE_FILE;
+				cfg_values->mode = MODE_FILE;
 			}else if (strcmp(val, "pipe")==0){
-				mode = MODE_NAMED_PIPE;
+				cfg_values->mode = MODE_NAMED_PIPE;
 			}else{
 				fprintf(stderr, "Unknown mode %s\n", val);
 			}
-		}else if (strcmp(cfg, "file")==0 && val!=NULL){ 
-			if (mode==MODE_FILE){
-				if (debug) printf("Setting input file %s\n", val);
-				input_file = fopen(val, "r");
-			}
-		}else if (strcmp(cfg, "port")==0 && val!=NULL){
-			if (mode==MODE_TCP){
-				port = atoi(val);
-				if (port==0) port=9999;
-				if (debug) printf("Using TCP port %d\n", port);
-			}
-		}else if (strcmp(cfg, "pipe")==0 && val!=NULL){
-			if (mode==MODE_NAMED_PIPE){
-				if (debug) printf("Opening named pipe %s\n", val);
-				named_pipe_file = (char*)malloc(strlen(val)+1);
-				strcpy(named_pipe_file, val);
-				remove(named_pipe_file);
-				mkfifo(named_pipe_file,0777);
-				chmod(named_pipe_file,0777);
-				input_file = fopen(named_pipe_file, "r");
-			}
-		}else if (strcmp(cfg, "init")==0 && val!=NULL){
-			if (strlen(val)>0){
-				if (debug) printf("Initialize cmd: %s\n", val);
-				initialize_cmd = (char*)malloc(strlen(val)+1);			
-				strcpy(initialize_cmd, val);
-			}
-		}else if (strcmp(cfg, "debug")==0 && val!=NULL) { // if not given as start-parameter, we can enable debug-mode in the configuration file, of course, this does suppress debug-output that happened during startup until reading the config-file.
+		}else if (strcmp(cfg, "file")==0){ 
+			free(cfg_values->file);
+			cfg_values->file = strdup(val);
+		}else if (strcmp(cfg, "port")==0){
+			cfg_values->port = atoi(val);
+			if (cfg_values->port==0) cfg_values->port=9999;
+		}else if (strcmp(cfg, "pipe")==0){
+			free(cfg_values->pipe);
+			cfg_values->pipe = strdup(val);
+		}else if (strcmp(cfg, "init")==0){
+			free(cfg_values->init);
+			cfg_values->init = strlen(val)>0 ? strdup(val) : NULL;
+		}else if (strcmp(cfg, "image_cache")==0){
+			cfg_values->image_cache = atoi(val) > 0 ? atoi(val) : 0;
+		}else if (strcmp(cfg, "snapshot_cache")==0){
+			cfg_values->snapshot_cache = atoi(val) > 0 ? atoi(val) : 0;
+		}else if (strcmp(cfg, "snapshot_dir")==0){
+			free(cfg_values->snapshot_dir);
+			cfg_values->snapshot_dir = strdup(val);
+		}else if (strcmp(cfg, "script_dir")==0){
+			free(cfg_values->script_dir);
+			cfg_values->script_dir = strdup(val);
+		}else if (strcmp(cfg, "metrics")==0){
+			free(cfg_values->metrics);
+			cfg_values->metrics = strdup(val);
+		}else if (strcmp(cfg, "trace")==0){
+			free(cfg_values->trace);
+			cfg_values->trace = strdup(val);
+		}else if (strcmp(cfg, "debug")==0) { // if not given as start-parameter, we can enable debug-mode in the configuration file, of course, this does suppress debug-output that happened during startup until reading the config-file.
 			if (strlen(val)>0) {
-				if (strcmp(val, "true")==0) {
-					debug = 1;
-				} else {
-					const int config_debug = atoi(val);
-					if (config_debug==1) {
-						debug = 1;
-					}
-				}
+				cfg_values->debug = strcmp(val, "true")==0 || atoi(val)==1;
 			}
 		}
     }
 
     fclose(file);
+    return 0;
+}
+
+//number of the command at the start of a command line of the init setting, 0 = setup, 1 = init, 2 = other
+int init_command_type(const char * command){
+	if (strncmp(command, "setup ", 6)==0) return 0;
+	if (strcmp(command, "init")==0 || strncmp(command, "init ", 5)==0) return 1;
+	return 2;
+}
+
+//splits the init setting in commands, returns the number of commands, the commands point into text
+int split_init_commands(char * text, char ** commands, int max_commands){
+	int n=0;
+	char * command = text!=NULL ? strtok(text, ";") : NULL;
+	while (command!=NULL && n<max_commands){
+		while (*command==' ' || *command=='\t') command++;
+		if (*command!=0) commands[n++]=command;
+		command = strtok(NULL, ";");
+	}
+	return n;
+}
+
+//removes the brightness (6th argument) from a setup command, returns the brightness (255 if not given)
+int setup_geometry(const char * command, char * geometry, int size){
+	const char * arg = command;
+	int i, brightness=255;
+	
+	snprintf(geometry, size, "%s", command);
+	for (i=0; i<5 && arg!=NULL; i++){
+		arg = strchr(arg, ',');
+		if (arg!=NULL) arg++;
+	}
+	if (arg!=NULL){
+		const char * next = strchr(arg, ',');
+		brightness = atoi(arg);
+		snprintf(&geometry[arg - command - 1], size - (arg - command - 1), "%s", next!=NULL ? next : ""); //from the comma before it
+	}
+	return brightness;
+}
+
+//executes a copy of a command line
+void execute_command_copy(const char * command){
+	char * line = strdup(command);
+	if (line==NULL) return;
+	execute_command(line);
+	free(line);
+}
+
+//applies a changed init setting: if the setup or init commands changed the leds are initialized again with all commands,
+//otherwise the commands from the first changed command to the end are executed again (gamma, brightness, run, ...),
+//of setup only the brightness, later commands can depend on the earlier ones
+//called with the commands locked
+#define MAX_INIT_COMMANDS 256
+void apply_init_changes(const char * old_init, const char * new_init){
+	char * old_text = old_init!=NULL ? strdup(old_init) : NULL;
+	char * new_text = new_init!=NULL ? strdup(new_init) : NULL;
+	char * old_commands[MAX_INIT_COMMANDS], * new_commands[MAX_INIT_COMMANDS];
+	int old_count = split_init_commands(old_text, old_commands, MAX_INIT_COMMANDS);
+	int new_count = split_init_commands(new_text, new_commands, MAX_INIT_COMMANDS);
+	int i, j, reinit=0;
+	char old_geometry[MAX_VAL_LEN], new_geometry[MAX_VAL_LEN];
+	
+	//compare the setup and init commands in order
+	for (i=0, j=0; !reinit && (i<old_count || j<new_count); i++, j++){
+		while (i<old_count && init_command_type(old_commands[i])==2) i++;
+		while (j<new_count && init_command_type(new_commands[j])==2) j++;
+		if (i>=old_count || j>=new_count){
+			reinit = i<old_count || j<new_count;
+		}else{
+			setup_geometry(old_commands[i], old_geometry, sizeof(old_geometry));
+			setup_geometry(new_commands[j], new_geometry, sizeof(new_geometry));
+			reinit = strcmp(old_geometry, new_geometry)!=0;
+		}
+	}
+	
+	if (reinit){
+		printf("Led setup changed, initializing the leds again.\n");
+		join_thread(1);
+		for (j=0; j<new_count; j++) execute_command_copy(new_commands[j]);
+	}else{
+		for (j=0; j<new_count && j<old_count && strcmp(old_commands[j], new_commands[j])==0; j++);
+		for (; j<new_count; j++){
+			int type = init_command_type(new_commands[j]);
+			if (type==1) continue;
+			if (type==0){ //the geometry is the same, only the brightness can have changed
+				char brightness[MAX_VAL_LEN];
+				int channel = atoi(&new_commands[j][6]);
+				snprintf(brightness, sizeof(brightness), "global_brightness %d,%d", channel,
+				         setup_geometry(new_commands[j], new_geometry, sizeof(new_geometry)));
+				execute_command_copy(brightness);
+			}else{
+				execute_command_copy(new_commands[j]);
+			}
+		}
+	}
+	free(old_text);
+	free(new_text);
+}
+
+//listens on another TCP port, a connected client keeps its connection
+void change_port(int new_port){
+	int fd = open_socket(new_port);
+	if (fd<0){
+		fprintf(stderr, "Keep listening on port %d\n", port);
+		return;
+	}
+	close(sockfd);
+	sockfd = fd;
+	port = new_port;
+	printf("Listening on %d.\n", port);
+}
+
+//applies the settings of a configuration file, old = settings that are in use: only what changed is applied
+//old = NULL at startup
+void apply_config(const config_t * old, const config_t * cfg){
+	if (old==NULL){
+		if (cfg->mode>=0){
+			if (debug) printf("Setting mode %d\n", cfg->mode);
+			mode = cfg->mode;
+		}
+		if (mode==MODE_FILE && cfg->file!=NULL){
+			if (debug) printf("Setting input file %s\n", cfg->file);
+			input_file = fopen(cfg->file, "r");
+		}
+		if (mode==MODE_TCP && cfg->port>0){
+			port = cfg->port;
+			if (debug) printf("Using TCP port %d\n", port);
+		}
+		if (mode==MODE_NAMED_PIPE && cfg->pipe!=NULL){
+			if (debug) printf("Opening named pipe %s\n", cfg->pipe);
+			named_pipe_file = strdup(cfg->pipe);
+			remove(named_pipe_file);
+			mkfifo(named_pipe_file,0777);
+			chmod(named_pipe_file,0777);
+			input_file = fopen(named_pipe_file, "r");
+		}
+		if (cfg->init!=NULL){
+			if (debug) printf("Initialize cmd: %s\n", cfg->init);
+			initialize_cmd = strdup(cfg->init);
+		}
+		if (cfg->debug==1) debug = 1;
+	}else{
+		if (cfg->mode!=old->mode || !same_str(cfg->file, old->file) || !same_str(cfg->pipe, old->pipe)){
+			fprintf(stderr, "The mode, file and pipe settings are used after a restart\n");
+		}
+		if (mode==MODE_TCP && cfg->port>0 && cfg->port!=port) change_port(cfg->port);
+		if (!same_str(cfg->init, old->init)) apply_init_changes(old->init, cfg->init);
+		if (cfg->debug>=0 && cfg->debug!=old->debug) debug = cfg->debug;
+	}
+	if (cfg->image_cache>=0 && (old==NULL || cfg->image_cache!=old->image_cache)){
+		if (debug) printf("Image cache size %d KB\n", cfg->image_cache);
+		image_cache_set_budget(&image_cache, (size_t) cfg->image_cache * 1024);
+	}
+	if (cfg->snapshot_cache>=0 && (old==NULL || cfg->snapshot_cache!=old->snapshot_cache)){
+		if (debug) printf("Snapshot memory %d KB\n", cfg->snapshot_cache);
+		snapshot_set_budget(&snapshots, (size_t) cfg->snapshot_cache * 1024);
+	}
+	if (cfg->snapshot_dir!=NULL && (old==NULL || !same_str(cfg->snapshot_dir, old->snapshot_dir))){
+		if (debug) printf("Snapshot directory %s\n", cfg->snapshot_dir);
+		snapshot_set_directory(&snapshots, cfg->snapshot_dir);
+	}
+	if (cfg->script_dir!=NULL && (old==NULL || !same_str(cfg->script_dir, old->script_dir))){
+		if (debug) printf("Script directory %s\n", cfg->script_dir);
+		if (script_library_load(&scripts, cfg->script_dir)<0) fprintf(stderr, "Error: can't read script directory %s\n", cfg->script_dir);
+		config_watch_scripts(&config_watch, cfg->script_dir);
+	}
+	if (old==NULL ? cfg->metrics!=NULL : !same_str(cfg->metrics, old->metrics)){
+		if (debug) printf("Metrics %s\n", cfg->metrics!=NULL ? cfg->metrics : "off");
+		start_metrics(cfg->metrics!=NULL ? cfg->metrics : "");
+	}
+	if (old==NULL ? cfg->trace!=NULL : !same_str(cfg->trace, old->trace)){
+		if (debug) printf("Trace %s\n", cfg->trace!=NULL ? cfg->trace : "off");
+		if (trace_set(cfg->trace!=NULL, cfg->trace)!=0) fprintf(stderr, "Tracing is not compiled in\n");
+	}
+}
+
+void load_config_file(char * filename){
+	if (read_config_file(filename, &config)!=0){
+		fprintf(stderr, "Error opening config file %s\nExiting.", filename);
+		exit(10);
+	}
+	apply_config(NULL, &config);
+	free(config_file);
+	config_file = strdup(filename);
+}
+
+//compiles the changed scripts of the script directory, a running script is started again when it was changed
+void reload_scripts(){
+	char directory[MAX_VAL_LEN];
+	char name[SCRIPT_MAX_NAME+1];
+	
+	if (scripts.directory==NULL) return;
+	snprintf(directory, sizeof(directory), "%s", scripts.directory);
+	script_library_load(&scripts, directory);
+	
+	snprintf(name, sizeof(name), "%s", running_script);
+	if (thread_running && name[0]!=0 && script_version(&scripts, name)!=running_version){
+		printf("Script %s changed, starting it again.\n", name);
+		run_script(name);
+	}
+}
+
+//applies changes of the configuration file and script directory, called between commands
+void check_config_changes(){
+	int changes = config_watch_read(&config_watch);
+	
+	if (changes==0) return;
+	lock_commands(); //the changes execute commands and change settings that commands use
+	if (changes & CONFIG_WATCH_CONFIG){
+		config_t changed;
+		if (read_config_file(config_file, &changed)==0){
+			printf("Configuration changed.\n");
+			apply_config(&config, &changed);
+			free_config(&config);
+			config = changed;
+		}else{
+			fprintf(stderr, "Error opening config file %s\n", config_file);
+		}
+	}
+	if (changes & CONFIG_WATCH_SCRIPTS) reload_scripts();
+	unlock_commands();
 }
 
 //main routine
@@ -2498,7 +4661,17 @@ int main(int argc, char *argv[]){
 	int i;
 	int index=0;
     
-    srand (time(NULL));
+    init_glyph_atlas();
+    colorspace_init();
+    for (i=0;i<RPI_PWM_CHANNELS;i++){
+        color_correction_default(&color_corrections[i]);
+        color_correction_build(&color_corrections[i], color_tables[i]);
+    }
+    image_cache_init(&image_cache, DEFAULT_IMAGE_CACHE_SIZE * 1024);
+    snapshot_store_init(&snapshots, DEFAULT_SNAPSHOT_MEMORY * 1024);
+    script_library_init(&scripts);
+    metrics_init(&metrics);
+    if (trace_init()!=0) fprintf(stderr, "Can't start the trace thread\n");
 
     ledstring.device=NULL;
     for (i=0;i<RPI_PWM_CHANNELS;i++){
@@ -2599,19 +4772,30 @@ int main(int argc, char *argv[]){
 		initialize_cmd=NULL;
 	}
 	
+	if (config_file!=NULL && config_watch_init(&config_watch)==0){ //changes of the configuration are applied without restart
+		if (config_watch_file(&config_watch, config_file)!=0) fprintf(stderr, "Can't watch %s for changes\n", config_file);
+		if (scripts.directory!=NULL) config_watch_scripts(&config_watch, scripts.directory);
+	}
+	
 	if (mode==MODE_TCP) start_tcpip(port);
 	
 	while (exit_program==0) {
         if (mode==MODE_TCP){
             c = 0;
-            if (read(active_socket, (void *) & c, 1)<=0) c = EOF; //returns 0 if connection is closed, -1 if no more data available and >0 if data read
-        }else{
+            if (!wait_for_input(active_socket, CLIENT_TIMEOUT)) c = EOF; //no data in time, same as the timeout of read
+            else if (read(active_socket, (void *) & c, 1)<=0) c = EOF; //returns 0 if connection is closed, -1 if no more data available and >0 if data read
+        }else if (mode==MODE_FILE){
             c = fgetc (input_file); //doesn't work with tcp
+        }else{
+            c = read_input(); //waits for input and changes of the configuration
         }
         
 	  if (c!=EOF){
+        metrics_add(&metrics.bytes_received, 1);
         process_character(c);
+        if ((c=='\n' || c==';') && config_watch.fd>=0) check_config_changes();
 	  }else{
+        if (config_watch.fd>=0) check_config_changes();
         //end of file or read error
 		switch (mode){
             case MODE_TCP:
@@ -2630,6 +4814,7 @@ int main(int argc, char *argv[]){
                 break;
             case MODE_FILE:
                 process_character('\n'); //end last line
+                join_thread(0); //a script started with run plays until it ends
 				exit_program=1; 
                 //if (ftell(input_file)==feof(input_file))  exit_program=1; //exit the program if we reached the end
                 break;
@@ -2650,9 +4835,19 @@ int main(int argc, char *argv[]){
         remove(named_pipe_file);
         free(named_pipe_file);
     }
+	join_thread(1);
 	free(command_line);
     if (thread_data!=NULL) free(thread_data);
     if (ledstring.device!=NULL) ws2811_fini(&ledstring);
+    for (i=0;i<RPI_PWM_CHANNELS;i++) led_layout_free(&layouts[i]);
+    for (i=0;i<RPI_PWM_CHANNELS;i++) transition_free(&transitions[i]);
+    snapshot_store_free(&snapshots); //waits until all persistent snapshots are written
+    script_library_free(&scripts);
+    config_watch_free(&config_watch);
+    metrics_server_stop(&metrics_server);
+    free_config(&config);
+    free(config_file);
+    image_cache_clear(&image_cache);
     
     return ret;
 }
@@ -0,0 +1,327 @@
+//
+// Performance metrics and their Prometheus exporter, see metrics.h
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include "metrics.h"
+
+#define PREFIX "ws2812svr_"
+#define REQUEST_TIMEOUT_MS 200 //a client that sends no request in this time gets the metrics without HTTP header
+
+//upper bounds of the buckets in ns, frame times are between some µs (encoding) and some 10 ms (DMA, 50 fps)
+static const uint64_t bucket_bounds[METRICS_BUCKETS - 1] = {
+    10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000, 25000000, 50000000,
+    100000000, 250000000
+};
+
+void metrics_init(metrics_t * metrics){
+    memset(metrics, 0, sizeof(*metrics));
+    pthread_mutex_init(&metrics->mutex, NULL);
+}
+
+uint64_t metrics_now(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+//__sync builtins: 64 bit atomics without libatomic on the 32 bit ARM of the Raspberry Pi
+void metrics_add(uint64_t * counter, uint64_t n){
+    __sync_fetch_and_add(counter, n);
+}
+
+static uint64_t load(uint64_t * counter){
+    return __sync_fetch_and_add(counter, 0);
+}
+
+void metrics_observe(metrics_histogram_t * histogram, uint64_t ns){
+    int bucket = 0;
+    while (bucket < METRICS_BUCKETS - 1 && ns > bucket_bounds[bucket]) bucket++;
+    __sync_fetch_and_add(&histogram->buckets[bucket], 1);
+    __sync_fetch_and_add(&histogram->sum, ns);
+    __sync_fetch_and_add(&histogram->count, 1);
+}
+
+void metrics_render(metrics_t * metrics, const ws2811_t * ws2811, int encoded, ws2811_return_t result){
+    int chan;
+
+    if (result != WS2811_SUCCESS){
+        metrics_add(&metrics->render_errors, 1);
+        return;
+    }
+    if (encoded){
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++){
+            if (ws2811->channel[chan].count > 0) metrics_observe(&metrics->encode_time[chan], ws2811->channel[chan].encode_time);
+        }
+    }
+    metrics_observe(&metrics->dma_wait, ws2811->wait_time);
+    metrics_add(&metrics->frames_rendered, 1);
+}
+
+static unsigned int hash(const char * name){
+    unsigned int h = 2166136261u;
+    while (*name) h = (h ^ (unsigned char) *name++) * 16777619u;
+    return h;
+}
+
+//returns the counters of a command, they are added the first time the command is executed, NULL if the table is full
+static metrics_command_t * find_command(metrics_t * metrics, const char * name){
+    unsigned int start = hash(name) % METRICS_MAX_COMMANDS;
+    unsigned int i, slot;
+    metrics_command_t * command = NULL;
+
+    for (i = 0; i < METRICS_MAX_COMMANDS; i++){
+        command = &metrics->commands[(start + i) % METRICS_MAX_COMMANDS];
+        if (!command->used) break;
+        __sync_synchronize(); //the name was written before used
+        if (strcmp(command->name, name) == 0) return command;
+    }
+    if (i == METRICS_MAX_COMMANDS || strlen(name) >= METRICS_MAX_NAME) return NULL;
+
+    //not found: add it, another thread can have added it meanwhile
+    pthread_mutex_lock(&metrics->mutex);
+    for (slot = start, i = 0; i < METRICS_MAX_COMMANDS; i++, slot = (slot + 1) % METRICS_MAX_COMMANDS){
+        command = &metrics->commands[slot];
+        if (!command->used){
+            strcpy(command->name, name);
+            __sync_synchronize();
+            command->used = 1;
+            break;
+        }
+        if (strcmp(command->name, name) == 0) break;
+    }
+    pthread_mutex_unlock(&metrics->mutex);
+    return i == METRICS_MAX_COMMANDS ? NULL : command;
+}
+
+void metrics_command(metrics_t * metrics, const char * name, uint64_t parse_ns, uint64_t run_ns){
+    metrics_command_t * command;
+
+    metrics_observe(&metrics->parse_time, parse_ns);
+    if (name == NULL){
+        metrics_add(&metrics->unknown_commands, 1);
+    }else if ((command = find_command(metrics, name)) != NULL){
+        metrics_add(&command->count, 1);
+        metrics_add(&command->time, run_ns);
+    }
+}
+
+static void write_histogram(FILE * out, const char * name, const char * labels, metrics_histogram_t * histogram){
+    uint64_t cumulative = 0;
+    int bucket;
+
+    for (bucket = 0; bucket < METRICS_BUCKETS; bucket++){
+        cumulative += load(&histogram->buckets[bucket]);
+        if (bucket < METRICS_BUCKETS - 1){
+            fprintf(out, PREFIX "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels, labels[0] ? "," : "",
+                    bucket_bounds[bucket] / 1e9, (unsigned long long) cumulative);
+        }else{
+            fprintf(out, PREFIX "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, labels[0] ? "," : "",
+                    (unsigned long long) cumulative);
+        }
+    }
+    fprintf(out, PREFIX "%s_sum%s%s%s %.9f\n", name, labels[0] ? "{" : "", labels, labels[0] ? "}" : "",
+            load(&histogram->sum) / 1e9);
+    fprintf(out, PREFIX "%s_count%s%s%s %llu\n", name, labels[0] ? "{" : "", labels, labels[0] ? "}" : "",
+            (unsigned long long) cumulative);
+}
+
+static void write_header(FILE * out, const char * name, const char * type, const char * help){
+    fprintf(out, "# HELP " PREFIX "%s %s\n# TYPE " PREFIX "%s %s\n", name, help, name, type);
+}
+
+static void write_counter(FILE * out, const char * name, const char * help, uint64_t * counter){
+    write_header(out, name, "counter", help);
+    fprintf(out, PREFIX "%s %llu\n", name, (unsigned long long) load(counter));
+}
+
+char * metrics_text(metrics_t * metrics, size_t * size){
+    char * text = NULL;
+    char labels[32];
+    FILE * out = open_memstream(&text, size);
+    int chan, i;
+
+    if (out == NULL) return NULL;
+
+    write_header(out, "encode_seconds", "histogram", "Time to encode the leds of a channel for a frame.");
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++){
+        if (load(&metrics->encode_time[chan].count) == 0) continue; //unused channel
+        sprintf(labels, "channel=\"%d\"", chan + 1);
+        write_histogram(out, "encode_seconds", labels, &metrics->encode_time[chan]);
+    }
+    write_header(out, "dma_wait_seconds", "histogram", "Time a frame waited for the DMA transfer of the previous frame.");
+    write_histogram(out, "dma_wait_seconds", "", &metrics->dma_wait);
+    write_header(out, "sleep_overshoot_seconds", "histogram", "Delay of the start of an animation frame after its planned time.");
+    write_histogram(out, "sleep_overshoot_seconds", "", &metrics->sleep_overshoot);
+    write_header(out, "command_parse_seconds", "histogram", "Time to split a command line into command and arguments.");
+    write_histogram(out, "command_parse_seconds", "", &metrics->parse_time);
+
+    write_counter(out, "frames_rendered_total", "Frames sent to the leds.", &metrics->frames_rendered);
+    write_counter(out, "frames_dropped_total", "Animation frame times that passed without a frame.", &metrics->frames_dropped);
+    write_counter(out, "render_errors_total", "Frames that could not be sent.", &metrics->render_errors);
+    write_counter(out, "received_bytes_total", "Bytes of commands received.", &metrics->bytes_received);
+    write_counter(out, "client_connects_total", "TCP clients that connected.", &metrics->client_connects);
+    write_counter(out, "unknown_commands_total", "Command lines with an unknown command.", &metrics->unknown_commands);
+
+    write_header(out, "commands_total", "counter", "Executed commands.");
+    for (i = 0; i < METRICS_MAX_COMMANDS; i++){
+        metrics_command_t * command = &metrics->commands[i];
+        if (!command->used) continue;
+        __sync_synchronize();
+        fprintf(out, PREFIX "commands_total{command=\"%s\"} %llu\n", command->name, (unsigned long long) load(&command->count));
+    }
+    write_header(out, "command_seconds_total", "counter", "Time spent executing commands.");
+    for (i = 0; i < METRICS_MAX_COMMANDS; i++){
+        metrics_command_t * command = &metrics->commands[i];
+        if (!command->used) continue;
+        __sync_synchronize();
+        fprintf(out, PREFIX "command_seconds_total{command=\"%s\"} %.9f\n", command->name, load(&command->time) / 1e9);
+    }
+
+    if (fclose(out) != 0){
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+static int send_all(int fd, const char * data, size_t len){
+    while (len > 0){
+        ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent <= 0) return -1;
+        data += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+//answers one client: an HTTP request gets an HTTP response, a client that sends nothing (nc -U) only the text
+static void serve_client(metrics_server_t * server, int client){
+    struct timeval tv = {0, REQUEST_TIMEOUT_MS * 1000};
+    char request[2048];
+    size_t received = 0;
+    char * text;
+    size_t size;
+
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    while (received < sizeof(request) - 1){
+        ssize_t len = recv(client, &request[received], sizeof(request) - 1 - received, 0);
+        if (len <= 0) break;
+        received += len;
+        request[received] = 0;
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) break; //end of the request header
+    }
+
+    if ((text = metrics_text(server->metrics, &size)) == NULL) return;
+    if (received > 0){
+        char header[160];
+        snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                 "Content-Length: %zu\r\nConnection: close\r\n\r\n", size);
+        if (send_all(client, header, strlen(header)) != 0){
+            free(text);
+            return;
+        }
+    }
+    send_all(client, text, size);
+    free(text);
+}
+
+static void * server_thread(void * arg){
+    metrics_server_t * server = (metrics_server_t *) arg;
+    int client;
+
+    //shutdown of the listening socket by metrics_server_stop ends accept
+    while ((client = accept(server->fd, NULL, NULL)) >= 0 || errno == EINTR){
+        if (client < 0) continue;
+        serve_client(server, client);
+        close(client);
+    }
+    return NULL;
+}
+
+static int is_port(const char * address){
+    if (*address == 0) return 0;
+    while (*address) if (!isdigit((unsigned char) *address++)) return 0;
+    return 1;
+}
+
+static int open_tcp(int port){
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    int reuse = 1;
+
+    if (fd < 0) return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 5) < 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int open_unix(const char * path){
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path) || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path); //socket of a previous run
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 5) < 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int metrics_server_start(metrics_server_t * server, metrics_t * metrics, const char * address){
+    server->metrics = metrics;
+    server->socket_path = NULL;
+    if (is_port(address)){
+        server->fd = open_tcp(atoi(address));
+    }else{
+        server->fd = open_unix(address);
+        if (server->fd >= 0 && (server->socket_path = strdup(address)) == NULL){
+            close(server->fd);
+            unlink(address);
+            server->fd = -1;
+        }
+    }
+    if (server->fd < 0) return -1;
+    if (pthread_create(&server->thread, NULL, server_thread, server) != 0){
+        close(server->fd);
+        if (server->socket_path != NULL) unlink(server->socket_path);
+        free(server->socket_path);
+        server->socket_path = NULL;
+        server->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void metrics_server_stop(metrics_server_t * server){
+    if (server->fd < 0) return;
+    shutdown(server->fd, SHUT_RDWR);
+    pthread_join(server->thread, NULL);
+    close(server->fd);
+    if (server->socket_path != NULL){
+        unlink(server->socket_path);
+        free(server->socket_path);
+        server->socket_path = NULL;
+    }
+    server->fd = -1;
+}
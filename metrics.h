@@ -0,0 +1,79 @@
+//
+// Counters and histograms of the render and command performance, exported in the Prometheus text format
+// over HTTP on a TCP port or a Unix socket.
+// Recording is a few atomic additions so it can stay on in the render loops, the export reads the counters
+// while they are recorded (a scrape can see a sample in the count before it is in its bucket).
+//
+
+#ifndef RPI_LEDMATRIX_SERVER_METRICS_H
+#define RPI_LEDMATRIX_SERVER_METRICS_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "ws2811.h"
+
+#define METRICS_BUCKETS 15          //upper bounds of the buckets see metrics.c, the last bucket is +Inf
+#define METRICS_MAX_COMMANDS 128    //command names that are counted separately
+#define METRICS_MAX_NAME 32
+
+typedef struct {
+    uint64_t buckets[METRICS_BUCKETS]; //number of samples in every bucket (not cumulative)
+    uint64_t count;
+    uint64_t sum;                   //ns
+} metrics_histogram_t;
+
+typedef struct {
+    char name[METRICS_MAX_NAME];
+    volatile int used;              //1 after the name was written
+    uint64_t count;
+    uint64_t time;                  //ns spent executing the command
+} metrics_command_t;
+
+typedef struct {
+    metrics_histogram_t encode_time[RPI_PWM_CHANNELS]; //encoding the leds of a frame
+    metrics_histogram_t dma_wait;   //ws2811_wait before a frame is sent
+    metrics_histogram_t sleep_overshoot; //how much later than planned the next frame of an animation started
+    metrics_histogram_t parse_time; //command line to command and arguments
+    uint64_t frames_rendered;
+    uint64_t frames_dropped;        //frame times of animations that passed while the server was busy
+    uint64_t render_errors;
+    uint64_t bytes_received;
+    uint64_t client_connects;
+    uint64_t unknown_commands;
+    metrics_command_t commands[METRICS_MAX_COMMANDS]; //hash table of the command names
+    pthread_mutex_t mutex;          //adding a command name
+} metrics_t;
+
+typedef struct {
+    int fd;                         //listening socket, -1 = not exporting
+    char * socket_path;             //Unix socket, NULL = TCP port
+    pthread_t thread;
+    metrics_t * metrics;
+} metrics_server_t;
+
+void metrics_init(metrics_t * metrics);
+
+//monotonic time in ns
+uint64_t metrics_now();
+
+void metrics_observe(metrics_histogram_t * histogram, uint64_t ns);
+
+void metrics_add(uint64_t * counter, uint64_t n);
+
+//records a rendered frame with the times the driver stored in ws2811, encoded = 0 for a pre-encoded frame
+void metrics_render(metrics_t * metrics, const ws2811_t * ws2811, int encoded, ws2811_return_t result);
+
+//records an executed command, name = NULL for an unknown command
+void metrics_command(metrics_t * metrics, const char * name, uint64_t parse_ns, uint64_t run_ns);
+
+//returns the metrics in the Prometheus text format (malloced) and its length in *size, NULL = out of memory
+char * metrics_text(metrics_t * metrics, size_t * size);
+
+//exports the metrics on address: a TCP port number or the path of a Unix socket
+//returns 0 on success, -1 if the socket can't be opened
+int metrics_server_start(metrics_server_t * server, metrics_t * metrics, const char * address);
+
+//stops exporting, does nothing if the server isn't running
+void metrics_server_stop(metrics_server_t * server);
+
+#endif //RPI_LEDMATRIX_SERVER_METRICS_H
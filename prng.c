@@ -0,0 +1,55 @@
+//
+// PCG32 random number generator, see prng.h
+//
+
+#include <string.h>
+#include <time.h>
+#include "prng.h"
+
+uint64_t prng_seed(prng_t * prng, uint64_t seed){
+    if (seed == 0){
+        static unsigned int calls = 0;
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        seed = ((uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec) ^ ((uint64_t) ++calls << 48);
+        seed = (uint32_t) (seed ^ (seed >> 32)); //the seed is given back as a 32 bit command argument
+        if (seed == 0) seed = 1;
+    }
+    prng->state = 0;
+    prng->inc = 0xda3e39cb94b95bdbULL; //any odd number, the stream of the generator
+    prng_next(prng);
+    prng->state += seed;
+    prng_next(prng);
+    return seed;
+}
+
+uint32_t prng_next(prng_t * prng){
+    uint64_t old = prng->state;
+    uint32_t xorshifted, rot;
+
+    prng->state = old * 6364136223846793005ULL + prng->inc;
+    xorshifted = (uint32_t) (((old >> 18) ^ old) >> 27);
+    rot = (uint32_t) (old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+//multiply and shift instead of a division, the bias is below n/2^32
+uint32_t prng_range(prng_t * prng, uint32_t n){
+    return (uint32_t) (((uint64_t) prng_next(prng) * n) >> 32);
+}
+
+void prng_fill(prng_t * prng, void * buffer, size_t len){
+    uint8_t * dst = (uint8_t *) buffer;
+    uint32_t value;
+
+    while (len >= sizeof(value)){
+        value = prng_next(prng);
+        memcpy(dst, &value, sizeof(value));
+        dst += sizeof(value);
+        len -= sizeof(value);
+    }
+    if (len > 0){
+        value = prng_next(prng);
+        memcpy(dst, &value, len);
+    }
+}
@@ -0,0 +1,30 @@
+//
+// Small and fast random number generator (PCG32) for the random effects.
+// Every effect has its own generator, the same seed always gives the same sequence so a run can be reproduced.
+//
+
+#ifndef RPI_LEDMATRIX_SERVER_PRNG_H
+#define RPI_LEDMATRIX_SERVER_PRNG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+    uint64_t state;
+    uint64_t inc;
+} prng_t;
+
+//seeds the generator, seed 0 picks a 32 bit seed from the clock
+//returns the seed used, give it again to repeat the sequence
+uint64_t prng_seed(prng_t * prng, uint64_t seed);
+
+//returns 32 random bits
+uint32_t prng_next(prng_t * prng);
+
+//returns a random number 0..n-1 (n > 0)
+uint32_t prng_range(prng_t * prng, uint32_t n);
+
+//fills len bytes with random data
+void prng_fill(prng_t * prng, void * buffer, size_t len);
+
+#endif //RPI_LEDMATRIX_SERVER_PRNG_H
@@ -0,0 +1,92 @@
+//
+// Raw frame files, see rawframes.h
+//
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rawframes.h"
+
+static unsigned int read_le(const uint8_t * p, int bytes){
+    unsigned int value = 0;
+    while (bytes-- > 0) value = (value << 8) | p[bytes];
+    return value;
+}
+
+int raw_frames_open(raw_frames_t * raw, const char * filename){
+    struct stat st;
+    const uint8_t * header;
+    unsigned int available;
+    int fd;
+
+    memset(raw, 0, sizeof(raw_frames_t));
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0){
+        close(fd);
+        return -1;
+    }
+    if (st.st_size < RAW_FRAMES_HEADER_SIZE){
+        close(fd);
+        return -3;
+    }
+    raw->map_size = st.st_size;
+    raw->map = mmap(NULL, raw->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); //the mapping keeps the file open
+    if (raw->map == MAP_FAILED){
+        raw->map = NULL;
+        return -1;
+    }
+    //frames are read once from the start to the end: let the kernel read ahead and drop pages that were played
+    madvise(raw->map, raw->map_size, MADV_SEQUENTIAL);
+
+    header = (const uint8_t *) raw->map;
+    raw->width = read_le(header + 4, 2);
+    raw->height = read_le(header + 6, 2);
+    raw->format = header[8];
+    raw->fps = read_le(header + 10, 2);
+    raw->frame_count = read_le(header + 12, 4);
+    raw->frames = header + RAW_FRAMES_HEADER_SIZE;
+
+    switch (raw->format){
+        case RAW_FORMAT_RGB:
+            raw->frame_size = (size_t) raw->width * raw->height * 3;
+            break;
+        case RAW_FORMAT_RGBW:
+        case RAW_FORMAT_LED:
+            raw->frame_size = (size_t) raw->width * raw->height * 4;
+            break;
+    }
+    if (memcmp(header, RAW_FRAMES_MAGIC, 4) != 0 || raw->frame_size == 0){
+        raw_frames_close(raw);
+        return -3;
+    }
+
+    //an incomplete last frame (file still being written) is ignored
+    available = (unsigned int) ((raw->map_size - RAW_FRAMES_HEADER_SIZE) / raw->frame_size);
+    if (raw->frame_count == 0 || raw->frame_count > available) raw->frame_count = available;
+    return 0;
+}
+
+void raw_frames_close(raw_frames_t * raw){
+    if (raw->map != NULL) munmap(raw->map, raw->map_size);
+    raw->map = NULL;
+    raw->frames = NULL;
+    raw->frame_count = 0;
+}
+
+void raw_frames_to_colors(const raw_frames_t * raw, const uint8_t * src, uint32_t * dst, int count){
+    int i;
+
+    if (raw->format == RAW_FORMAT_RGB){
+        for (i = 0; i < count; i++, src += 3){
+            dst[i] = ((uint32_t) src[2] << 16) | ((uint32_t) src[1] << 8) | src[0];
+        }
+    }else{
+        for (i = 0; i < count; i++, src += 4){
+            dst[i] = ((uint32_t) src[3] << 24) | ((uint32_t) src[2] << 16) | ((uint32_t) src[1] << 8) | src[0];
+        }
+    }
+}
@@ -0,0 +1,51 @@
+//
+// Pre-rendered shows stored as raw frames: a 16 byte header followed by the packed frames.
+// The file is memory mapped and read sequentially, playing a frame only copies its pixels.
+//
+// header (little endian):
+//   char     magic[4]      "LEDR"
+//   uint16_t width         pixels of every frame (row by row, logical coordinates of the matrix)
+//   uint16_t height
+//   uint8_t  format        RAW_FORMAT_*
+//   uint8_t  reserved      0
+//   uint16_t fps           frames per second the show was made for
+//   uint32_t frame_count   0 = all frames until the end of the file
+//
+
+#ifndef RPI_LEDMATRIX_SERVER_RAWFRAMES_H
+#define RPI_LEDMATRIX_SERVER_RAWFRAMES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RAW_FRAMES_MAGIC "LEDR"
+#define RAW_FRAMES_HEADER_SIZE 16
+
+#define RAW_FORMAT_RGB 0    //3 bytes per pixel: red, green, blue
+#define RAW_FORMAT_RGBW 1   //4 bytes per pixel: red, green, blue, white
+#define RAW_FORMAT_LED 2    //32 bit led colors (0xWWBBGGRR) as stored in the leds, copied without conversion
+
+typedef struct {
+    int width;
+    int height;
+    int format;
+    int fps;
+    unsigned int frame_count;
+    size_t frame_size;          //bytes of one frame
+    const uint8_t * frames;     //first frame
+    void * map;
+    size_t map_size;
+} raw_frames_t;
+
+//returns the data of frame i
+#define raw_frame(raw, i) ((raw)->frames + (size_t) (i) * (raw)->frame_size)
+
+//maps a raw frame file, returns 0 on success, -1 if the file can't be read, -3 if the header is not valid
+int raw_frames_open(raw_frames_t * raw, const char * filename);
+
+void raw_frames_close(raw_frames_t * raw);
+
+//converts count pixels of a RAW_FORMAT_RGB or RAW_FORMAT_RGBW frame to led colors
+void raw_frames_to_colors(const raw_frames_t * raw, const uint8_t * src, uint32_t * dst, int count);
+
+#endif //RPI_LEDMATRIX_SERVER_RAWFRAMES_H
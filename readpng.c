@@ -201,20 +201,12 @@ int readpng_get_bgcolor(uch *red, uch *green, uch *blue)
 
 /* display_exponent == LUT_exponent * CRT_exponent */
 
-uch *readpng_get_image(double display_exponent, int *pChannels, ulg *pRowbytes)
+/* registers the transformations to 8 bit RGB[A] and updates info_ptr, shared by
+ * readpng_get_image and readpng_start_rows */
+
+static void readpng_set_transforms(double display_exponent)
 {
     double  gamma;
-    png_uint_32  i, rowbytes;
-    png_bytepp  row_pointers = NULL;
-
-
-    /* setjmp() must be called in every function that calls a PNG-reading
-     * libpng function */
-
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-        return NULL;
-    }
 
 
     /* expand palette images to RGB, low-bit-depth grayscale images to 8 bits,
@@ -246,6 +238,27 @@ uch *readpng_get_image(double display_exponent, int *pChannels, ulg *pRowbytes)
      * get rowbytes and channels, and allocate image memory */
 
     png_read_update_info(png_ptr, info_ptr);
+}
+
+
+
+
+uch *readpng_get_image(double display_exponent, int *pChannels, ulg *pRowbytes)
+{
+    png_uint_32  i, rowbytes;
+    png_bytepp  row_pointers = NULL;
+
+
+    /* setjmp() must be called in every function that calls a PNG-reading
+     * libpng function */
+
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return NULL;
+    }
+
+
+    readpng_set_transforms(display_exponent);
 
     *pRowbytes = rowbytes = png_get_rowbytes(png_ptr, info_ptr);
     *pChannels = (int)png_get_channels(png_ptr, info_ptr);
@@ -287,6 +300,47 @@ uch *readpng_get_image(double display_exponent, int *pChannels, ulg *pRowbytes)
 }
 
 
+/* row by row reading: only one row has to be in memory, call readpng_read_row
+ * for every row after readpng_start_rows returned 0.  Interlaced images are
+ * not complete before the last pass, they must be read with readpng_get_image
+ * (return value 1) */
+
+int readpng_start_rows(double display_exponent, int *pChannels, ulg *pRowbytes)
+{
+    if (png_get_interlace_type(png_ptr, info_ptr) != PNG_INTERLACE_NONE)
+        return 1;
+
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return 2;
+    }
+
+    readpng_set_transforms(display_exponent);
+
+    *pRowbytes = png_get_rowbytes(png_ptr, info_ptr);
+    *pChannels = (int)png_get_channels(png_ptr, info_ptr);
+
+    return 0;
+}
+
+
+/* reads the next row (rowbytes from readpng_start_rows), returns 2 on a libpng error */
+
+int readpng_read_row(uch *row)
+{
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        return 2;
+    }
+
+    png_read_row(png_ptr, row, NULL);
+
+    return 0;
+}
+
+
+
+
 void readpng_cleanup(int free_image_data)
 {
     if (free_image_data && image_data) {
@@ -84,4 +84,8 @@ int readpng_get_bgcolor(uch *bg_red, uch *bg_green, uch *bg_blue);
 
 uch *readpng_get_image(double display_exponent, int *pChannels, ulg *pRowbytes);
 
+int readpng_start_rows(double display_exponent, int *pChannels, ulg *pRowbytes);
+
+int readpng_read_row(uch *row);
+
 void readpng_cleanup(int free_image_data);
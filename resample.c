@@ -0,0 +1,93 @@
+//
+// Scaling of decoded images, see resample.h
+//
+
+#include <stdlib.h>
+#include "resample.h"
+
+static int clamp(int value, int min, int max){
+    if (value < min) return min;
+    if (value > max) return max;
+    return value;
+}
+
+void resample_layout(int mode, int image_width, int image_height, int width, int height, resample_rect_t * src, resample_rect_t * dst){
+    long long iw = image_width, ih = image_height;
+
+    src->x = src->y = dst->x = dst->y = 0;
+    src->width = image_width;
+    src->height = image_height;
+    dst->width = width;
+    dst->height = height;
+
+    switch (mode){
+        case RESAMPLE_FIT:
+            if (iw * height <= ih * width){ //height of the image limits the size
+                dst->width = clamp((int) ((iw * height + ih / 2) / ih), 1, width);
+            }else{
+                dst->height = clamp((int) ((ih * width + iw / 2) / iw), 1, height);
+            }
+            break;
+        case RESAMPLE_FILL:
+            if (iw * height >= ih * width){ //image is wider than the matrix, crop left and right
+                src->width = clamp((int) ((ih * width + height / 2) / height), 1, image_width);
+            }else{
+                src->height = clamp((int) ((iw * height + width / 2) / width), 1, image_height);
+            }
+            break;
+        case RESAMPLE_CROP:
+            src->width = dst->width = image_width < width ? image_width : width;
+            src->height = dst->height = image_height < height ? image_height : height;
+            break;
+    }
+    src->x = (image_width - src->width) / 2;
+    src->y = (image_height - src->height) / 2;
+    dst->x = (width - dst->width) / 2;
+    dst->y = (height - dst->height) / 2;
+}
+
+//scales lines of src_len pixels to dst_len pixels, the pixels of a line are src_step (dst_step) apart
+//and the lines src_line_step (dst_line_step)
+static void resample_lines(const uint32_t * src, int src_len, int src_step, int src_line_step,
+                           uint32_t * dst, int dst_len, int dst_step, int dst_line_step, int lines){
+    uint32_t scale = ((uint32_t) src_len << 16) / dst_len;
+    int line, i, c;
+
+    for (line = 0; line < lines; line++, src += src_line_step, dst += dst_line_step){
+        uint32_t * out = dst;
+        for (i = 0; i < dst_len; i++, out += dst_step){
+            uint32_t start = i * scale;
+            uint32_t end = i == dst_len - 1 ? (uint32_t) src_len << 16 : (i + 1) * scale;
+            uint32_t sum[4] = {0, 0, 0, 0}, total = 0, p, pixel = 0;
+
+            //weights in 1/256 of a source pixel, the partly covered pixels at the edges count for the covered part
+            for (p = start >> 16; (p << 16) < end; p++){
+                uint32_t from = start > (p << 16) ? start : (p << 16);
+                uint32_t to = end < ((p + 1) << 16) ? end : ((p + 1) << 16);
+                uint32_t weight = (to - from + 255) >> 8;
+                uint32_t value = src[p * src_step];
+                sum[0] += (value & 0xFF) * weight;
+                sum[1] += ((value >> 8) & 0xFF) * weight;
+                sum[2] += ((value >> 16) & 0xFF) * weight;
+                sum[3] += (value >> 24) * weight;
+                total += weight;
+            }
+            for (c = 0; c < 4; c++) pixel |= ((sum[c] + total / 2) / total) << (c * 8);
+            *out = pixel;
+        }
+    }
+}
+
+int resample_area(const uint32_t * src, int src_width, int src_height, int src_stride, uint32_t * dst, int dst_width, int dst_height){
+    uint32_t * rows;
+
+    if (src_width <= 0 || src_height <= 0 || dst_width <= 0 || dst_height <= 0) return 0;
+    rows = (uint32_t *) malloc(sizeof(uint32_t) * dst_width * src_height);
+    if (rows == NULL) return -2;
+
+    //rows first: every source row to dst_width pixels, then the columns of the result to dst_height pixels
+    resample_lines(src, src_width, 1, src_stride, rows, dst_width, 1, dst_width, src_height);
+    resample_lines(rows, src_height, dst_width, 1, dst, dst_height, dst_width, 1, dst_width);
+    free(rows);
+    return 0;
+}
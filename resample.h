@@ -0,0 +1,32 @@
+//
+// Scaling of decoded images to the size of the matrix.
+// Pixels are 4 independent 8 bit components (led colors with R,G,B,W), every component is averaged separately.
+//
+
+#ifndef RPI_LEDMATRIX_SERVER_RESAMPLE_H
+#define RPI_LEDMATRIX_SERVER_RESAMPLE_H
+
+#include <stdint.h>
+
+#define RESAMPLE_FIT 0      //whole image visible, aspect ratio kept, borders around the image
+#define RESAMPLE_FILL 1     //matrix covered, aspect ratio kept, the image is cropped
+#define RESAMPLE_STRETCH 2  //image scaled to the matrix, aspect ratio not kept
+#define RESAMPLE_CROP 3     //image not scaled, the center of the image is shown
+
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} resample_rect_t;
+
+//computes the part of the image (src) that is scaled to the part of the matrix (dst) for the mode
+void resample_layout(int mode, int image_width, int image_height, int width, int height, resample_rect_t * src, resample_rect_t * dst);
+
+//scales src_width*src_height pixels (src_stride pixels between 2 rows) to dst_width*dst_height pixels
+//every destination pixel is the area weighted average of the source pixels it covers (box filter), the filter
+//runs in 2 passes (rows, then columns) with 16.16 fixed point positions
+//returns -2 if out of memory
+int resample_area(const uint32_t * src, int src_width, int src_height, int src_stride, uint32_t * dst, int dst_width, int dst_height);
+
+#endif //RPI_LEDMATRIX_SERVER_RESAMPLE_H
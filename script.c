@@ -0,0 +1,281 @@
+//
+// Library of compiled command scripts, see script.h
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "script.h"
+
+#define SCRIPT_EXTENSION ".txt"
+
+void script_library_init(script_library_t * library){
+    memset(library, 0, sizeof(*library));
+    pthread_mutex_init(&library->mutex, NULL);
+}
+
+static void free_scripts(script_library_t * library){
+    script_t * script = library->first;
+    while (script != NULL){
+        script_t * next = script->next;
+        free(script->name);
+        free(script->code);
+        free(script);
+        script = next;
+    }
+    library->first = NULL;
+}
+
+void script_library_free(script_library_t * library){
+    free_scripts(library);
+    free(library->directory);
+    library->directory = NULL;
+    pthread_mutex_destroy(&library->mutex);
+}
+
+//names are file names without extension: letters, digits, '_', '-' and '.' (not first)
+static int valid_name(const char * name, size_t len){
+    size_t i;
+
+    if (len == 0 || len > SCRIPT_MAX_NAME || name[0] == '.') return 0;
+    for (i = 0; i < len; i++){
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.')) return 0;
+    }
+    return 1;
+}
+
+//removes comments, empty lines, indentation and trailing spaces, every command line ends with ';'
+static char * compile(const char * text, size_t len, size_t * length){
+    char * code = (char *) malloc(len + 2);
+    size_t pos = 0, out = 0;
+
+    if (code == NULL) return NULL;
+    while (pos < len){
+        size_t start, end;
+
+        while (pos < len && (text[pos] == ' ' || text[pos] == '\t')) pos++;
+        start = pos;
+        while (pos < len && text[pos] != '\n' && text[pos] != '\r') pos++;
+        end = pos;
+        while (pos < len && (text[pos] == '\n' || text[pos] == '\r')) pos++;
+
+        while (end > start && (text[end - 1] == ' ' || text[end - 1] == '\t')) end--;
+        if (end == start || text[start] == '#') continue;
+        memcpy(&code[out], &text[start], end - start);
+        out += end - start;
+        if (code[out - 1] != ';') code[out++] = ';';
+    }
+    code[out] = 0;
+    *length = out;
+    return code;
+}
+
+//(re)compiles the file of a script, returns 0 on success, -1 can't read the file, -2 out of memory
+static int compile_file(script_t * script, const char * path, const struct stat * st){
+    FILE * file = fopen(path, "rb");
+    char * text, * code;
+    size_t len;
+
+    if (file == NULL) return -1;
+    text = (char *) malloc(st->st_size + 1);
+    if (text == NULL){
+        fclose(file);
+        return -2;
+    }
+    len = fread(text, 1, st->st_size, file);
+    fclose(file);
+
+    code = compile(text, len, &len);
+    free(text);
+    if (code == NULL) return -2;
+
+    free(script->code);
+    script->code = code;
+    script->length = len;
+    script->modified = st->st_mtim;
+    script->size = st->st_size;
+    return 0;
+}
+
+//compiles a script if it is new or its file changed, returns 0 on success, -1 can't read the file, -2 out of memory
+static int update(script_library_t * library, script_t * script, const char * path, const struct stat * st){
+    int result;
+    if (script->code != NULL && script->modified.tv_sec == st->st_mtim.tv_sec && script->modified.tv_nsec == st->st_mtim.tv_nsec &&
+        script->size == st->st_size) return 0;
+    if ((result = compile_file(script, path, st)) == 0) script->version = ++library->compiles;
+    return result;
+}
+
+//returns the script and the script before it (NULL = first)
+static script_t * find(const script_library_t * library, const char * name, script_t ** prev){
+    script_t * script = library->first;
+    *prev = NULL;
+    while (script != NULL && strcmp(script->name, name) < 0){
+        *prev = script;
+        script = script->next;
+    }
+    return script != NULL && strcmp(script->name, name) == 0 ? script : NULL;
+}
+
+static script_t * add(script_library_t * library, const char * name, size_t len){
+    script_t * script = (script_t *) calloc(1, sizeof(script_t));
+    script_t * prev;
+
+    if (script == NULL) return NULL;
+    script->name = (char *) malloc(len + 1);
+    if (script->name == NULL){
+        free(script);
+        return NULL;
+    }
+    memcpy(script->name, name, len);
+    script->name[len] = 0;
+
+    find(library, script->name, &prev);
+    script->next = prev == NULL ? library->first : prev->next;
+    if (prev == NULL) library->first = script;
+    else prev->next = script;
+    return script;
+}
+
+static void remove_script(script_library_t * library, script_t * script, script_t * prev){
+    if (prev == NULL) library->first = script->next;
+    else prev->next = script->next;
+    free(script->name);
+    free(script->code);
+    free(script);
+}
+
+//returns a malloced file name of a script
+static char * script_path(const script_library_t * library, const char * name, size_t len){
+    char * path = (char *) malloc(strlen(library->directory) + len + strlen(SCRIPT_EXTENSION) + 2);
+    if (path != NULL) sprintf(path, "%s/%.*s%s", library->directory, (int) len, name, SCRIPT_EXTENSION);
+    return path;
+}
+
+int script_library_load(script_library_t * library, const char * directory){
+    DIR * dir;
+    struct dirent * entry;
+    script_t * script, * prev;
+    int count = 0, result = 0;
+
+    pthread_mutex_lock(&library->mutex);
+    if (library->directory == NULL || strcmp(library->directory, directory) != 0){
+        char * copy = strdup(directory);
+        if (copy == NULL){
+            pthread_mutex_unlock(&library->mutex);
+            return -2;
+        }
+        free_scripts(library);
+        free(library->directory);
+        library->directory = copy;
+    }
+
+    if ((dir = opendir(directory)) == NULL){
+        pthread_mutex_unlock(&library->mutex);
+        return -1;
+    }
+    for (script = library->first; script != NULL; script = script->next) script->found = 0;
+    while (result == 0 && (entry = readdir(dir)) != NULL){
+        size_t len = strlen(entry->d_name);
+        size_t ext = strlen(SCRIPT_EXTENSION);
+        struct stat st;
+        char * path;
+
+        if (len <= ext || strcmp(&entry->d_name[len - ext], SCRIPT_EXTENSION) != 0) continue;
+        len -= ext;
+        if (!valid_name(entry->d_name, len)) continue;
+        if ((path = script_path(library, entry->d_name, len)) == NULL){
+            result = -2;
+            break;
+        }
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode)){
+            char name[SCRIPT_MAX_NAME + 1];
+            memcpy(name, entry->d_name, len);
+            name[len] = 0;
+            if ((script = find(library, name, &prev)) == NULL) script = add(library, name, len);
+            if (script == NULL){
+                result = -2;
+            }else if (update(library, script, path, &st) == 0){
+                script->found = 1;
+                count++;
+            }else if (script->code != NULL){
+                script->found = 1; //keep the last version if the file can't be read now
+                count++;
+            }
+        }
+        free(path);
+    }
+    closedir(dir);
+
+    //remove the scripts of removed files
+    prev = NULL;
+    script = library->first;
+    while (result == 0 && script != NULL){
+        script_t * next = script->next;
+        if (!script->found) remove_script(library, script, prev);
+        else prev = script;
+        script = next;
+    }
+    pthread_mutex_unlock(&library->mutex);
+    return result == 0 ? count : result;
+}
+
+int script_get_code(script_library_t * library, const char * name, char ** buffer, int * size){
+    size_t len = strlen(name);
+    script_t * script, * prev;
+    struct stat st;
+    char * path;
+    int result = 0;
+
+    if (!valid_name(name, len)) return -1;
+    pthread_mutex_lock(&library->mutex);
+    if (library->directory == NULL){
+        pthread_mutex_unlock(&library->mutex);
+        return -1;
+    }
+    if ((path = script_path(library, name, len)) == NULL){
+        pthread_mutex_unlock(&library->mutex);
+        return -2;
+    }
+
+    script = find(library, name, &prev);
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)){
+        if (script != NULL) remove_script(library, script, prev); //the file was removed
+        result = -1;
+    }else{
+        if (script == NULL && (script = add(library, name, len)) == NULL) result = -2;
+        else if ((result = update(library, script, path, &st)) != 0){
+            find(library, name, &prev);
+            remove_script(library, script, prev);
+        }
+    }
+    free(path);
+
+    if (result == 0 && (size_t) *size <= script->length){
+        char * grown = (char *) realloc(*buffer, script->length + 1);
+        if (grown == NULL) result = -2;
+        else{
+            *buffer = grown;
+            *size = script->length + 1;
+        }
+    }
+    if (result == 0){
+        memcpy(*buffer, script->code, script->length + 1);
+        result = script->length;
+    }
+    pthread_mutex_unlock(&library->mutex);
+    return result;
+}
+
+unsigned int script_version(script_library_t * library, const char * name){
+    script_t * script, * prev;
+    unsigned int version = 0;
+
+    pthread_mutex_lock(&library->mutex);
+    if ((script = find(library, name, &prev)) != NULL) version = script->version;
+    pthread_mutex_unlock(&library->mutex);
+    return version;
+}
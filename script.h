@@ -0,0 +1,51 @@
+//
+// Library of command scripts (<name>.txt files in a directory) that are read and compiled once and started by name.
+// Compiling removes comments, empty lines and indentation and joins the commands with ';', the format of the thread buffer.
+// A script is compiled again when its file was changed.
+//
+
+#ifndef RPI_LEDMATRIX_SERVER_SCRIPT_H
+#define RPI_LEDMATRIX_SERVER_SCRIPT_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#define SCRIPT_MAX_NAME 64
+
+typedef struct script {
+    char * name;
+    char * code;            //compiled commands separated by ';'
+    size_t length;
+    struct timespec modified; //time and size of the file when it was compiled
+    off_t size;
+    unsigned int version;   //changes when the script is compiled again
+    int found;              //used while the directory is read
+    struct script * next;
+} script_t;
+
+typedef struct {
+    script_t * first;       //sorted by name
+    char * directory;       //NULL = no library
+    unsigned int compiles;  //number of compiled scripts, gives the versions
+    pthread_mutex_t mutex;
+} script_library_t;
+
+void script_library_init(script_library_t * library);
+
+void script_library_free(script_library_t * library);
+
+//compiles all scripts in directory, the scripts of a previous directory are removed
+//reading the same directory again only compiles the new and changed files and removes the scripts of removed files
+//returns the number of scripts, -1 if the directory can't be read, -2 out of memory
+int script_library_load(script_library_t * library, const char * directory);
+
+//copies the compiled commands of script name to *buffer (grown to *size if needed), a changed or new file is compiled first
+//returns the length of the commands, -1 not found, -2 out of memory
+int script_get_code(script_library_t * library, const char * name, char ** buffer, int * size);
+
+//returns the version of the compiled script name, 0 if it is not in the library
+unsigned int script_version(script_library_t * library, const char * name);
+
+#endif //RPI_LEDMATRIX_SERVER_SCRIPT_H
@@ -0,0 +1,360 @@
+//
+// Named snapshots of the leds, see snapshot.h
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "LEDS"
+#define SNAPSHOT_MAX_NAME 64
+
+//file: header followed by the leds of all channels (native byte order, the file is read back by the same machine)
+typedef struct {
+    char magic[4];
+    int32_t count[RPI_PWM_CHANNELS];
+} snapshot_header_t;
+
+void snapshot_store_init(snapshot_store_t * store, size_t budget){
+    memset(store, 0, sizeof(*store));
+    store->budget = budget;
+    pthread_mutex_init(&store->mutex, NULL);
+    pthread_cond_init(&store->cond, NULL);
+}
+
+//names become file names: letters, digits, '_', '-' and '.' (not first)
+static int valid_name(const char * name){
+    size_t i, len = strlen(name);
+
+    if (len == 0 || len > SNAPSHOT_MAX_NAME || name[0] == '.') return 0;
+    for (i = 0; i < len; i++){
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.')) return 0;
+    }
+    return 1;
+}
+
+//returns a malloced file name of a snapshot, NULL if there is no directory or out of memory
+static char * snapshot_path(const snapshot_store_t * store, const char * name){
+    char * path;
+
+    if (store->directory == NULL) return NULL;
+    path = (char *) malloc(strlen(store->directory) + strlen(name) + 7);
+    if (path != NULL) sprintf(path, "%s/%s.snap", store->directory, name);
+    return path;
+}
+
+static snapshot_t * find(snapshot_store_t * store, const char * name){
+    snapshot_t * snapshot;
+    for (snapshot = store->first; snapshot != NULL; snapshot = snapshot->next){
+        if (strcmp(snapshot->name, name) == 0) return snapshot;
+    }
+    return NULL;
+}
+
+static void unlink_entry(snapshot_store_t * store, snapshot_t * snapshot){
+    if (snapshot->prev) snapshot->prev->next = snapshot->next;
+    else store->first = snapshot->next;
+    if (snapshot->next) snapshot->next->prev = snapshot->prev;
+    else store->last = snapshot->prev;
+    snapshot->prev = snapshot->next = NULL;
+}
+
+static void link_first(snapshot_store_t * store, snapshot_t * snapshot){
+    snapshot->prev = NULL;
+    snapshot->next = store->first;
+    if (store->first) store->first->prev = snapshot;
+    store->first = snapshot;
+    if (store->last == NULL) store->last = snapshot;
+}
+
+static void remove_entry(snapshot_store_t * store, snapshot_t * snapshot){
+    unlink_entry(store, snapshot);
+    store->used -= snapshot->bytes;
+    free(snapshot->leds);
+    free(snapshot->name);
+    free(snapshot);
+}
+
+//drops snapshots that are safe on disk until bytes more fit in the budget, returns 1 if they fit
+static int make_room(snapshot_store_t * store, size_t bytes){
+    snapshot_t * snapshot = store->last;
+
+    while (snapshot != NULL && store->used + bytes > store->budget){
+        snapshot_t * prev = snapshot->prev;
+        if (snapshot->persist && !snapshot->dirty) remove_entry(store, snapshot);
+        snapshot = prev;
+    }
+    return store->used + bytes <= store->budget;
+}
+
+//adds an empty snapshot of bytes as most recently used, returns NULL if it doesn't fit or out of memory
+static snapshot_t * add_entry(snapshot_store_t * store, const char * name, size_t bytes){
+    snapshot_t * snapshot;
+
+    if (!make_room(store, bytes)) return NULL;
+    snapshot = (snapshot_t *) calloc(1, sizeof(snapshot_t));
+    if (snapshot == NULL) return NULL;
+    snapshot->name = strdup(name);
+    snapshot->leds = (ws2811_led_t *) malloc(bytes > 0 ? bytes : 1);
+    if (snapshot->name == NULL || snapshot->leds == NULL){
+        free(snapshot->name);
+        free(snapshot->leds);
+        free(snapshot);
+        return NULL;
+    }
+    snapshot->bytes = bytes;
+    store->used += bytes;
+    link_first(store, snapshot);
+    return snapshot;
+}
+
+//writes the snapshot to temp, it is renamed to the snapshot file afterwards
+//so a crash while writing doesn't leave a half written snapshot, returns 0 on success, -1 on error
+static int write_temp(const char * temp, const snapshot_header_t * header, const void * leds, size_t bytes){
+    FILE * file;
+    int ok;
+
+    if ((file = fopen(temp, "wb")) == NULL) return -1;
+    ok = fwrite(header, sizeof(*header), 1, file) == 1 && (bytes == 0 || fwrite(leds, bytes, 1, file) == 1);
+    ok = fclose(file) == 0 && ok;
+    if (!ok) unlink(temp);
+    return ok ? 0 : -1;
+}
+
+//writes pending snapshots, the data is copied so the store isn't locked while writing
+//the temp file is renamed with the store locked: a snapshot deleted or saved again while it was written is not replaced
+static void * snapshot_writer(void * arg){
+    snapshot_store_t * store = (snapshot_store_t *) arg;
+
+    pthread_mutex_lock(&store->mutex);
+    for (;;){
+        snapshot_header_t header;
+        snapshot_t * snapshot;
+        void * leds;
+        char * name, * path, * temp;
+        size_t bytes;
+        unsigned int version;
+        int chan, ok;
+
+        for (snapshot = store->first; snapshot != NULL && !snapshot->pending; snapshot = snapshot->next);
+        if (snapshot == NULL){
+            if (store->stop) break;
+            pthread_cond_wait(&store->cond, &store->mutex);
+            continue;
+        }
+
+        snapshot->pending = 0;
+        version = snapshot->version;
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++) header.count[chan] = snapshot->count[chan];
+        bytes = snapshot->bytes;
+        name = strdup(snapshot->name);
+        path = snapshot_path(store, snapshot->name);
+        temp = path != NULL ? (char *) malloc(strlen(path) + 5) : NULL;
+        leds = malloc(bytes > 0 ? bytes : 1);
+        if (name == NULL || temp == NULL || leds == NULL){
+            fprintf(stderr, "Out of memory while saving snapshot %s\n", snapshot->name);
+            free(name);
+            free(path);
+            free(temp);
+            free(leds);
+            continue;
+        }
+        memcpy(leds, snapshot->leds, bytes);
+        sprintf(temp, "%s.tmp", path);
+
+        pthread_mutex_unlock(&store->mutex);
+        ok = write_temp(temp, &header, leds, bytes) == 0;
+        free(leds);
+        pthread_mutex_lock(&store->mutex);
+
+        snapshot = find(store, name);
+        if (ok && (snapshot == NULL || snapshot->version != version)){
+            unlink(temp); //deleted or saved again while it was written
+        }else if (ok && rename(temp, path) == 0){
+            snapshot->dirty = 0;
+        }else{
+            //stays dirty so it is kept in memory, the next save of it tries again
+            if (ok) unlink(temp);
+            fprintf(stderr, "Error: can't write %s\n", path);
+        }
+        free(name);
+        free(path);
+        free(temp);
+    }
+    pthread_mutex_unlock(&store->mutex);
+    return NULL;
+}
+
+void snapshot_store_free(snapshot_store_t * store){
+    pthread_mutex_lock(&store->mutex);
+    store->stop = 1;
+    pthread_cond_signal(&store->cond);
+    pthread_mutex_unlock(&store->mutex);
+    if (store->writer_running) pthread_join(store->writer, NULL);
+
+    while (store->first != NULL) remove_entry(store, store->first);
+    free(store->directory);
+    pthread_cond_destroy(&store->cond);
+    pthread_mutex_destroy(&store->mutex);
+    memset(store, 0, sizeof(*store));
+}
+
+void snapshot_set_budget(snapshot_store_t * store, size_t budget){
+    pthread_mutex_lock(&store->mutex);
+    store->budget = budget;
+    make_room(store, 0);
+    pthread_mutex_unlock(&store->mutex);
+}
+
+int snapshot_set_directory(snapshot_store_t * store, const char * directory){
+    char * copy = NULL;
+
+    if (directory != NULL && *directory != 0){
+        if ((copy = strdup(directory)) == NULL) return -2;
+        if (mkdir(copy, 0755) != 0 && errno != EEXIST) fprintf(stderr, "Error: can't create %s\n", copy);
+    }
+    pthread_mutex_lock(&store->mutex);
+    free(store->directory);
+    store->directory = copy;
+    pthread_mutex_unlock(&store->mutex);
+    return 0;
+}
+
+int snapshot_save(snapshot_store_t * store, const char * name, const ws2811_t * ws2811, int persist){
+    snapshot_t * snapshot;
+    size_t bytes = 0, offset = 0;
+    int chan;
+
+    if (!valid_name(name)) return -1;
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++){
+        if (ws2811->channel[chan].leds != NULL) bytes += sizeof(ws2811_led_t) * ws2811->channel[chan].count;
+    }
+
+    pthread_mutex_lock(&store->mutex);
+    if (persist && store->directory == NULL){
+        pthread_mutex_unlock(&store->mutex);
+        return -3;
+    }
+    snapshot = find(store, name);
+    if (snapshot != NULL && snapshot->bytes != bytes){
+        remove_entry(store, snapshot);
+        snapshot = NULL;
+    }
+    if (snapshot == NULL){
+        if ((snapshot = add_entry(store, name, bytes)) == NULL){
+            pthread_mutex_unlock(&store->mutex);
+            return -2;
+        }
+    }else{
+        unlink_entry(store, snapshot);
+        link_first(store, snapshot);
+    }
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++){
+        const ws2811_channel_t * channel = &ws2811->channel[chan];
+        snapshot->count[chan] = channel->leds != NULL ? channel->count : 0;
+        memcpy(&snapshot->leds[offset], channel->leds, sizeof(ws2811_led_t) * snapshot->count[chan]);
+        offset += snapshot->count[chan];
+    }
+    snapshot->persist = persist;
+    snapshot->dirty = persist;
+    snapshot->pending = persist;
+    snapshot->version = ++store->versions;
+
+    if (persist){
+        if (!store->writer_running){
+            store->writer_running = pthread_create(&store->writer, NULL, snapshot_writer, store) == 0;
+        }
+        pthread_cond_signal(&store->cond);
+    }
+    pthread_mutex_unlock(&store->mutex);
+    return 0;
+}
+
+//loads a snapshot from the directory into the store, returns NULL if there is none
+static snapshot_t * load_entry(snapshot_store_t * store, const char * name){
+    snapshot_header_t header;
+    snapshot_t * snapshot = NULL;
+    char * path = snapshot_path(store, name);
+    FILE * file;
+    long bytes = 0;
+    int chan;
+
+    if (path == NULL) return NULL;
+    file = fopen(path, "rb");
+    free(path);
+    if (file == NULL) return NULL;
+
+    if (fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0){
+        for (chan = 0; chan < RPI_PWM_CHANNELS && header.count[chan] >= 0 && header.count[chan] <= 0x100000; chan++){
+            bytes += sizeof(ws2811_led_t) * header.count[chan];
+        }
+        if (chan == RPI_PWM_CHANNELS && (snapshot = add_entry(store, name, bytes)) != NULL){
+            if (bytes > 0 && fread(snapshot->leds, bytes, 1, file) != 1){
+                remove_entry(store, snapshot);
+                snapshot = NULL;
+            }else{
+                for (chan = 0; chan < RPI_PWM_CHANNELS; chan++) snapshot->count[chan] = header.count[chan];
+                snapshot->persist = 1;
+            }
+        }
+    }
+    fclose(file);
+    return snapshot;
+}
+
+int snapshot_recall(snapshot_store_t * store, const char * name, ws2811_t * ws2811){
+    snapshot_t * snapshot;
+    size_t offset = 0;
+    int chan, ret = 0;
+
+    if (!valid_name(name)) return -1;
+    pthread_mutex_lock(&store->mutex);
+    snapshot = find(store, name);
+    if (snapshot == NULL) snapshot = load_entry(store, name);
+    if (snapshot == NULL){
+        pthread_mutex_unlock(&store->mutex);
+        return -1;
+    }
+    unlink_entry(store, snapshot);
+    link_first(store, snapshot);
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++){
+        ws2811_channel_t * channel = &ws2811->channel[chan];
+        if (snapshot->count[chan] == 0) continue;
+        if (channel->leds != NULL && channel->count == snapshot->count[chan]){
+            memcpy(channel->leds, &snapshot->leds[offset], sizeof(ws2811_led_t) * snapshot->count[chan]);
+        }else{
+            ret = -2;
+        }
+        offset += snapshot->count[chan];
+    }
+    pthread_mutex_unlock(&store->mutex);
+    return ret;
+}
+
+int snapshot_delete(snapshot_store_t * store, const char * name){
+    snapshot_t * snapshot;
+    char * path;
+    int ret = -1;
+
+    if (!valid_name(name)) return -1;
+    pthread_mutex_lock(&store->mutex);
+    if ((snapshot = find(store, name)) != NULL){
+        remove_entry(store, snapshot);
+        ret = 0;
+    }
+    if ((path = snapshot_path(store, name)) != NULL){
+        if (unlink(path) == 0) ret = 0;
+        free(path);
+    }
+    pthread_mutex_unlock(&store->mutex);
+    return ret;
+}
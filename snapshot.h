@@ -0,0 +1,65 @@
+//
+// Named snapshots of the leds (color and brightness of all channels) kept in memory, a recall is a memcpy per channel.
+// Snapshots can be written to a directory by a background thread so they survive a restart,
+// a snapshot that is not in memory is loaded from there when it is recalled.
+//
+
+#ifndef RPI_LEDMATRIX_SERVER_SNAPSHOT_H
+#define RPI_LEDMATRIX_SERVER_SNAPSHOT_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include "ws2811.h"
+
+typedef struct snapshot {
+    char * name;
+    int count[RPI_PWM_CHANNELS];    //number of leds of every channel
+    ws2811_led_t * leds;            //leds of all channels after each other
+    size_t bytes;
+    int persist;                    //1 = the snapshot is (or will be) written to the directory
+    int dirty;                      //1 = not in the directory yet, it can't be dropped from memory
+    int pending;                    //1 = the writer still has to start writing it
+    unsigned int version;           //changes with every save, a write of an older save is not renamed
+    struct snapshot * prev;         //more recently used
+    struct snapshot * next;         //less recently used
+} snapshot_t;
+
+typedef struct {
+    snapshot_t * first;             //most recently used
+    snapshot_t * last;              //least recently used
+    size_t used;                    //bytes of led data
+    size_t budget;                  //maximum bytes of led data
+    char * directory;               //where snapshots are written, NULL = only in memory
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t writer;
+    int writer_running;
+    int stop;
+    unsigned int versions;          //last version given to a snapshot
+} snapshot_store_t;
+
+void snapshot_store_init(snapshot_store_t * store, size_t budget);
+
+//writes all pending snapshots, stops the writer and frees all snapshots
+void snapshot_store_free(snapshot_store_t * store);
+
+//changes the memory budget, snapshots that are saved on disk are dropped (least recently used first) until it fits
+void snapshot_set_budget(snapshot_store_t * store, size_t budget);
+
+//sets the directory for persistent snapshots, NULL to keep snapshots only in memory
+//returns 0 on success, -2 out of memory
+int snapshot_set_directory(snapshot_store_t * store, const char * directory);
+
+//stores the leds of all channels as name, replaces an older snapshot with this name
+//persist = 1 also writes it to the directory in the background
+//returns 0 on success, -1 invalid name, -2 out of memory or over budget, -3 persist without directory
+int snapshot_save(snapshot_store_t * store, const char * name, const ws2811_t * ws2811, int persist);
+
+//copies the leds of snapshot name back to all channels that still have the same number of leds
+//returns 0 on success, -1 not found, -2 a channel has another number of leds now (it is not changed)
+int snapshot_recall(snapshot_store_t * store, const char * name, ws2811_t * ws2811);
+
+//removes a snapshot from memory and from the directory, returns 0 on success, -1 not found
+int snapshot_delete(snapshot_store_t * store, const char * name);
+
+#endif //RPI_LEDMATRIX_SERVER_SNAPSHOT_H
@@ -0,0 +1,127 @@
+//
+// Bulk operations on spans of leds, see span.h
+//
+
+#include "span.h"
+
+static void span_set(ws2811_led_t * leds, int count, uint32_t color){
+    int i;
+    for (i = 0; i < count; i++) leds[i].color = color;
+}
+
+static void span_or(ws2811_led_t * leds, int count, uint32_t color){
+    int i;
+    for (i = 0; i < count; i++) leds[i].color |= color;
+}
+
+static void span_and(ws2811_led_t * leds, int count, uint32_t color){
+    int i;
+    for (i = 0; i < count; i++) leds[i].color &= color;
+}
+
+static void span_xor(ws2811_led_t * leds, int count, uint32_t color){
+    int i;
+    for (i = 0; i < count; i++) leds[i].color ^= color;
+}
+
+//NOT is XOR with all bits set
+void span_fill(ws2811_led_t * leds, int count, int op, uint32_t color){
+    switch (op){
+        case SPAN_OP_SET:
+            span_set(leds, count, color);
+            break;
+        case SPAN_OP_OR:
+            span_or(leds, count, color);
+            break;
+        case SPAN_OP_AND:
+            span_and(leds, count, color);
+            break;
+        case SPAN_OP_XOR:
+            span_xor(leds, count, color);
+            break;
+        case SPAN_OP_NOT:
+            span_xor(leds, count, 0xFFFFFFFF);
+            break;
+        case SPAN_OP_ADD:
+            span_add(leds, count, color);
+            break;
+    }
+}
+
+void span_set_component(ws2811_led_t * leds, int count, int component, unsigned int value){
+    int i;
+
+    if (component == SPAN_BRIGHTNESS){
+        for (i = 0; i < count; i++) leds[i].brightness = value;
+    }else{
+        uint32_t mask = ~((uint32_t) 0xFF << component);
+        uint32_t bits = (uint32_t) (value & 0xFF) << component;
+        for (i = 0; i < count; i++) leds[i].color = (leds[i].color & mask) | bits;
+    }
+}
+
+//levels are 16.16 fixed point, every led gets the integer part. The step is rounded up, so a level is never
+//below the exact value and up to 256 leds get exactly start + (end - start) * i / (count - 1)
+void span_ramp(ws2811_led_t * leds, int count, int component, int start, int end){
+    int32_t step, level = start * 65536;
+    int i;
+
+    if (count <= 0) return;
+    if (count == 1){
+        span_set_component(leds, 1, component, end);
+        return;
+    }
+    step = (end - start) * 65536;
+    step = step > 0 ? (step + count - 2) / (count - 1) : step / (count - 1);
+    count--; //last led gets exactly end
+
+    if (component == SPAN_BRIGHTNESS){
+        for (i = 0; i < count; i++) leds[i].brightness = (uint32_t) (level + i * step) >> 16;
+    }else{
+        uint32_t mask = ~((uint32_t) 0xFF << component);
+        for (i = 0; i < count; i++) leds[i].color = (leds[i].color & mask) | ((((uint32_t) (level + i * step) >> 16) & 0xFF) << component);
+    }
+    span_set_component(&leds[count], 1, component, end);
+}
+
+//2 components are multiplied at once: red and blue, then green and white
+void span_scale(ws2811_led_t * leds, int count, unsigned int scale){
+    int i;
+
+    if (scale > 256) scale = 256;
+    for (i = 0; i < count; i++){
+        uint32_t c = leds[i].color;
+        uint32_t rb = ((c & 0x00FF00FF) * scale >> 8) & 0x00FF00FF;
+        uint32_t gw = (((c >> 8) & 0x00FF00FF) * scale) & 0xFF00FF00;
+        leds[i].color = rb | gw;
+    }
+}
+
+//the carries out of every component are turned into a mask of 0xFF for the components that overflow
+void span_add(ws2811_led_t * leds, int count, uint32_t color){
+    int i;
+
+    for (i = 0; i < count; i++){
+        uint32_t c = leds[i].color;
+        uint32_t sum = (c & 0x7F7F7F7F) + (color & 0x7F7F7F7F);
+        uint32_t carry = ((c & color) | ((c | color) & sum)) & 0x80808080;
+        sum ^= (c ^ color) & 0x80808080;
+        leds[i].color = sum | ((carry >> 7) * 0xFF);
+    }
+}
+
+void span_copy_colors(ws2811_led_t * leds, int count, const uint32_t * colors, uint32_t mask){
+    int i;
+    for (i = 0; i < count; i++) leds[i].color = colors[i] & mask;
+}
+
+void span_copy_component(ws2811_led_t * leds, int count, int component, const uint32_t * values){
+    int i;
+
+    if (component == SPAN_BRIGHTNESS){
+        for (i = 0; i < count; i++) leds[i].brightness = values[i] & 0xFF;
+    }else{
+        uint32_t mask = ~((uint32_t) 0xFF << component);
+        for (i = 0; i < count; i++) leds[i].color = (leds[i].color & mask) | ((values[i] & 0xFF) << component);
+    }
+}
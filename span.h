@@ -0,0 +1,50 @@
+//
+// Bulk operations on spans of consecutive leds.
+// The operation is selected once for the whole span, every kernel is a simple loop without branches per led,
+// so the compiler can vectorize it (span.c is compiled with -O3).
+// Colors are 4 independent 8 bit components (0xWWBBGGRR), the brightness of a led is 0-255.
+//
+
+#ifndef RPI_LEDMATRIX_SERVER_SPAN_H
+#define RPI_LEDMATRIX_SERVER_SPAN_H
+
+#include <stdint.h>
+#include "ws2811.h"
+
+//operations of span_fill, same values as the OR, AND, XOR, NOT, = argument of the commands
+#define SPAN_OP_SET 0
+#define SPAN_OP_OR 1
+#define SPAN_OP_AND 2
+#define SPAN_OP_XOR 3
+#define SPAN_OP_NOT 4   //inverts the colors, color is not used
+#define SPAN_OP_ADD 5   //adds color, every component saturates at 255
+
+//components of span_set_component and span_ramp, the shift of the component in the color
+#define SPAN_RED 0
+#define SPAN_GREEN 8
+#define SPAN_BLUE 16
+#define SPAN_WHITE 24
+#define SPAN_BRIGHTNESS 32
+
+//applies the operation with color to the colors of count leds
+void span_fill(ws2811_led_t * leds, int count, int op, uint32_t color);
+
+//sets one component (SPAN_RED...SPAN_BRIGHTNESS) of count leds to value
+void span_set_component(ws2811_led_t * leds, int count, int component, unsigned int value);
+
+//sets one component of count leds to a linear ramp from start to end (the last led gets end)
+void span_ramp(ws2811_led_t * leds, int count, int component, int start, int end);
+
+//scales all color components of count leds by scale/256 (0-256)
+void span_scale(ws2811_led_t * leds, int count, unsigned int scale);
+
+//adds color to the colors of count leds, every component saturates at 255
+void span_add(ws2811_led_t * leds, int count, uint32_t color);
+
+//sets the colors of count leds to colors & mask
+void span_copy_colors(ws2811_led_t * leds, int count, const uint32_t * colors, uint32_t mask);
+
+//sets one component (SPAN_RED...SPAN_BRIGHTNESS) of count leds to the low byte of values
+void span_copy_component(ws2811_led_t * leds, int count, int component, const uint32_t * values);
+
+#endif //RPI_LEDMATRIX_SERVER_SPAN_H
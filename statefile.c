@@ -0,0 +1,130 @@
+//
+// Binary led state files, see statefile.h
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "statefile.h"
+
+static inline uint32_t read_le32(const uint8_t * p){
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline void write_le(uint8_t * p, uint32_t value, int bytes){
+    while (bytes-- > 0){
+        *p++ = value & 0xFF;
+        value >>= 8;
+    }
+}
+
+static uint32_t checksum(const uint8_t * data, size_t len){
+    uint32_t hash = 2166136261u; //FNV-1a
+    size_t i;
+    for (i = 0; i < len; i++) hash = (hash ^ data[i]) * 16777619u;
+    return hash;
+}
+
+int state_file_save(const char * filename, const ws2811_led_t * leds, unsigned int count, unsigned int start,
+                    const ws2811_channel_t * channel, int width, int height){
+    size_t size = STATE_FILE_HEADER_SIZE + (size_t) count * 5;
+    uint8_t * data = (uint8_t *) calloc(1, size);
+    uint8_t * colors = data + STATE_FILE_HEADER_SIZE;
+    uint8_t * brightness = colors + (size_t) count * 4;
+    FILE * file;
+    unsigned int i;
+    int ok;
+
+    if (data == NULL) return -2;
+    for (i = 0; i < count; i++){
+        write_le(&colors[i * 4], leds[i].color, 4);
+        brightness[i] = leds[i].brightness;
+    }
+    memcpy(data, STATE_FILE_MAGIC, 4);
+    write_le(data + 4, STATE_FILE_VERSION, 2);
+    data[6] = channel->color_size;
+    write_le(data + 8, channel->strip_type, 4);
+    write_le(data + 12, width, 2);
+    write_le(data + 14, height, 2);
+    write_le(data + 16, count, 4);
+    write_le(data + 20, start, 4);
+    write_le(data + 24, checksum(colors, (size_t) count * 5), 4);
+
+    if ((file = fopen(filename, "wb")) == NULL){
+        free(data);
+        return -1;
+    }
+    ok = fwrite(data, size, 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    free(data);
+    return ok ? 0 : -1;
+}
+
+int state_file_open(state_file_t * state, const char * filename){
+    struct stat st;
+    const uint8_t * header;
+    int fd;
+
+    memset(state, 0, sizeof(state_file_t));
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0){
+        close(fd);
+        return -1;
+    }
+    if (st.st_size < STATE_FILE_HEADER_SIZE){
+        close(fd);
+        return -3;
+    }
+    state->map_size = st.st_size;
+    state->map = mmap(NULL, state->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); //the mapping keeps the file open
+    if (state->map == MAP_FAILED){
+        state->map = NULL;
+        return -1;
+    }
+
+    header = (const uint8_t *) state->map;
+    if (memcmp(header, STATE_FILE_MAGIC, 4) != 0){
+        state_file_close(state);
+        return -3;
+    }
+    state->version = header[4] | (header[5] << 8);
+    state->color_size = header[6];
+    state->strip_type = read_le32(header + 8);
+    state->width = header[12] | (header[13] << 8);
+    state->height = header[14] | (header[15] << 8);
+    state->count = read_le32(header + 16);
+    state->start = read_le32(header + 20);
+    state->colors = header + STATE_FILE_HEADER_SIZE;
+    state->brightness = state->colors + (size_t) state->count * 4;
+
+    if (state->version != STATE_FILE_VERSION || state->count > (state->map_size - STATE_FILE_HEADER_SIZE) / 5 ||
+        checksum(state->colors, (size_t) state->count * 5) != read_le32(header + 24)){
+        state_file_close(state);
+        return -4;
+    }
+    return 0;
+}
+
+void state_file_close(state_file_t * state){
+    if (state->map != NULL) munmap(state->map, state->map_size);
+    state->map = NULL;
+    state->colors = NULL;
+    state->brightness = NULL;
+    state->count = 0;
+}
+
+void state_file_to_leds(const state_file_t * state, ws2811_led_t * leds, unsigned int count){
+    unsigned int i;
+
+    if (count > state->count) count = state->count;
+    for (i = 0; i < count; i++){
+        leds[i].color = read_le32(&state->colors[i * 4]);
+        leds[i].brightness = state->brightness[i];
+    }
+}
@@ -0,0 +1,58 @@
+//
+// Binary led state files written by save_state: a 32 byte header followed by the colors and the brightness of the leds.
+// The file is memory mapped when it is loaded, the leds are copied without parsing.
+//
+// header (little endian):
+//   char     magic[4]      "LSTA"
+//   uint16_t version       STATE_FILE_VERSION
+//   uint8_t  color_size    3 = RGB, 4 = RGBW channel
+//   uint8_t  reserved      0
+//   uint32_t strip_type    WS2811_STRIP_* of the channel
+//   uint16_t width         size of the matrix
+//   uint16_t height
+//   uint32_t count         number of leds in the file
+//   uint32_t start         index of the first led that was saved
+//   uint32_t checksum      FNV-1a of the colors and brightness that follow
+//   uint32_t reserved      0
+// followed by uint32_t colors[count] (0xWWBBGGRR) and uint8_t brightness[count]
+//
+
+#ifndef RPI_LEDMATRIX_SERVER_STATEFILE_H
+#define RPI_LEDMATRIX_SERVER_STATEFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ws2811.h"
+
+#define STATE_FILE_MAGIC "LSTA"
+#define STATE_FILE_VERSION 1
+#define STATE_FILE_HEADER_SIZE 32
+
+typedef struct {
+    int version;
+    int color_size;
+    uint32_t strip_type;
+    int width;
+    int height;
+    unsigned int count;
+    unsigned int start;
+    const uint8_t * colors;
+    const uint8_t * brightness;
+    void * map;
+    size_t map_size;
+} state_file_t;
+
+//writes count leds, returns 0 on success, -1 if the file can't be written, -2 out of memory
+int state_file_save(const char * filename, const ws2811_led_t * leds, unsigned int count, unsigned int start,
+                    const ws2811_channel_t * channel, int width, int height);
+
+//maps a state file and checks it, returns 0 on success, -1 if the file can't be read,
+//-3 if it is not a binary state file (a text file of older versions), -4 if it is damaged or of a newer version
+int state_file_open(state_file_t * state, const char * filename);
+
+void state_file_close(state_file_t * state);
+
+//copies the first count leds of the file (at most state->count) to leds
+void state_file_to_leds(const state_file_t * state, ws2811_led_t * leds, unsigned int count);
+
+#endif //RPI_LEDMATRIX_SERVER_STATEFILE_H
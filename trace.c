@@ -0,0 +1,192 @@
+//
+// Per thread trace rings and their Chrome trace JSON output, see trace.h
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "trace.h"
+
+typedef struct trace_ring {
+    trace_event_t events[TRACE_RING_SIZE];
+    uint32_t head;                  //number of events written, only changed by the owner
+    int tid;                        //thread that owns the ring
+    volatile int in_use;            //0 after the thread ended, the ring is used by the next new thread
+    struct trace_ring * next;
+} trace_ring_t;
+
+volatile int trace_enabled = 0;
+
+static __thread trace_ring_t * thread_ring = NULL;
+static trace_ring_t * rings = NULL;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER; //the list of rings and the trace file
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static uint64_t start_time = 0;     //events before the last start are not written
+static char * trace_file = NULL;
+
+static uint64_t now_ns(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void release_ring(void * ring){
+    ((trace_ring_t *) ring)->in_use = 0;
+}
+
+static void create_ring_key(){
+    pthread_key_create(&ring_key, release_ring);
+}
+
+//gives the calling thread a ring: the ring of an ended thread or a new one, NULL = out of memory
+static trace_ring_t * take_ring(){
+    trace_ring_t * ring;
+
+    pthread_once(&ring_key_once, create_ring_key);
+    pthread_mutex_lock(&rings_mutex);
+    for (ring = rings; ring != NULL && ring->in_use; ring = ring->next);
+    if (ring == NULL && (ring = (trace_ring_t *) calloc(1, sizeof(trace_ring_t))) != NULL){
+        ring->next = rings;
+        rings = ring;
+    }
+    if (ring != NULL){
+        ring->in_use = 1;
+        ring->tid = (int) syscall(SYS_gettid);
+    }
+    pthread_mutex_unlock(&rings_mutex);
+    if (ring != NULL) pthread_setspecific(ring_key, ring);
+    thread_ring = ring;
+    return ring;
+}
+
+void trace_event(char phase, const char * name, int arg){
+    trace_ring_t * ring = thread_ring;
+    trace_event_t * event;
+    int i = 0;
+
+    if (ring == NULL && (ring = take_ring()) == NULL) return;
+    event = &ring->events[ring->head & (TRACE_RING_SIZE - 1)];
+    event->time = now_ns();
+    event->tid = ring->tid;
+    event->arg = arg;
+    event->phase = phase;
+    if (name != NULL) for (; i < TRACE_MAX_NAME && name[i] != 0; i++) event->name[i] = name[i];
+    if (i < TRACE_MAX_NAME) event->name[i] = 0;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE); //the event is complete before it is counted
+}
+
+#ifdef USE_TRACE
+static void * signal_thread(void * arg){
+    sigset_t signals;
+    int number;
+
+    (void) arg;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    while (sigwait(&signals, &number) == 0){
+        int count = trace_dump(NULL);
+        if (count < 0) fprintf(stderr, "Error: can't write the trace file\n");
+        else printf("Trace with %d events written.\n", count);
+    }
+    return NULL;
+}
+#endif
+
+int trace_init(){
+#ifdef USE_TRACE
+    sigset_t signals;
+    pthread_t thread;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL); //inherited by all threads, only signal_thread receives it
+    if (pthread_create(&thread, NULL, signal_thread, NULL) != 0) return -1;
+    pthread_detach(thread);
+#endif
+    return 0;
+}
+
+int trace_set(int enabled, const char * filename){
+#ifdef USE_TRACE
+    pthread_mutex_lock(&rings_mutex);
+    if (filename != NULL && filename[0] != 0){
+        free(trace_file);
+        trace_file = strdup(filename);
+    }
+    if (enabled && !trace_enabled) start_time = now_ns();
+    trace_enabled = enabled;
+    pthread_mutex_unlock(&rings_mutex);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+//writes a name as JSON string, characters that would need escaping are replaced
+static void write_name(FILE * file, const char * name){
+    int i;
+    fputc('"', file);
+    for (i = 0; i < TRACE_MAX_NAME && name[i] != 0; i++){
+        char c = name[i];
+        fputc(c < ' ' || c == '"' || c == '\\' ? '?' : c, file);
+    }
+    fputc('"', file);
+}
+
+//writes the events of a ring that are still in it after they were copied, returns the number of events
+static int write_ring(FILE * file, trace_ring_t * ring, trace_event_t * copy, int pid, int * first){
+    uint32_t end = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t begin = end > TRACE_RING_SIZE ? end - TRACE_RING_SIZE : 0;
+    uint32_t index, written;
+    int count = 0;
+
+    for (index = begin; index != end; index++) copy[index - begin] = ring->events[index & (TRACE_RING_SIZE - 1)];
+    //the owner can have overwritten the oldest events while they were copied, and it can be in the middle of
+    //writing the next event (not counted yet) into the slot of the oldest one
+    written = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    for (index = written + 1 > TRACE_RING_SIZE && written + 1 - TRACE_RING_SIZE > begin ? written + 1 - TRACE_RING_SIZE : begin; index < end; index++){
+        const trace_event_t * event = &copy[index - begin];
+        if (event->time < start_time) continue;
+        fprintf(file, "%s{\"name\":", *first ? "" : ",\n");
+        write_name(file, event->phase == 'E' ? "" : event->name);
+        fprintf(file, ",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%d", event->phase,
+                (unsigned long long) (event->time / 1000), (unsigned int) (event->time % 1000), pid, event->tid);
+        if (event->phase == 'i') fprintf(file, ",\"s\":\"t\"");
+        if (event->arg >= 0) fprintf(file, ",\"args\":{\"arg\":%d}", event->arg);
+        fputc('}', file);
+        *first = 0;
+        count++;
+    }
+    return count;
+}
+
+int trace_dump(const char * filename){
+    trace_event_t * copy = (trace_event_t *) malloc(sizeof(trace_event_t) * TRACE_RING_SIZE);
+    trace_ring_t * ring;
+    FILE * file;
+    int pid = getpid(), first = 1, count = 0;
+
+    if (copy == NULL) return -1;
+    pthread_mutex_lock(&rings_mutex);
+    if (filename == NULL || filename[0] == 0) filename = trace_file != NULL ? trace_file : TRACE_DEFAULT_FILE;
+    if ((file = fopen(filename, "w")) == NULL){
+        pthread_mutex_unlock(&rings_mutex);
+        free(copy);
+        return -1;
+    }
+    fprintf(file, "{\"traceEvents\":[\n");
+    for (ring = rings; ring != NULL; ring = ring->next) count += write_ring(file, ring, copy, pid, &first);
+    fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"main\"}}\n",
+            first ? "" : ",\n", pid, pid);
+    fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+    pthread_mutex_unlock(&rings_mutex);
+    free(copy);
+    if (fclose(file) != 0) return -1;
+    return count;
+}
@@ -0,0 +1,55 @@
+//
+// Timeline of commands and frames for finding stutters: every thread records timestamped events in its own ring buffer
+// (no locks, the oldest events are overwritten), the rings are written in the Chrome trace JSON format
+// (chrome://tracing, ui.perfetto.dev) on SIGUSR1 or with the trace_dump command.
+// Without USE_TRACE the TRACE_* macros are empty, with USE_TRACE they cost a test of trace_enabled while not recording.
+//
+
+#ifndef RPI_LEDMATRIX_SERVER_TRACE_H
+#define RPI_LEDMATRIX_SERVER_TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_RING_SIZE 8192        //events per thread, power of 2
+#define TRACE_MAX_NAME 15           //longer names are cut
+#define TRACE_DEFAULT_FILE "/tmp/ws2812svr_trace.json"
+
+typedef struct {
+    uint64_t time;                  //ns, CLOCK_MONOTONIC
+    int tid;
+    int arg;                        //-1 = no argument
+    char phase;                     //'B' begin, 'E' end, 'i' instant
+    char name[TRACE_MAX_NAME];      //not 0 terminated if the name has TRACE_MAX_NAME characters
+} trace_event_t;
+
+extern volatile int trace_enabled;
+
+#ifdef USE_TRACE
+#define TRACE_BEGIN(name) do { if (trace_enabled) trace_event('B', name, -1); } while (0)
+#define TRACE_BEGIN_ARG(name, arg) do { if (trace_enabled) trace_event('B', name, arg); } while (0)
+#define TRACE_END() do { if (trace_enabled) trace_event('E', NULL, -1); } while (0)
+#define TRACE_INSTANT(name) do { if (trace_enabled) trace_event('i', name, -1); } while (0)
+#else
+#define TRACE_BEGIN(name) ((void) 0)
+#define TRACE_BEGIN_ARG(name, arg) ((void) 0)
+#define TRACE_END() ((void) 0)
+#define TRACE_INSTANT(name) ((void) 0)
+#endif
+
+//records an event in the ring of the calling thread, an 'E' event ends the last 'B' event of the thread
+void trace_event(char phase, const char * name, int arg);
+
+//blocks SIGUSR1 in the calling thread and starts the thread that writes the trace on SIGUSR1,
+//must be called before other threads are started, returns 0 on success, -1 if the thread can't be started
+int trace_init();
+
+//starts (enabled = 1) or stops recording, starting removes the recorded events
+//filename = file written on SIGUSR1, NULL = keep the file (default TRACE_DEFAULT_FILE)
+//returns 0 on success, -1 if tracing is not compiled in
+int trace_set(int enabled, const char * filename);
+
+//writes the recorded events of all threads to filename (NULL = file of trace_set) in the Chrome trace JSON format
+//returns the number of events, -1 if the file can't be written
+int trace_dump(const char * filename);
+
+#endif //RPI_LEDMATRIX_SERVER_TRACE_H
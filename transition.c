@@ -0,0 +1,142 @@
+//
+// Transitions between two frames, see transition.h
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "transition.h"
+
+int transition_type(const char * name){
+    if (strcmp(name, "crossfade")==0) return TRANSITION_CROSSFADE;
+    if (strcmp(name, "wipe")==0) return TRANSITION_WIPE;
+    if (strcmp(name, "slide")==0) return TRANSITION_SLIDE;
+    if (strcmp(name, "dissolve")==0) return TRANSITION_DISSOLVE;
+    if (*name >= '0' && *name <= '9' && atoi(name) <= TRANSITION_DISSOLVE) return atoi(name);
+    return -1;
+}
+
+//smoothstep: starts and ends slowly, in 16.16 fixed point
+static uint32_t ease(uint32_t t){
+    uint64_t t2 = (uint64_t) t * t >> 16;
+    return (uint32_t) (t2 * (3 * 65536 - 2 * (uint64_t) t) >> 16);
+}
+
+int transition_start(transition_t * transition, int type, const ws2811_led_t * leds, int count,
+                     const led_layout_t * layout, int frames, prng_t * prng){
+    int i;
+
+    memset(transition, 0, sizeof(*transition));
+    if (type < TRANSITION_CROSSFADE || type > TRANSITION_DISSOLVE || count <= 0) return -1;
+    if ((type == TRANSITION_WIPE || type == TRANSITION_SLIDE) &&
+        (layout == NULL || layout->index == NULL || layout->width * layout->height != count)) return -1;
+    if (frames < 1) frames = 1;
+
+    transition->from = (ws2811_led_t *) malloc(sizeof(ws2811_led_t) * count);
+    transition->to = (ws2811_led_t *) malloc(sizeof(ws2811_led_t) * count);
+    transition->progress = (uint32_t *) malloc(sizeof(uint32_t) * (frames + 1));
+    if (type == TRANSITION_WIPE || type == TRANSITION_DISSOLVE){
+        transition->keys = (uint32_t *) malloc(sizeof(uint32_t) * count);
+    }
+    if (transition->from == NULL || transition->to == NULL || transition->progress == NULL ||
+        ((type == TRANSITION_WIPE || type == TRANSITION_DISSOLVE) && transition->keys == NULL)){
+        transition_free(transition);
+        return -2;
+    }
+
+    transition->type = type;
+    transition->count = count;
+    transition->frames = frames;
+    transition->layout = layout;
+    memcpy(transition->from, leds, sizeof(ws2811_led_t) * count);
+    memcpy(transition->to, leds, sizeof(ws2811_led_t) * count);
+
+    for (i = 0; i <= frames; i++){
+        transition->progress[i] = ease((uint32_t) ((uint64_t) i * 65536 / frames));
+    }
+    transition->progress[frames] = 65536;
+
+    if (type == TRANSITION_WIPE){
+        //leds switch column by column
+        for (i = 0; i < count; i++) transition->keys[i] = layout->led_x[i];
+        transition->key_count = layout->width;
+    }else if (type == TRANSITION_DISSOLVE){
+        //random order: shuffled led numbers (Fisher-Yates)
+        for (i = 0; i < count; i++) transition->keys[i] = i;
+        for (i = count - 1; i > 0; i--){
+            int j = prng_range(prng, i + 1);
+            uint32_t key = transition->keys[i];
+            transition->keys[i] = transition->keys[j];
+            transition->keys[j] = key;
+        }
+        transition->key_count = count;
+    }
+    return 0;
+}
+
+void transition_set_target(transition_t * transition, const ws2811_led_t * leds){
+    if (transition->to != NULL) memcpy(transition->to, leds, sizeof(ws2811_led_t) * transition->count);
+}
+
+//2 components are blended at once: red and blue, then green and white. A lane holds at most 255*256.
+static void crossfade(ws2811_led_t * leds, const ws2811_led_t * from, const ws2811_led_t * to, int count, uint32_t weight){
+    uint32_t inverse = 256 - weight;
+    int i;
+
+    for (i = 0; i < count; i++){
+        uint32_t a = from[i].color, b = to[i].color;
+        uint32_t rb = (((a & 0x00FF00FF) * inverse + (b & 0x00FF00FF) * weight) >> 8) & 0x00FF00FF;
+        uint32_t gw = (((a >> 8) & 0x00FF00FF) * inverse + ((b >> 8) & 0x00FF00FF) * weight) & 0xFF00FF00;
+        leds[i].color = rb | gw;
+        leds[i].brightness = (from[i].brightness * inverse + to[i].brightness * weight) >> 8;
+    }
+}
+
+static void switch_keys(ws2811_led_t * leds, const ws2811_led_t * from, const ws2811_led_t * to, int count,
+                        const uint32_t * keys, uint32_t threshold){
+    int i;
+    for (i = 0; i < count; i++) leds[i] = keys[i] < threshold ? to[i] : from[i];
+}
+
+//the old frame moves offset columns to the left, the new frame follows it
+static void slide(ws2811_led_t * leds, const ws2811_led_t * from, const ws2811_led_t * to,
+                  const led_layout_t * layout, int offset){
+    int x, y, width = layout->width;
+
+    for (y = 0; y < layout->height; y++){
+        const int * row = &layout->index[y * width];
+        for (x = 0; x < width - offset; x++) leds[row[x]] = from[row[x + offset]];
+        for (; x < width; x++) leds[row[x]] = to[row[x + offset - width]];
+    }
+}
+
+void transition_frame(const transition_t * transition, ws2811_led_t * leds, int frame){
+    uint32_t progress;
+
+    if (transition->frames <= 0) return;
+    if (frame < 0) frame = 0;
+    if (frame > transition->frames) frame = transition->frames;
+    progress = transition->progress[frame];
+
+    switch (transition->type){
+        case TRANSITION_CROSSFADE:
+            crossfade(leds, transition->from, transition->to, transition->count, (progress + 128) >> 8);
+            break;
+        case TRANSITION_WIPE:
+        case TRANSITION_DISSOLVE:
+            switch_keys(leds, transition->from, transition->to, transition->count, transition->keys,
+                        (uint32_t) (((uint64_t) progress * transition->key_count + 32768) >> 16));
+            break;
+        case TRANSITION_SLIDE:
+            slide(leds, transition->from, transition->to, transition->layout,
+                  (int) (((uint64_t) progress * transition->layout->width + 32768) >> 16));
+            break;
+    }
+}
+
+void transition_free(transition_t * transition){
+    free(transition->from);
+    free(transition->to);
+    free(transition->keys);
+    free(transition->progress);
+    memset(transition, 0, sizeof(*transition));
+}
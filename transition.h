@@ -0,0 +1,49 @@
+//
+// Transitions between two frames of a channel: crossfade, wipe, slide and dissolve.
+// Everything that depends on the type is computed when the transition starts (the eased progress of every frame,
+// the order in which leds switch), a frame is blended in place into the led buffer without allocating memory.
+//
+
+#ifndef RPI_LEDMATRIX_SERVER_TRANSITION_H
+#define RPI_LEDMATRIX_SERVER_TRANSITION_H
+
+#include <stdint.h>
+#include "ws2811.h"
+#include "layout.h"
+#include "prng.h"
+
+#define TRANSITION_CROSSFADE 0      //blends every led from the old to the new color
+#define TRANSITION_WIPE      1      //the new frame covers the old one from left to right
+#define TRANSITION_SLIDE     2      //the new frame pushes the old one out to the left
+#define TRANSITION_DISSOLVE  3      //leds switch to the new frame one by one in random order
+
+typedef struct {
+    int type;
+    int count;                  //number of leds
+    int frames;                 //number of frames, 0 = no transition started
+    ws2811_led_t * from;        //frame when the transition started
+    ws2811_led_t * to;          //target frame
+    uint32_t * keys;            //wipe and dissolve: a led switches when the progress passes its key
+    uint32_t key_count;         //keys are 0..key_count-1
+    uint32_t * progress;        //progress at every frame, 0-65536, eased in and out
+    const led_layout_t * layout;
+} transition_t;
+
+//returns the type of a name (crossfade, wipe, slide, dissolve or the number), -1 if unknown
+int transition_type(const char * name);
+
+//captures count leds as the start frame of a transition of frames frames
+//layout is needed for wipe and slide, prng for dissolve
+//returns 0 on success, -1 on an invalid type or layout, -2 out of memory
+int transition_start(transition_t * transition, int type, const ws2811_led_t * leds, int count,
+                     const led_layout_t * layout, int frames, prng_t * prng);
+
+//captures the target frame
+void transition_set_target(transition_t * transition, const ws2811_led_t * leds);
+
+//blends frame (1..frames) into leds, the last frame is exactly the target
+void transition_frame(const transition_t * transition, ws2811_led_t * leds, int frame);
+
+void transition_free(transition_t * transition);
+
+#endif //RPI_LEDMATRIX_SERVER_TRANSITION_H
@@ -51,6 +51,7 @@
 #include "rpihw.h"
 
 #include "ws2811.h"
+#include "trace.h"
 
 
 #define BUS_TO_PHYS(x)                           ((x)&~0xC0000000)
@@ -113,6 +114,12 @@ typedef struct ws2811_device
     volatile cm_clk_t *cm_clk;
     videocore_mbox_t mbox;
     int max_count;
+    // Configuration the device was set up with, compared by ws2811_reconfigure()
+    uint32_t freq;
+    int dmanum;
+    int gpionum[RPI_PWM_CHANNELS];
+    int invert[RPI_PWM_CHANNELS];
+    int count[RPI_PWM_CHANNELS];
 } ws2811_device_t;
 
 /**
@@ -131,6 +138,36 @@ static uint64_t get_microsecond_timestamp()
     return (uint64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
 }
 
+static uint64_t get_nanosecond_timestamp()
+{
+    struct timespec t;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &t) != 0) {
+        return 0;
+    }
+
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/**
+ * Find the led whose pixel is shown at the position of led i in a scrolled matrix.
+ *
+ * @param    viewport  Scroll offset and mapping tables of the matrix.
+ * @param    i         Index of the led that is rendered.
+ *
+ * @returns  Index of the led buffer entry to render.
+ */
+static inline int viewport_led_index(const ws2811_viewport_t *viewport, int i)
+{
+    int x = viewport->led_x[i] + viewport->offset_x;
+    int y = viewport->led_y[i] + viewport->offset_y;
+
+    if (x >= viewport->width) x -= viewport->width;
+    if (y >= viewport->height) y -= viewport->height;
+
+    return viewport->index[y * viewport->width + x];
+}
+
 /**
  * Iterate through the channels and find the largest led count.
  *
@@ -749,6 +786,213 @@ static int check_hwver_and_gpionum(ws2811_t *ws2811)
     return -1;
 }
 
+/**
+ * Size of the VideoCore memory for the DMA control block and buffer, a multiple of the page size.
+ *
+ * @param    driver_mode  PWM or PCM.
+ * @param    max_count    Number of LEDs of the longest channel.
+ * @param    freq         LED frequency.
+ *
+ * @returns  Size in bytes.
+ */
+static uint32_t dma_memory_size(int driver_mode, int max_count, uint32_t freq)
+{
+    uint32_t size = sizeof(dma_cb_t);
+
+    switch (driver_mode) {
+    case PWM:
+        size += PWM_BYTE_COUNT(max_count, freq);
+        break;
+
+    case PCM:
+        size += PCM_BYTE_COUNT(max_count, freq);
+        break;
+    }
+    // Round up to page size multiple
+    return (size + (PAGE_SIZE - 1)) & ~(PAGE_SIZE - 1);
+}
+
+/**
+ * Derive the color shifts of a channel from its strip type.
+ *
+ * @param    channel  Channel to update.
+ *
+ * @returns  None
+ */
+static void set_channel_shifts(ws2811_channel_t *channel)
+{
+    if (!channel->strip_type)
+    {
+      channel->strip_type=WS2811_STRIP_RGB;
+    }
+
+    channel->wshift = (channel->strip_type >> 24) & 0xff;
+    channel->rshift = (channel->strip_type >> 16) & 0xff;
+    channel->gshift = (channel->strip_type >> 8)  & 0xff;
+    channel->bshift = (channel->strip_type >> 0)  & 0xff;
+}
+
+/**
+ * Remember the configuration the device is set up with.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  None
+ */
+static void remember_config(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    int chan;
+
+    device->freq = ws2811->freq;
+    device->dmanum = ws2811->dmanum;
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        device->gpionum[chan] = ws2811->channel[chan].gpionum;
+        device->invert[chan] = ws2811->channel[chan].invert;
+        device->count[chan] = ws2811->channel[chan].count;
+    }
+}
+
+/**
+ * Resize the LED buffer of a channel to its count, the LEDs that fit keep their color.
+ * Added LEDs are off with full brightness like after ws2811_init().
+ *
+ * @param    channel    Channel with the new count.
+ * @param    old_count  Number of LEDs in the buffer now.
+ *
+ * @returns  0 on success, -1 if out of memory (the buffer is not changed).
+ */
+static int resize_channel_leds(ws2811_channel_t *channel, int old_count)
+{
+    ws2811_led_t *leds;
+    int i;
+
+    if (channel->count == old_count && channel->leds)
+    {
+        return 0;
+    }
+
+    leds = realloc(channel->leds, sizeof(ws2811_led_t) * (channel->count > 0 ? channel->count : 1));
+    if (!leds)
+    {
+        return -1;
+    }
+    channel->leds = leds;
+
+    for (i = old_count; i < channel->count; i++)
+    {
+        channel->leds[i].color = 0;
+        channel->leds[i].brightness = 255;
+    }
+
+    return 0;
+}
+
+/**
+ * Replace the VideoCore memory of the DMA control block and buffer by a block of another size.
+ * The mailbox stays open, the controller must be stopped.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    size    New size, a multiple of the page size.
+ *
+ * @returns  0 on success, -1 otherwise (the mailbox is closed).
+ */
+static int resize_dma_memory(ws2811_t *ws2811, uint32_t size)
+{
+    ws2811_device_t *device = ws2811->device;
+    videocore_mbox_t *mbox = &device->mbox;
+
+    unmapmem(mbox->virt_addr, mbox->size);
+    mem_unlock(mbox->handle, mbox->mem_ref);
+    mem_free(mbox->handle, mbox->mem_ref);
+
+    mbox->size = size;
+    mbox->mem_ref = mem_alloc(mbox->handle, mbox->size, PAGE_SIZE,
+                              ws2811->rpi_hw->videocore_base == 0x40000000 ? 0xC : 0x4);
+    if (mbox->mem_ref == 0)
+    {
+        goto fail;
+    }
+
+    mbox->bus_addr = mem_lock(mbox->handle, mbox->mem_ref);
+    if (mbox->bus_addr == (uint32_t) ~0UL)
+    {
+        mem_free(mbox->handle, mbox->mem_ref);
+        goto fail;
+    }
+
+    mbox->virt_addr = mapmem(BUS_TO_PHYS(mbox->bus_addr), mbox->size, DEV_MEM);
+    if (!mbox->virt_addr)
+    {
+        mem_unlock(mbox->handle, mbox->mem_ref);
+        mem_free(mbox->handle, mbox->mem_ref);
+        goto fail;
+    }
+
+    device->dma_cb = (dma_cb_t *)mbox->virt_addr;
+    device->pxl_raw = (uint8_t *)mbox->virt_addr + sizeof(dma_cb_t);
+    memset((dma_cb_t *)device->dma_cb, 0, sizeof(dma_cb_t));
+    device->dma_cb_addr = addr_to_bus(device, device->dma_cb);
+
+    return 0;
+
+fail:
+    mbox_close(mbox->handle);
+    mbox->handle = -1;
+    device->dma_cb = NULL;
+    device->pxl_raw = NULL;
+    return -1;
+}
+
+/**
+ * Initialize everything again with ws2811_fini() and ws2811_init(), the LEDs and gamma tables are kept.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  0 on success, < 0 otherwise.
+ */
+static ws2811_return_t reinit(ws2811_t *ws2811)
+{
+    ws2811_led_t *leds[RPI_PWM_CHANNELS];
+    uint8_t *gamma[RPI_PWM_CHANNELS];
+    int count[RPI_PWM_CHANNELS];
+    ws2811_return_t ret;
+    int chan;
+
+    // ws2811_cleanup() frees the buffers, take them over
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        leds[chan] = ws2811->channel[chan].leds;
+        gamma[chan] = ws2811->channel[chan].gamma;
+        count[chan] = ws2811->device->count[chan];
+        ws2811->channel[chan].leds = NULL;
+        ws2811->channel[chan].gamma = NULL;
+    }
+
+    ws2811_fini(ws2811);
+    ret = ws2811_init(ws2811);
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        ws2811_channel_t *channel = &ws2811->channel[chan];
+
+        if (ret == WS2811_SUCCESS && channel->leds && leds[chan])
+        {
+            int n = count[chan] < channel->count ? count[chan] : channel->count;
+            memcpy(channel->leds, leds[chan], sizeof(ws2811_led_t) * n);
+        }
+        if (ret == WS2811_SUCCESS && channel->gamma && gamma[chan])
+        {
+            memcpy(channel->gamma, gamma[chan], WS2811_GAMMA_TABLE_SIZE);
+        }
+        free(leds[chan]);
+        free(gamma[chan]);
+    }
+
+    return ret;
+}
+
 static ws2811_return_t spi_init(ws2811_t *ws2811)
 {
     int spi_fd;
@@ -824,25 +1068,18 @@ static ws2811_return_t spi_init(ws2811_t *ws2811)
         return WS2811_ERROR_OUT_OF_MEMORY;
     }
     memset(channel->leds, 0, sizeof(ws2811_led_t) * channel->count);
-    if (!channel->strip_type)
-    {
-      channel->strip_type=WS2811_STRIP_RGB;
-    }
 
     // Set default uncorrected gamma table
     if (!channel->gamma)
     {
-      channel->gamma = malloc(sizeof(uint8_t) * 256);
+      channel->gamma = malloc(sizeof(uint8_t) * WS2811_GAMMA_TABLE_SIZE);
       int x;
-      for(x = 0; x < 256; x++){
-        channel->gamma[x] = x;
+      for(x = 0; x < WS2811_GAMMA_TABLE_SIZE; x++){
+        channel->gamma[x] = x & 0xff;
       }
     }
 
-    channel->wshift = (channel->strip_type >> 24) & 0xff;
-    channel->rshift = (channel->strip_type >> 16) & 0xff;
-    channel->gshift = (channel->strip_type >> 8)  & 0xff;
-    channel->bshift = (channel->strip_type >> 0)  & 0xff;
+    set_channel_shifts(channel);
 
     // Allocate SPI transmit buffer (same size as PCM)
     device->pxl_raw = malloc(PCM_BYTE_COUNT(device->max_count, ws2811->freq));
@@ -919,23 +1156,16 @@ ws2811_return_t ws2811_init(ws2811_t *ws2811)
     device->max_count = max_channel_led_count(ws2811);
 
     if (device->driver_mode == SPI) {
-        return spi_init(ws2811);
+        ws2811_return_t ret = spi_init(ws2811);
+        if (ret == WS2811_SUCCESS)
+        {
+            remember_config(ws2811);
+        }
+        return ret;
     }
 
     // Determine how much physical memory we need for DMA
-    switch (device->driver_mode) {
-    case PWM:
-        device->mbox.size = PWM_BYTE_COUNT(device->max_count, ws2811->freq) +
-                            sizeof(dma_cb_t);
-        break;
-
-    case PCM:
-        device->mbox.size = PCM_BYTE_COUNT(device->max_count, ws2811->freq) +
-                            sizeof(dma_cb_t);
-        break;
-    }
-    // Round up to page size multiple
-    device->mbox.size = (device->mbox.size + (PAGE_SIZE - 1)) & ~(PAGE_SIZE - 1);
+    device->mbox.size = dma_memory_size(device->driver_mode, device->max_count, ws2811->freq);
 
     device->mbox.handle = mbox_open();
     if (device->mbox.handle == -1)
@@ -989,28 +1219,19 @@ ws2811_return_t ws2811_init(ws2811_t *ws2811)
 
         memset(channel->leds, 0, sizeof(ws2811_led_t) * channel->count);
 
-        if (!channel->strip_type)
-        {
-          channel->strip_type=WS2811_STRIP_RGB;
-        }
-
 		for (i=0;i<channel->count;i++) channel->leds[i].brightness=255;
 		
         // Set default uncorrected gamma table
         if (!channel->gamma)
         {
-          channel->gamma = malloc(sizeof(uint8_t) * 256);
+          channel->gamma = malloc(sizeof(uint8_t) * WS2811_GAMMA_TABLE_SIZE);
           int x;
-          for(x = 0; x < 256; x++){
-            channel->gamma[x] = x;
+          for(x = 0; x < WS2811_GAMMA_TABLE_SIZE; x++){
+            channel->gamma[x] = x & 0xff;
           }
         }
 
-        channel->wshift = (channel->strip_type >> 24) & 0xff;
-        channel->rshift = (channel->strip_type >> 16) & 0xff;
-        channel->gshift = (channel->strip_type >> 8)  & 0xff;
-        channel->bshift = (channel->strip_type >> 0)  & 0xff;
-
+        set_channel_shifts(channel);
     }
 
     device->dma_cb = (dma_cb_t *)device->mbox.virt_addr;
@@ -1067,9 +1288,149 @@ ws2811_return_t ws2811_init(ws2811_t *ws2811)
         break;
     }
 
+    remember_config(ws2811);
     return WS2811_SUCCESS;
 }
 
+/**
+ * Apply a changed configuration (frequency, LED count, strip type, invert) of an initialized instance.
+ * Only what changed is set up again: the LED buffers are resized, the DMA memory is only replaced when it must grow
+ * and the clock and PWM/PCM are only programmed again when the frequency, inversion or buffer size changed.
+ * The LEDs keep their colors. Another GPIO or DMA channel needs a full ws2811_fini() / ws2811_init(),
+ * this is done with the LEDs and gamma tables kept.
+ *
+ * @param    ws2811  ws2811 instance pointer, not initialized calls ws2811_init().
+ *
+ * @returns  0 on success, < 0 otherwise (the instance is not initialized after a hardware error).
+ */
+ws2811_return_t ws2811_reconfigure(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    ws2811_return_t ret = WS2811_SUCCESS;
+    int chan, max_count, setup = 0;
+
+    if (!device)
+    {
+        return ws2811_init(ws2811);
+    }
+
+    // The pins, the DMA channel and the driver (chosen by the pins) are set up by ws2811_init()
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        if (ws2811->channel[chan].gpionum != device->gpionum[chan])
+        {
+            return reinit(ws2811);
+        }
+    }
+    if (ws2811->dmanum != device->dmanum || (ws2811->channel[0].count == 0) != (device->count[0] == 0))
+    {
+        return reinit(ws2811);
+    }
+
+    ws2811_wait(ws2811);
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        ws2811_channel_t *channel = &ws2811->channel[chan];
+
+        if (device->driver_mode != PWM && chan > 0)
+        {
+            break;  // PCM and SPI only use the first channel
+        }
+        if (resize_channel_leds(channel, device->count[chan]))
+        {
+            channel->count = device->count[chan];
+            return WS2811_ERROR_OUT_OF_MEMORY;
+        }
+        device->count[chan] = channel->count;
+        set_channel_shifts(channel);
+        if (channel->invert != device->invert[chan])
+        {
+            setup = 1;
+        }
+    }
+
+    max_count = max_channel_led_count(ws2811);
+    if (max_count != device->max_count || ws2811->freq != device->freq)
+    {
+        setup = 1;
+    }
+
+    switch (device->driver_mode) {
+    case SPI:
+        if (ws2811->freq != device->freq)
+        {
+            uint32_t speed = ws2811->freq * 3;
+            if (ioctl(device->spi_fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) < 0)
+            {
+                ws2811->freq = device->freq;  // keep sending at the old frequency
+                ret = WS2811_ERROR_SPI_SETUP;
+            }
+        }
+        if (max_count != device->max_count || ws2811->freq != device->freq)
+        {
+            volatile uint8_t *pxl_raw = realloc((uint8_t *)device->pxl_raw, PCM_BYTE_COUNT(max_count, ws2811->freq));
+            if (!pxl_raw)
+            {
+                // The old buffer fits the old frequency and count.  The leds were already resized: fewer leds
+                // fit in the old buffer, more leds go back to the old count (the larger led array covers it).
+                ws2811->freq = device->freq;
+                if (ws2811->channel[0].count > device->max_count)
+                {
+                    ws2811->channel[0].count = device->max_count;
+                    device->count[0] = device->max_count;
+                }
+                pcm_raw_init(ws2811);  // no stale symbols of removed leds
+                return WS2811_ERROR_OUT_OF_MEMORY;
+            }
+            device->pxl_raw = pxl_raw;
+            device->max_count = max_count;
+            pcm_raw_init(ws2811);
+        }
+        break;
+
+    case PWM:
+    case PCM:
+        if (!setup)
+        {
+            break;
+        }
+        if (device->driver_mode == PWM)
+        {
+            stop_pwm(ws2811);
+        }
+        else
+        {
+            stop_pcm(ws2811);
+        }
+
+        // A smaller buffer fits in the memory that is already there
+        if (dma_memory_size(device->driver_mode, max_count, ws2811->freq) > device->mbox.size &&
+            resize_dma_memory(ws2811, dma_memory_size(device->driver_mode, max_count, ws2811->freq)))
+        {
+            unmap_registers(ws2811);
+            ws2811_cleanup(ws2811);
+            return WS2811_ERROR_OUT_OF_MEMORY;
+        }
+        device->max_count = max_count;
+
+        if (device->driver_mode == PWM)
+        {
+            pwm_raw_init(ws2811);
+            setup_pwm(ws2811);
+        }
+        else
+        {
+            pcm_raw_init(ws2811);
+            setup_pcm(ws2811);
+        }
+        break;
+    }
+
+    remember_config(ws2811);
+    return ret;
+}
+
 /**
  * Shut down DMA, PWM, and cleanup memory.
  *
@@ -1099,6 +1460,7 @@ void ws2811_fini(ws2811_t *ws2811)
 
 /**
  * Wait for any executing DMA operation to complete before returning.
+ * The time spent waiting is stored in wait_time.
  *
  * @param    ws2811  ws2811 instance pointer.
  *
@@ -1107,17 +1469,23 @@ void ws2811_fini(ws2811_t *ws2811)
 ws2811_return_t ws2811_wait(ws2811_t *ws2811)
 {
     volatile dma_t *dma = ws2811->device->dma;
+    uint64_t start;
 
+    ws2811->wait_time = 0;
     if (ws2811->device->driver_mode == SPI)  // Nothing to do for SPI
     {
         return WS2811_SUCCESS;
     }
 
+    start = get_nanosecond_timestamp();
+    TRACE_BEGIN("dma_wait");    // Ends when the previous transfer is complete
     while ((dma->cs & RPI_DMA_CS_ACTIVE) &&
            !(dma->cs & RPI_DMA_CS_ERROR))
     {
         usleep(10);
     }
+    TRACE_END();
+    ws2811->wait_time = get_nanosecond_timestamp() - start;
 
     if (dma->cs & RPI_DMA_CS_ERROR)
     {
@@ -1129,59 +1497,56 @@ ws2811_return_t ws2811_wait(ws2811_t *ws2811)
 }
 
 /**
- * Render the DMA buffer from the user supplied LED arrays and start the DMA
- * controller.  This will update all LEDs on both PWM channels.
+ * Encode the user supplied LED arrays to the symbols of the selected driver.
  *
- * @param    ws2811  ws2811 instance pointer.
+ * @param    ws2811      ws2811 instance pointer.
+ * @param    pxl_raw     Buffer of ws2811_raw_size() bytes, initialized like the DMA buffer.
+ * @param    level_sums  If not NULL the power limiter is applied and the sum of all sent color levels
+ *                       of every channel is stored here.
  *
  * @returns  None
  */
-ws2811_return_t  ws2811_render(ws2811_t *ws2811)
+static void encode_leds(ws2811_t *ws2811, volatile uint8_t *pxl_raw, uint32_t *level_sums)
 {
-    volatile uint8_t *pxl_raw = ws2811->device->pxl_raw;
     int driver_mode = ws2811->device->driver_mode;
     int bitpos;
     int i, k, l, chan;
     unsigned j;
-    ws2811_return_t ret = WS2811_SUCCESS;
-    uint32_t protocol_time = 0;
-    static uint64_t previous_timestamp = 0;
 
     bitpos = (driver_mode == SPI ? 7 : 31);
 
     for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)         // Channel
     {
         ws2811_channel_t *channel = &ws2811->channel[chan];
+        const uint64_t start = get_nanosecond_timestamp();
 
+        TRACE_BEGIN_ARG("encode", chan + 1);
         int wordpos = chan; // PWM & PCM
         int bytepos = 0;    // SPI
-        const int scale = (channel->brightness & 0xff) + 1;
-        uint8_t array_size = 3; // Assume 3 color LEDs, RGB
+        int scale = (channel->brightness & 0xff) + 1;
+        uint32_t level_sum = 0;
 
-        // If our shift mask includes the highest nibble, then we have 4 LEDs, RBGW.
-        if (channel->strip_type & SK6812_SHIFT_WMASK)
+        if (level_sums && channel->power.scale && channel->power.scale < 256)
         {
-            array_size = 4;
+            scale = (scale * channel->power.scale) >> 8;
+            if (scale < 1) scale = 1;
         }
 
-        // 1.25µs per bit
-        const uint32_t channel_protocol_time = channel->count * array_size * 8 * 1.25;
-
-        // Only using the channel which takes the longest as both run in parallel
-        if (channel_protocol_time > protocol_time)
-        {
-            protocol_time = channel_protocol_time;
-        }
+        // A scrolled matrix is rendered through its viewport instead of moving the pixels in the led buffer
+        const ws2811_viewport_t *viewport = channel->viewport;
+        const int scrolled = viewport && (viewport->offset_x || viewport->offset_y) &&
+                             channel->count == viewport->width * viewport->height;
 
         for (i = 0; i < channel->count; i++)                // Led
         {
-            const int brightness = scale * (channel->leds[i].brightness & 0xff) + 1;
+            const ws2811_led_t *led = &channel->leds[scrolled ? viewport_led_index(viewport, i) : i];
+            const int brightness = scale * (led->brightness & 0xff) + 1;
             uint8_t color[] =
             {
-                channel->gamma[(((channel->leds[i].color >> channel->rshift) & 0xff) * brightness) >> 16], // red
-                channel->gamma[(((channel->leds[i].color >> channel->gshift) & 0xff) * brightness) >> 16], // green
-                channel->gamma[(((channel->leds[i].color >> channel->bshift) & 0xff) * brightness) >> 16], // blue
-                channel->gamma[(((channel->leds[i].color >> channel->wshift) & 0xff) * brightness) >> 16], // white
+                channel->gamma[WS2811_GAMMA_RED + ((((led->color >> channel->rshift) & 0xff) * brightness) >> 16)],
+                channel->gamma[WS2811_GAMMA_GREEN + ((((led->color >> channel->gshift) & 0xff) * brightness) >> 16)],
+                channel->gamma[WS2811_GAMMA_BLUE + ((((led->color >> channel->bshift) & 0xff) * brightness) >> 16)],
+                channel->gamma[WS2811_GAMMA_WHITE + ((((led->color >> channel->wshift) & 0xff) * brightness) >> 16)],
             };
             uint8_t array_size = 3; // Assume 3 color LEDs, RGB
 
@@ -1194,6 +1559,8 @@ ws2811_return_t  ws2811_render(ws2811_t *ws2811)
 
             for (j = 0; j < array_size; j++)               // Color
             {
+                level_sum += color[j];
+
                 for (k = 7; k >= 0; k--)                   // Bit
                 {
                     // Inversion is handled by hardware for PWM, otherwise by software here
@@ -1247,12 +1614,146 @@ ws2811_return_t  ws2811_render(ws2811_t *ws2811)
                 }
             }
         }
+
+        if (level_sums)
+        {
+            level_sums[chan] = level_sum;
+        }
+        channel->encode_time = get_nanosecond_timestamp() - start;
+        TRACE_END();
     }
+}
 
-    // Wait for any previous DMA operation to complete.
-    if ((ret = ws2811_wait(ws2811)) != WS2811_SUCCESS)
+/**
+ * Update the power limiter of all channels from the levels of the frame that was just encoded.
+ * A frame above the budget is dimmed at once by budget / current and encoded again, see reduce_power.
+ * A dimmed channel gets brighter again slowly, 1/16 of the way to full brightness every frame.
+ *
+ * @param    ws2811      ws2811 instance pointer.
+ * @param    level_sums  Sum of all sent color levels of every channel.
+ *
+ * @returns  1 if the frame must be encoded again with a lower brightness
+ */
+static int limit_power(ws2811_t *ws2811, const uint32_t *level_sums)
+{
+    int chan, encode = 0;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
     {
-        return ret;
+        ws2811_power_t *power = &ws2811->channel[chan].power;
+        uint32_t scale = power->scale && power->scale < 256 ? power->scale : 256;
+        uint32_t current;
+
+        if (!power->max_current || !power->led_current)
+        {
+            power->scale = 0;
+            power->current = power->demand = 0;
+            continue;
+        }
+
+        current = (uint64_t)level_sums[chan] * power->led_current / 255;
+        power->current = current;
+        power->demand = (uint64_t)current * 256 / scale;
+
+        if (current > power->max_current)
+        {
+            scale = (uint64_t)scale * power->max_current / current;
+            power->scale = scale ? scale : 1;
+            power->limited_frames++;
+            encode = 1;
+        }
+        else if (scale < 256)
+        {
+            // the next frame may draw at most the budget if it has the same content
+            uint32_t allowed = current ? (uint64_t)scale * power->max_current / current : 256;
+            scale += (256 - scale) / 16 + 1;
+            if (scale > allowed) scale = allowed;
+            power->scale = scale < 256 ? scale : 256;
+            power->limited_frames++;
+        }
+    }
+    return encode;
+}
+
+/**
+ * Check the levels of a frame that was encoded again by the power limiter.  With a gamma table that
+ * isn't linear (an exponent below 1 or a loaded table) the levels don't drop in proportion to the
+ * brightness, so a channel that is still above its budget gets a lower scale: budget / current, but at
+ * least a quarter lower than before so a table that hardly changes with the level ends after ~20 passes.
+ *
+ * @param    ws2811      ws2811 instance pointer.
+ * @param    level_sums  Sum of all sent color levels of every channel.
+ *
+ * @returns  1 if the frame must be encoded again, 0 if all channels are within their budget,
+ *           -1 if a channel is above its budget at the lowest scale
+ */
+static int reduce_power(ws2811_t *ws2811, const uint32_t *level_sums)
+{
+    int chan, encode = 0;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        ws2811_power_t *power = &ws2811->channel[chan].power;
+        uint32_t scale = power->scale && power->scale < 256 ? power->scale : 256;
+        uint32_t current, lower;
+
+        if (!power->max_current || !power->led_current)
+        {
+            continue;
+        }
+
+        current = (uint64_t)level_sums[chan] * power->led_current / 255;
+        power->current = current;
+        if (current <= power->max_current)
+        {
+            continue;
+        }
+        if (scale <= 1)
+        {
+            return -1;
+        }
+
+        lower = (uint64_t)scale * power->max_current / current;
+        if (lower > scale - scale / 4 - 1) lower = scale - scale / 4 - 1;
+        power->scale = lower ? lower : 1;
+        encode = 1;
+    }
+    return encode;
+}
+
+/**
+ * Wait until the previous transfer has reached the leds and start sending the DMA buffer.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  0 on success, < 0 on error
+ */
+static ws2811_return_t start_transfer(ws2811_t *ws2811)
+{
+    ws2811_return_t ret = WS2811_SUCCESS;
+    uint32_t protocol_time = 0;
+    static uint64_t previous_timestamp = 0;
+    int chan;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)         // Channel
+    {
+        ws2811_channel_t *channel = &ws2811->channel[chan];
+        uint8_t array_size = 3; // Assume 3 color LEDs, RGB
+
+        // If our shift mask includes the highest nibble, then we have 4 LEDs, RBGW.
+        if (channel->strip_type & SK6812_SHIFT_WMASK)
+        {
+            array_size = 4;
+        }
+
+        // 1.25µs per bit
+        const uint32_t channel_protocol_time = channel->count * array_size * 8 * 1.25;
+
+        // Only using the channel which takes the longest as both run in parallel
+        if (channel_protocol_time > protocol_time)
+        {
+            protocol_time = channel_protocol_time;
+        }
     }
 
     if (ws2811->render_wait_time != 0) {
@@ -1264,13 +1765,16 @@ ws2811_return_t  ws2811_render(ws2811_t *ws2811)
         }
     }
 
-    if (driver_mode != SPI)
+    if (ws2811->device->driver_mode != SPI)
     {
+        TRACE_INSTANT("dma_start");
         dma_start(ws2811);
     }
     else
     {
+        TRACE_BEGIN("spi_transfer");
         ret = spi_transfer(ws2811);
+        TRACE_END();
     }
 
     // LED_RESET_WAIT_TIME is added to allow enough time for the reset to occur.
@@ -1280,6 +1784,161 @@ ws2811_return_t  ws2811_render(ws2811_t *ws2811)
     return ret;
 }
 
+/**
+ * Render the DMA buffer from the user supplied LED arrays and start the DMA
+ * controller.  This will update all LEDs on both PWM channels.
+ * Channels with a power budget are dimmed by the power limiter, see limit_power.  A frame that
+ * is still above the budget at the lowest brightness is not sent.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  0 on success, < 0 on error
+ */
+ws2811_return_t  ws2811_render(ws2811_t *ws2811)
+{
+    ws2811_return_t ret;
+    uint32_t level_sums[RPI_PWM_CHANNELS];
+    uint32_t encode_times[RPI_PWM_CHANNELS];
+    int chan, encode;
+
+    encode_leds(ws2811, ws2811->device->pxl_raw, level_sums);
+    if (limit_power(ws2811, level_sums))
+    {
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+        {
+            encode_times[chan] = ws2811->channel[chan].encode_time;
+        }
+        do
+        {
+            encode_leds(ws2811, ws2811->device->pxl_raw, level_sums);
+            for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+            {
+                encode_times[chan] += ws2811->channel[chan].encode_time; // All passes count
+            }
+        } while ((encode = reduce_power(ws2811, level_sums)) > 0);
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+        {
+            ws2811->channel[chan].encode_time = encode_times[chan];
+        }
+        if (encode < 0)
+        {
+            return WS2811_ERROR_POWER_LIMIT;
+        }
+    }
+
+    // Wait for any previous DMA operation to complete.
+    if ((ret = ws2811_wait(ws2811)) != WS2811_SUCCESS)
+    {
+        return ret;
+    }
+
+    return start_transfer(ws2811);
+}
+
+/**
+ * Size of the DMA buffer, the size of a pre-encoded frame.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  Number of bytes
+ */
+size_t ws2811_raw_size(ws2811_t *ws2811)
+{
+    if (ws2811->device->driver_mode == PWM)
+    {
+        return PWM_BYTE_COUNT(ws2811->device->max_count, ws2811->freq);
+    }
+    return PCM_BYTE_COUNT(ws2811->device->max_count, ws2811->freq);
+}
+
+/**
+ * Get the settings that change the encoded DMA buffer.  A pre-encoded frame can only be sent
+ * with exactly the same configuration.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    config  Configuration to fill in.
+ *
+ * @returns  None
+ */
+void ws2811_get_raw_config(ws2811_t *ws2811, ws2811_raw_config_t *config)
+{
+    int chan, i;
+
+    memset(config, 0, sizeof(*config));
+    config->driver_mode = ws2811->device->driver_mode;
+    config->freq = ws2811->freq;
+    config->raw_size = ws2811_raw_size(ws2811);
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        ws2811_channel_t *channel = &ws2811->channel[chan];
+        uint32_t hash = 2166136261u; // FNV-1a of the gamma table
+
+        config->channel[chan].count = channel->count;
+        config->channel[chan].strip_type = channel->strip_type;
+        config->channel[chan].invert = channel->invert;
+        config->channel[chan].brightness = channel->brightness;
+        for (i = 0; channel->gamma && i < WS2811_GAMMA_TABLE_SIZE; i++)
+        {
+            hash = (hash ^ channel->gamma[i]) * 16777619u;
+        }
+        config->channel[chan].gamma_hash = hash;
+    }
+}
+
+/**
+ * Encode the user supplied LED arrays to a buffer instead of the DMA buffer, nothing is sent.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    raw     Buffer of ws2811_raw_size() bytes, it is initialized with the DMA buffer
+ *                   when init is set (the idle and reset bits are kept from there).
+ * @param    init    Copy the DMA buffer to raw before encoding.
+ *
+ * The power limiter is not applied, ws2811_render_raw doesn't send frames while a channel has a budget.
+ *
+ * @returns  None
+ */
+void ws2811_encode(ws2811_t *ws2811, uint8_t *raw, int init)
+{
+    if (init)
+    {
+        memcpy(raw, (const void *)ws2811->device->pxl_raw, ws2811_raw_size(ws2811));
+    }
+    encode_leds(ws2811, raw, NULL);
+}
+
+/**
+ * Send a frame encoded with ws2811_encode, the leds are not encoded again.
+ * The levels of a pre-encoded frame aren't known, so nothing is sent while a channel has a power budget.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    raw     ws2811_raw_size() bytes encoded with the current configuration.
+ *
+ * @returns  0 on success, < 0 on error
+ */
+ws2811_return_t ws2811_render_raw(ws2811_t *ws2811, const uint8_t *raw)
+{
+    ws2811_return_t ret;
+    int chan;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        if (ws2811->channel[chan].power.max_current)
+        {
+            return WS2811_ERROR_POWER_LIMIT;
+        }
+    }
+
+    // The DMA buffer can't be changed before the previous frame is sent
+    if ((ret = ws2811_wait(ws2811)) != WS2811_SUCCESS)
+    {
+        return ret;
+    }
+
+    memcpy((void *)ws2811->device->pxl_raw, raw, ws2811_raw_size(ws2811));
+
+    return start_transfer(ws2811);
+}
+
 const char * ws2811_get_return_t_str(const ws2811_return_t state)
 {
     const int index = -state;
@@ -35,6 +35,8 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
+
 #include "rpihw.h"
 #include "pwm.h"
 
@@ -63,6 +65,13 @@ extern "C" {
 #define SK6812_STRIP                             WS2811_STRIP_GRB
 #define SK6812W_STRIP                            SK6812_STRIP_GRBW
 
+// Offsets of the per color tables in ws2811_channel_t.gamma
+#define WS2811_GAMMA_RED                         0
+#define WS2811_GAMMA_GREEN                       256
+#define WS2811_GAMMA_BLUE                        512
+#define WS2811_GAMMA_WHITE                       768
+#define WS2811_GAMMA_TABLE_SIZE                  1024
+
 struct ws2811_device;
 
 typedef struct
@@ -72,6 +81,30 @@ typedef struct
 }ws2811_led_t;
 
 
+// Logical scroll offset of a led matrix, applied while rendering so scrolling doesn't have to move the pixels
+typedef struct
+{
+    int width;                                   //< Width of the matrix
+    int height;                                  //< Height of the matrix
+    const int *index;                            //< Led index of (x,y), row by row
+    const uint16_t *led_x;                       //< x of every led in the matrix
+    const uint16_t *led_y;                       //< y of every led in the matrix
+    int offset_x;                                //< Led at (x,y) shows the pixel stored at (x+offset_x,y+offset_y)
+    int offset_y;
+} ws2811_viewport_t;
+
+// Power limiter of a channel: the current of every frame is estimated from the levels sent to the leds,
+// frames above the budget are dimmed before they are sent
+typedef struct
+{
+    uint32_t max_current;                        //< Budget in mA, 0 = no limit
+    uint32_t led_current;                        //< mA of one color of a led at full level
+    uint32_t scale;                              //< Brightness scale of the limiter, 1-256 (256 or 0 = not dimmed)
+    uint32_t current;                            //< Estimated mA of the last rendered frame
+    uint32_t demand;                             //< Estimated mA the last frame would draw without the limiter
+    uint32_t limited_frames;                     //< Number of rendered frames that were dimmed
+} ws2811_power_t;
+
 typedef struct
 {
 	int color_size;                              //3 = RGB, 4 = RGBW
@@ -85,12 +118,16 @@ typedef struct
     uint8_t rshift;                              //< Red shift value
     uint8_t gshift;                              //< Green shift value
     uint8_t bshift;                              //< Blue shift value
-    uint8_t *gamma;                              //< Gamma correction table
+    uint8_t *gamma;                              //< Gamma correction tables, 256 entries for every color, see WS2811_GAMMA_*
+    ws2811_viewport_t *viewport;                 //< Optional scroll offset of a matrix, NULL if not used
+    ws2811_power_t power;                        //< Optional power limiter
+    uint32_t encode_time;                        //< ns to encode the leds of the last frame
 } ws2811_channel_t;
 
 typedef struct
 {
     uint64_t render_wait_time;                   //< time in µs before the next render can run
+    uint32_t wait_time;                          //< ns the last ws2811_wait waited for the DMA transfer
     struct ws2811_device *device;                //< Private data for driver use
     const rpi_hw_t *rpi_hw;                      //< RPI Hardware Information
     uint32_t freq;                               //< Required output frequency
@@ -98,6 +135,22 @@ typedef struct
     ws2811_channel_t channel[RPI_PWM_CHANNELS];
 } ws2811_t;
 
+// Settings that change the encoded DMA buffer, see ws2811_get_raw_config
+typedef struct
+{
+    uint32_t driver_mode;
+    uint32_t freq;
+    uint32_t raw_size;
+    struct
+    {
+        int32_t count;
+        int32_t strip_type;
+        int32_t invert;
+        int32_t brightness;
+        uint32_t gamma_hash;
+    } channel[RPI_PWM_CHANNELS];
+} ws2811_raw_config_t;
+
 #define WS2811_RETURN_STATES(X)                                                             \
             X(0, WS2811_SUCCESS, "Success"),                                                \
             X(-1, WS2811_ERROR_GENERIC, "Generic failure"),                                 \
@@ -113,7 +166,8 @@ typedef struct
             X(-11, WS2811_ERROR_ILLEGAL_GPIO, "Selected GPIO not possible"),                \
             X(-12, WS2811_ERROR_PCM_SETUP, "Unable to initialize PCM"),                     \
             X(-13, WS2811_ERROR_SPI_SETUP, "Unable to initialize SPI"),                     \
-            X(-14, WS2811_ERROR_SPI_TRANSFER, "SPI transfer error")                         \
+            X(-14, WS2811_ERROR_SPI_TRANSFER, "SPI transfer error"),                        \
+            X(-15, WS2811_ERROR_POWER_LIMIT, "Frame doesn't fit in the power budget")        \
 
 #define WS2811_RETURN_STATES_ENUM(state, name, str) name = state
 #define WS2811_RETURN_STATES_STRING(state, name, str) str
@@ -126,10 +180,16 @@ typedef enum {
 
 ws2811_return_t ws2811_init(ws2811_t *ws2811);                         //< Initialize buffers/hardware
 void ws2811_fini(ws2811_t *ws2811);                                    //< Tear it all down
+ws2811_return_t ws2811_reconfigure(ws2811_t *ws2811);                 //< Apply changed settings, only redoes what changed
 ws2811_return_t ws2811_render(ws2811_t *ws2811);                       //< Send LEDs off to hardware
 ws2811_return_t ws2811_wait(ws2811_t *ws2811);                         //< Wait for DMA completion
 const char * ws2811_get_return_t_str(const ws2811_return_t state);     //< Get string representation of the given return state
 
+size_t ws2811_raw_size(ws2811_t *ws2811);                              //< Size of an encoded frame (the DMA buffer)
+void ws2811_get_raw_config(ws2811_t *ws2811, ws2811_raw_config_t *config); //< Settings an encoded frame depends on
+void ws2811_encode(ws2811_t *ws2811, uint8_t *raw, int init);         //< Encode LEDs to a buffer without sending them
+ws2811_return_t ws2811_render_raw(ws2811_t *ws2811, const uint8_t *raw); //< Send a frame encoded with ws2811_encode
+
 #ifdef __cplusplus
 }
 #endif